@@ -365,13 +365,24 @@ export type UpdateDisconnectedBarPayload = { +visible: boolean };
 
 export type OneTimeKeyGenerator = (inc: number) => string;
 
+export type ProcessedIncomingMessages = {
+  +messageIDs: $ReadOnlyArray<string>,
+  +threadIDs: $ReadOnlyArray<string>,
+};
+
 export type GRPCStream = {
   readyState: number,
   onopen: (ev: any) => mixed,
   onmessage: (ev: MessageEvent) => mixed,
   onclose: (ev: CloseEvent) => mixed,
+  // Setting it makes encrypted messages get decrypted and stored natively,
+  // onmessage only gets the messages that couldn't be processed
+  onprocessed?: ?(summary: ProcessedIncomingMessages) => mixed,
   close(code?: number, reason?: string): void,
-  send(data: string | Blob | ArrayBuffer | $ArrayBufferView): void,
+  send(
+    data: string | Blob | ArrayBuffer | $ArrayBufferView,
+    onSent?: (error: ?string) => mixed,
+  ): void,
 };
 
 export type CommTransportLayer = GRPCStream | WebSocket;
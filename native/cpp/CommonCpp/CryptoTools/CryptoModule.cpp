@@ -2,11 +2,19 @@
 #include "PlatformSpecificTools.h"
 #include "olm/session.hh"
 
+#include <algorithm>
+#include <mutex>
 #include <stdexcept>
 
 namespace comm {
 namespace crypto {
 
+namespace {
+// Olm overwrites the messages it reads, so they're copied here first. It's
+// kept per thread, so after the first few messages the copies don't allocate.
+thread_local OlmBuffer scratchMessage;
+} // namespace
+
 CryptoModule::CryptoModule(std::string id) : id{id} {
   this->createAccount();
 }
@@ -35,6 +43,7 @@ void CryptoModule::createAccount() {
       ::olm_create_account(this->account, randomBuffer.data(), randomSize)) {
     throw std::runtime_error{"error createAccount => ::olm_create_account"};
   };
+  this->accountDirty = true;
 }
 
 void CryptoModule::exposePublicIdentityKeys() {
@@ -55,11 +64,22 @@ void CryptoModule::exposePublicIdentityKeys() {
 }
 
 void CryptoModule::generateOneTimeKeys(size_t oneTimeKeysAmount) {
+  // Olm keeps a limited number of keys and drops the oldest ones to make room
+  // for the new ones. Published keys are older than the unpublished ones, so
+  // they are dropped first.
+  size_t maxOneTimeKeys =
+      ::olm_account_max_number_of_one_time_keys(this->account);
+  size_t storedOneTimeKeys =
+      this->countUnpublishedOneTimeKeys() + this->publishedOneTimeKeysCount;
+  if (storedOneTimeKeys + oneTimeKeysAmount > maxOneTimeKeys) {
+    size_t droppedOneTimeKeys =
+        storedOneTimeKeys + oneTimeKeysAmount - maxOneTimeKeys;
+    this->publishedOneTimeKeysCount -=
+        std::min(droppedOneTimeKeys, this->publishedOneTimeKeysCount);
+  }
+
   size_t oneTimeKeysSize = ::olm_account_generate_one_time_keys_random_length(
       this->account, oneTimeKeysAmount);
-  if (this->keys.oneTimeKeys.size() == oneTimeKeysSize) {
-    return;
-  }
   OlmBuffer random;
   PlatformSpecificTools::generateSecureRandomBytes(random, oneTimeKeysSize);
 
@@ -69,6 +89,15 @@ void CryptoModule::generateOneTimeKeys(size_t oneTimeKeysAmount) {
     throw std::runtime_error{
         "error generateOneTimeKeys => ::olm_account_generate_one_time_keys"};
   }
+  this->accountDirty = true;
+}
+
+size_t CryptoModule::countUnpublishedOneTimeKeys() {
+  // The keys are returned as {"curve25519":{"<id>":"<key>",...}}, where each
+  // id has 6 characters, so the JSON is 16 characters long plus 55 for each
+  // key
+  return (::olm_account_one_time_keys_length(this->account) - 16) /
+      (KEYSIZE + ONE_TIME_KEYS_MIDDLE_OFFSET);
 }
 
 // returns number of published keys
@@ -83,6 +112,7 @@ size_t CryptoModule::publishOneTimeKeys() {
     throw std::runtime_error{
         "error publishOneTimeKeys => ::olm_account_one_time_keys"};
   }
+  this->accountDirty = true;
   return ::olm_account_mark_keys_as_published(this->account);
 }
 
@@ -95,34 +125,67 @@ Keys CryptoModule::keysFromStrings(
 }
 
 std::string CryptoModule::getIdentityKeys() {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
   this->exposePublicIdentityKeys();
   return std::string{
       this->keys.identityKeys.begin(), this->keys.identityKeys.end()};
 }
 
 std::string CryptoModule::getOneTimeKeys(size_t oneTimeKeysAmount) {
-  this->generateOneTimeKeys(oneTimeKeysAmount);
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  size_t maxOneTimeKeys =
+      ::olm_account_max_number_of_one_time_keys(this->account);
+  if (oneTimeKeysAmount > maxOneTimeKeys) {
+    throw std::runtime_error{
+        "error generateKeys => can't publish more than " +
+        std::to_string(maxOneTimeKeys) + " one-time keys"};
+  }
+  size_t unpublishedOneTimeKeys = this->countUnpublishedOneTimeKeys();
+  if (unpublishedOneTimeKeys < oneTimeKeysAmount) {
+    // the pool wasn't refilled in time
+    this->generateOneTimeKeys(oneTimeKeysAmount - unpublishedOneTimeKeys);
+  }
   size_t publishedOneTimeKeys = this->publishOneTimeKeys();
-  if (publishedOneTimeKeys != oneTimeKeysAmount) {
+  if (publishedOneTimeKeys < oneTimeKeysAmount) {
     throw std::runtime_error{
         "error generateKeys => invalid amount of one-time keys published. "
-        "Expected " +
+        "Expected at least " +
         std::to_string(oneTimeKeysAmount) + ", got " +
         std::to_string(publishedOneTimeKeys)};
   }
+  this->publishedOneTimeKeysCount += publishedOneTimeKeys;
 
   return std::string{
       this->keys.oneTimeKeys.begin(), this->keys.oneTimeKeys.end()};
 }
 
+bool CryptoModule::replenishOneTimeKeys() {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  size_t unpublishedOneTimeKeys = this->countUnpublishedOneTimeKeys();
+  if (unpublishedOneTimeKeys >= oneTimeKeysPoolWatermark) {
+    return false;
+  }
+  // It may drop the oldest published keys, the most recently published ones
+  // are always kept. They are the ones other devices are most likely to use.
+  this->generateOneTimeKeys(oneTimeKeysPoolSize - unpublishedOneTimeKeys);
+  return true;
+}
+
+size_t CryptoModule::getPublishedOneTimeKeysCount() {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  return this->publishedOneTimeKeysCount;
+}
+
 void CryptoModule::initializeInboundForReceivingSession(
     const std::string &targetUserId,
     const OlmBuffer &encryptedMessage,
     const OlmBuffer &idKeys,
     const bool overwrite) {
-  if (this->hasSessionFor(targetUserId)) {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  if (this->sessionExists(targetUserId)) {
     if (overwrite) {
-      this->sessions.erase(this->sessions.find(targetUserId));
+      this->removeSession(targetUserId);
     } else {
       throw std::runtime_error{
           "error initializeInboundForReceivingSession => session already "
@@ -131,7 +194,16 @@ void CryptoModule::initializeInboundForReceivingSession(
   }
   std::unique_ptr<Session> newSession = Session::createSessionAsResponder(
       this->account, this->keys.identityKeys.data(), encryptedMessage, idKeys);
-  this->sessions.insert(make_pair(targetUserId, std::move(newSession)));
+  // the one-time key can't be used by another session
+  if (-1 !=
+      ::olm_remove_one_time_keys(this->account, newSession->getOlmSession())) {
+    if (this->publishedOneTimeKeysCount > 0) {
+      this->publishedOneTimeKeysCount--;
+    }
+    this->accountDirty = true;
+  }
+  this->addSession(targetUserId, std::move(newSession));
+  this->dirtySessions.insert(targetUserId);
 }
 
 void CryptoModule::initializeOutboundForSendingSession(
@@ -139,7 +211,9 @@ void CryptoModule::initializeOutboundForSendingSession(
     const OlmBuffer &idKeys,
     const OlmBuffer &oneTimeKeys,
     size_t keyIndex) {
-  if (this->hasSessionFor(targetUserId)) {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  if (this->sessionExists(targetUserId)) {
     throw std::runtime_error{
         "error initializeOutboundForSendingSession => session already "
         "initialized"};
@@ -150,44 +224,153 @@ void CryptoModule::initializeOutboundForSendingSession(
       idKeys,
       oneTimeKeys,
       keyIndex);
-  this->sessions.insert(make_pair(targetUserId, std::move(newSession)));
+  this->addSession(targetUserId, std::move(newSession));
+  this->dirtySessions.insert(targetUserId);
+}
+
+bool CryptoModule::sessionExists(const std::string &targetUserId) {
+  return this->sessions.find(targetUserId) != this->sessions.end() ||
+      this->pickledSessions.find(targetUserId) != this->pickledSessions.end();
 }
 
 bool CryptoModule::hasSessionFor(const std::string &targetUserId) {
-  return (this->sessions.find(targetUserId) != this->sessions.end());
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  return this->sessionExists(targetUserId);
 }
 
 std::shared_ptr<Session>
 CryptoModule::getSessionByUserId(const std::string &userId) {
-  return this->sessions.at(userId);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  return this->loadSession(userId);
+}
+
+std::shared_ptr<Session> CryptoModule::loadSessionForUse(
+    const std::string &targetUserId,
+    const std::string &errorPrefix) {
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  if (!this->sessionExists(targetUserId)) {
+    throw std::runtime_error{
+        errorPrefix + " => uninitialized session for " + targetUserId};
+  }
+  return this->loadSession(targetUserId);
+}
+
+void CryptoModule::markSessionsDirty(
+    const std::vector<std::string> &targetUserIds) {
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  this->dirtySessions.insert(targetUserIds.begin(), targetUserIds.end());
+}
+
+std::shared_ptr<Session>
+CryptoModule::loadSession(const std::string &targetUserId) {
+  auto liveSessionIt = this->sessions.find(targetUserId);
+  if (liveSessionIt != this->sessions.end()) {
+    this->sessionsUsage.splice(
+        this->sessionsUsage.begin(),
+        this->sessionsUsage,
+        liveSessionIt->second.usage);
+    return liveSessionIt->second.session;
+  }
+
+  auto pickledSessionIt = this->pickledSessions.find(targetUserId);
+  if (pickledSessionIt == this->pickledSessions.end()) {
+    throw std::out_of_range{"error loadSession => no session for the user"};
+  }
+  // unpickling overwrites the buffer
+  OlmBuffer pickledSession(pickledSessionIt->second);
+  std::shared_ptr<Session> session = Session::restoreFromB64(
+      this->account,
+      this->keys.identityKeys.data(),
+      this->pickleKey,
+      pickledSession);
+  this->pickledSessions.erase(pickledSessionIt);
+  this->addSession(targetUserId, session);
+  return session;
+}
+
+void CryptoModule::addSession(
+    const std::string &targetUserId,
+    std::shared_ptr<Session> session) {
+  this->sessionsUsage.push_front(targetUserId);
+  this->sessions.insert(make_pair(
+      targetUserId,
+      LiveSession{std::move(session), this->sessionsUsage.begin()}));
+  this->evictSessions();
+}
+
+void CryptoModule::removeSession(const std::string &targetUserId) {
+  auto liveSessionIt = this->sessions.find(targetUserId);
+  if (liveSessionIt != this->sessions.end()) {
+    this->sessionsUsage.erase(liveSessionIt->second.usage);
+    this->sessions.erase(liveSessionIt);
+  }
+  this->pickledSessions.erase(targetUserId);
+}
+
+void CryptoModule::evictSessions() {
+  if (this->pickleKey.empty()) {
+    return;
+  }
+  auto usageIt = this->sessionsUsage.end();
+  while (this->sessions.size() > maxLiveSessionsCount &&
+         usageIt != this->sessionsUsage.begin()) {
+    --usageIt;
+    auto liveSessionIt = this->sessions.find(*usageIt);
+    // a session still referenced elsewhere could be in use, or be changed
+    // after it's pickled and the change would be lost
+    if (liveSessionIt->second.session.use_count() > 1) {
+      continue;
+    }
+    this->pickledSessions.insert(make_pair(
+        *usageIt, liveSessionIt->second.session->storeAsB64(this->pickleKey)));
+    this->sessions.erase(liveSessionIt);
+    usageIt = this->sessionsUsage.erase(usageIt);
+  }
 }
 
 bool CryptoModule::matchesInboundSession(
     const std::string &targetUserId,
-    EncryptedData encryptedData,
-    const OlmBuffer &theirIdentityKey) const {
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
+    const EncryptedData &encryptedData,
+    const OlmBuffer &theirIdentityKey) {
+  std::shared_ptr<Session> session;
+  {
+    std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+    session = this->loadSession(targetUserId);
+  }
+  std::lock_guard<std::mutex> sessionLock(session->getMutex());
+  return this->sessionMatches(
+      session->getOlmSession(), encryptedData, theirIdentityKey);
+}
+
+bool CryptoModule::sessionMatches(
+    OlmSession *session,
+    const EncryptedData &encryptedData,
+    const OlmBuffer &theirIdentityKey) {
   // Check that the inbound session matches the message it was created from.
-  OlmBuffer tmpEncryptedMessage(encryptedData.message);
+  scratchMessage.assign(
+      encryptedData.message.begin(), encryptedData.message.end());
   if (1 !=
       ::olm_matches_inbound_session(
-          session, tmpEncryptedMessage.data(), tmpEncryptedMessage.size())) {
+          session, scratchMessage.data(), scratchMessage.size())) {
     return false;
   }
 
   // Check that the inbound session matches the key this message is supposed
   // to be from.
-  tmpEncryptedMessage = OlmBuffer(encryptedData.message);
+  scratchMessage.assign(
+      encryptedData.message.begin(), encryptedData.message.end());
   return 1 ==
       ::olm_matches_inbound_session_from(
              session,
              theirIdentityKey.data() + ID_KEYS_PREFIX_OFFSET,
              KEYSIZE,
-             tmpEncryptedMessage.data(),
-             tmpEncryptedMessage.size());
+             scratchMessage.data(),
+             scratchMessage.size());
 }
 
 Persist CryptoModule::storeAsB64(const std::string &secretKey) {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
   Persist persist;
   size_t accountPickleLength = ::olm_pickle_account_length(this->account);
   OlmBuffer accountPickleBuffer(accountPickleLength);
@@ -201,19 +384,91 @@ Persist CryptoModule::storeAsB64(const std::string &secretKey) {
     throw std::runtime_error{"error storeAsB64 => ::olm_pickle_account"};
   }
   persist.account = accountPickleBuffer;
+  persist.publishedOneTimeKeysCount = this->publishedOneTimeKeysCount;
+
+  if (secretKey != this->pickleKey) {
+    for (auto &pickledSessionIt : this->pickledSessions) {
+      std::unique_ptr<Session> session = Session::restoreFromB64(
+          this->account,
+          this->keys.identityKeys.data(),
+          this->pickleKey,
+          pickledSessionIt.second);
+      pickledSessionIt.second = session->storeAsB64(secretKey);
+    }
+    this->pickleKey = secretKey;
+  }
+  persist.sessions = this->pickledSessions;
+  for (const auto &liveSessionIt : this->sessions) {
+    Session &session = *liveSessionIt.second.session;
+    std::lock_guard<std::mutex> sessionLock(session.getMutex());
+    OlmBuffer buffer = session.storeAsB64(secretKey);
+    persist.sessions.insert(make_pair(liveSessionIt.first, buffer));
+  }
+  this->accountDirty = false;
+  this->dirtySessions.clear();
+  this->evictSessions();
+
+  return persist;
+}
+
+Persist CryptoModule::storeDirty() {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  if (this->pickleKey.empty()) {
+    throw std::runtime_error{"error storeDirty => module was never stored"};
+  }
+  Persist persist;
+  if (this->accountDirty) {
+    size_t accountPickleLength = ::olm_pickle_account_length(this->account);
+    persist.account.resize(accountPickleLength);
+    if (accountPickleLength !=
+        ::olm_pickle_account(
+            this->account,
+            this->pickleKey.data(),
+            this->pickleKey.size(),
+            persist.account.data(),
+            accountPickleLength)) {
+      throw std::runtime_error{"error storeDirty => ::olm_pickle_account"};
+    }
+    persist.publishedOneTimeKeysCount = this->publishedOneTimeKeysCount;
+  }
 
-  std::unordered_map<std::string, std::shared_ptr<Session>>::iterator it;
-  for (it = this->sessions.begin(); it != this->sessions.end(); ++it) {
-    OlmBuffer buffer = it->second->storeAsB64(secretKey);
-    persist.sessions.insert(make_pair(it->first, buffer));
+  for (const std::string &targetUserId : this->dirtySessions) {
+    auto liveSessionIt = this->sessions.find(targetUserId);
+    if (liveSessionIt != this->sessions.end()) {
+      Session &session = *liveSessionIt->second.session;
+      std::lock_guard<std::mutex> sessionLock(session.getMutex());
+      persist.sessions.insert(
+          make_pair(targetUserId, session.storeAsB64(this->pickleKey)));
+      continue;
+    }
+    auto pickledSessionIt = this->pickledSessions.find(targetUserId);
+    if (pickledSessionIt != this->pickledSessions.end()) {
+      persist.sessions.insert(*pickledSessionIt);
+    }
   }
+  this->accountDirty = false;
+  this->dirtySessions.clear();
 
   return persist;
 }
 
+void CryptoModule::markDirty(const Persist &persist) {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+  if (!persist.account.empty()) {
+    this->accountDirty = true;
+  }
+  for (const auto &session : persist.sessions) {
+    this->dirtySessions.insert(session.first);
+  }
+}
+
 void CryptoModule::restoreFromB64(
     const std::string &secretKey,
     Persist persist) {
+  std::lock_guard<std::mutex> accountLock(this->accountMutex);
+  std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
   this->accountBuffer.resize(::olm_account_size());
   this->account = ::olm_account(this->accountBuffer.data());
   if (-1 ==
@@ -230,34 +485,32 @@ void CryptoModule::restoreFromB64(
         "error restoreFromB64 => ::olm_pickle_account_length"};
   }
 
-  std::unordered_map<std::string, OlmBuffer>::iterator it;
-  for (it = persist.sessions.begin(); it != persist.sessions.end(); ++it) {
-    std::unique_ptr<Session> session = session->restoreFromB64(
-        this->account, this->keys.identityKeys.data(), secretKey, it->second);
-    this->sessions.insert(make_pair(it->first, move(session)));
-  }
+  this->publishedOneTimeKeysCount = persist.publishedOneTimeKeysCount;
+
+  // sessions are unpickled when they are used for the first time
+  this->sessions.clear();
+  this->sessionsUsage.clear();
+  this->accountDirty = false;
+  this->dirtySessions.clear();
+  this->pickledSessions = std::move(persist.sessions);
+  this->pickleKey = secretKey;
 }
 
-EncryptedData CryptoModule::encrypt(
-    const std::string &targetUserId,
-    const std::string &content) {
-  if (!this->hasSessionFor(targetUserId)) {
-    throw std::runtime_error{"error encrypt => uninitialized session"};
-  }
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
+EncryptedData CryptoModule::encryptWithRandom(
+    OlmSession *session,
+    const std::string &content,
+    std::uint8_t *random,
+    size_t randomLength) {
   OlmBuffer encryptedMessage(
       ::olm_encrypt_message_length(session, content.size()));
-  OlmBuffer messageRandom;
-  PlatformSpecificTools::generateSecureRandomBytes(
-      messageRandom, ::olm_encrypt_random_length(session));
   size_t messageType = ::olm_encrypt_message_type(session);
   if (-1 ==
       ::olm_encrypt(
           session,
           (uint8_t *)content.data(),
           content.size(),
-          messageRandom.data(),
-          messageRandom.size(),
+          random,
+          randomLength,
           encryptedMessage.data(),
           encryptedMessage.size())) {
     throw std::runtime_error{"error encrypt => ::olm_encrypt"};
@@ -265,41 +518,151 @@ EncryptedData CryptoModule::encrypt(
   return {encryptedMessage, messageType};
 }
 
-std::string CryptoModule::decrypt(
+EncryptedData CryptoModule::encrypt(
     const std::string &targetUserId,
-    EncryptedData encryptedData,
-    const OlmBuffer &theirIdentityKey) {
-  if (!this->hasSessionFor(targetUserId)) {
-    throw std::runtime_error{"error decrypt => uninitialized session"};
+    const std::string &content) {
+  std::shared_ptr<Session> lockedSession =
+      this->loadSessionForUse(targetUserId, "error encrypt");
+  EncryptedData encryptedData;
+  {
+    std::lock_guard<std::mutex> sessionLock(lockedSession->getMutex());
+    OlmSession *session = lockedSession->getOlmSession();
+    OlmBuffer messageRandom;
+    PlatformSpecificTools::generateSecureRandomBytes(
+        messageRandom, ::olm_encrypt_random_length(session));
+    encryptedData = this->encryptWithRandom(
+        session, content, messageRandom.data(), messageRandom.size());
   }
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
+  this->markSessionsDirty({targetUserId});
+  return encryptedData;
+}
 
-  OlmBuffer tmpEncryptedMessage(encryptedData.message);
+std::vector<EncryptedData> CryptoModule::encryptForMany(
+    const std::vector<std::string> &targetUserIds,
+    const std::string &content) {
+  // All the sessions are loaded first, so nothing is encrypted if any of them
+  // is missing. Holding them also keeps them from being evicted meanwhile.
+  std::vector<std::shared_ptr<Session>> sessions;
+  sessions.reserve(targetUserIds.size());
+  {
+    std::lock_guard<std::mutex> sessionsLock(this->sessionsMutex);
+    for (const std::string &targetUserId : targetUserIds) {
+      if (!this->sessionExists(targetUserId)) {
+        throw std::runtime_error{
+            "error encryptForMany => uninitialized session for " +
+            targetUserId};
+      }
+    }
+    for (const std::string &targetUserId : targetUserIds) {
+      sessions.push_back(this->loadSession(targetUserId));
+    }
+  }
 
-  if (encryptedData.messageType == (size_t)olm::MessageType::PRE_KEY) {
-    if (!this->matchesInboundSession(
-            targetUserId, encryptedData, theirIdentityKey)) {
-      throw std::runtime_error{"error decrypt => matchesInboundSession"};
+  size_t randomSize = 0;
+  for (const std::shared_ptr<Session> &session : sessions) {
+    std::lock_guard<std::mutex> sessionLock(session->getMutex());
+    randomSize += ::olm_encrypt_random_length(session->getOlmSession());
+  }
+  OlmBuffer messagesRandom;
+  PlatformSpecificTools::generateSecureRandomBytes(messagesRandom, randomSize);
+
+  std::vector<EncryptedData> encryptedMessages;
+  encryptedMessages.reserve(targetUserIds.size());
+  size_t randomOffset = 0;
+  try {
+    for (const std::shared_ptr<Session> &lockedSession : sessions) {
+      std::lock_guard<std::mutex> sessionLock(lockedSession->getMutex());
+      OlmSession *session = lockedSession->getOlmSession();
+      // The length counted above can change if a target is repeated, or if
+      // the session was used by another thread in the meantime
+      size_t randomLength = ::olm_encrypt_random_length(session);
+      if (randomOffset + randomLength > messagesRandom.size()) {
+        OlmBuffer messageRandom;
+        PlatformSpecificTools::generateSecureRandomBytes(
+            messageRandom, randomLength);
+        encryptedMessages.push_back(this->encryptWithRandom(
+            session, content, messageRandom.data(), randomLength));
+        continue;
+      }
+      encryptedMessages.push_back(this->encryptWithRandom(
+          session,
+          content,
+          messagesRandom.data() + randomOffset,
+          randomLength));
+      randomOffset += randomLength;
     }
+  } catch (std::runtime_error &e) {
+    // The sessions used before the failure were advanced
+    this->markSessionsDirty(targetUserIds);
+    throw;
   }
+  this->markSessionsDirty(targetUserIds);
+  return encryptedMessages;
+}
 
-  size_t maxSize = ::olm_decrypt_max_plaintext_length(
-      session,
-      encryptedData.messageType,
-      tmpEncryptedMessage.data(),
-      tmpEncryptedMessage.size());
-  OlmBuffer decryptedMessage(maxSize);
-  size_t decryptedSize = ::olm_decrypt(
-      session,
-      encryptedData.messageType,
-      encryptedData.message.data(),
-      encryptedData.message.size(),
-      decryptedMessage.data(),
-      decryptedMessage.size());
-  if (decryptedSize == -1) {
-    throw std::runtime_error{"error ::olm_decrypt"};
-  }
-  return std::string{(char *)decryptedMessage.data(), decryptedSize};
+std::string CryptoModule::decrypt(
+    const std::string &targetUserId,
+    const EncryptedData &encryptedData,
+    const OlmBuffer &theirIdentityKey) {
+  std::shared_ptr<Session> lockedSession =
+      this->loadSessionForUse(targetUserId, "error decrypt");
+  // Olm leaves the session unchanged if decrypting fails
+  std::string decryptedMessage;
+  {
+    std::lock_guard<std::mutex> sessionLock(lockedSession->getMutex());
+    OlmSession *session = lockedSession->getOlmSession();
+
+    if (encryptedData.messageType == (size_t)olm::MessageType::PRE_KEY) {
+      if (!this->sessionMatches(session, encryptedData, theirIdentityKey)) {
+        throw std::runtime_error{"error decrypt => matchesInboundSession"};
+      }
+    }
+
+    scratchMessage.assign(
+        encryptedData.message.begin(), encryptedData.message.end());
+    size_t maxSize = ::olm_decrypt_max_plaintext_length(
+        session,
+        encryptedData.messageType,
+        scratchMessage.data(),
+        scratchMessage.size());
+    if (maxSize == -1) {
+      throw std::runtime_error{"error ::olm_decrypt_max_plaintext_length"};
+    }
+    // decrypted straight into the returned string
+    decryptedMessage.resize(maxSize);
+    scratchMessage.assign(
+        encryptedData.message.begin(), encryptedData.message.end());
+    size_t decryptedSize = ::olm_decrypt(
+        session,
+        encryptedData.messageType,
+        scratchMessage.data(),
+        scratchMessage.size(),
+        (uint8_t *)&decryptedMessage[0],
+        decryptedMessage.size());
+    if (decryptedSize == -1) {
+      throw std::runtime_error{"error ::olm_decrypt"};
+    }
+    decryptedMessage.resize(decryptedSize);
+  }
+  this->markSessionsDirty({targetUserId});
+  return decryptedMessage;
+}
+
+std::vector<DecryptResult>
+CryptoModule::decryptMany(const std::vector<IncomingEncryptedData> &messages) {
+  std::vector<DecryptResult> results(messages.size());
+  for (size_t idx = 0; idx < messages.size(); idx++) {
+    const IncomingEncryptedData &message = messages[idx];
+    try {
+      results[idx].decryptedMessage = this->decrypt(
+          message.targetUserId,
+          message.encryptedData,
+          message.theirIdentityKey);
+    } catch (std::runtime_error &e) {
+      results[idx].error = e.what();
+    }
+  }
+  return results;
 }
 
 } // namespace crypto
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "olm/olm.h"
 
@@ -13,20 +17,85 @@
 namespace comm {
 namespace crypto {
 
+// Sessions for different users can be used from different threads at the
+// same time. Operations on the account, like creating sessions or generating
+// keys, are exclusive.
 class CryptoModule {
+  struct LiveSession {
+    std::shared_ptr<Session> session;
+    // position in sessionsUsage
+    std::list<std::string>::iterator usage;
+  };
+
+  // Sessions unused for the longest time are pickled when there are more of
+  // them, so the memory used doesn't grow with the number of peers
+  static const size_t maxLiveSessionsCount = 50;
+  // One-time keys are generated ahead of time, so publishing them doesn't
+  // have to wait for the generation. The pool of unpublished keys is refilled
+  // up to its size once it drops below the watermark. Olm holds up to 100
+  // keys, so at least the 50 most recently published ones are kept.
+  static const size_t oneTimeKeysPoolSize = 50;
+  static const size_t oneTimeKeysPoolWatermark = 20;
+
+  // Guards the account, its keys and accountDirty. Taken before sessionsMutex
+  // when both are needed.
+  std::mutex accountMutex;
+  // Guards the collections of sessions below and pickleKey. Each Olm session
+  // is guarded by its own mutex, taken after this one, so operations on
+  // different sessions can run in parallel.
+  std::mutex sessionsMutex;
 
   OlmAccount *account = nullptr;
   OlmBuffer accountBuffer;
 
-  std::unordered_map<std::string, std::shared_ptr<Session>> sessions = {};
+  std::unordered_map<std::string, LiveSession> sessions = {};
+  // IDs of the live sessions' target users, the most recently used first
+  std::list<std::string> sessionsUsage = {};
+  // Restored sessions are kept pickled until they are used for the first time
+  std::unordered_map<std::string, OlmBuffer> pickledSessions = {};
+  // Key the pickled sessions are encrypted with, set once the module is
+  // stored or restored. Sessions aren't evicted before that.
+  std::string pickleKey;
+  // Published one-time keys which weren't used for a session yet, nor dropped
+  // by Olm to make room for new ones
+  size_t publishedOneTimeKeysCount = 0;
+  // Changed since the last storeAsB64 or storeDirty
+  bool accountDirty = false;
+  std::unordered_set<std::string> dirtySessions = {};
 
   Keys keys;
 
   void createAccount();
   void exposePublicIdentityKeys();
   void generateOneTimeKeys(size_t oneTimeKeysAmount);
+  size_t countUnpublishedOneTimeKeys();
   // returns number of published keys
   size_t publishOneTimeKeys();
+  // The private session helpers below expect sessionsMutex to be held
+  bool sessionExists(const std::string &targetUserId);
+  std::shared_ptr<Session> loadSession(const std::string &targetUserId);
+  void addSession(
+      const std::string &targetUserId,
+      std::shared_ptr<Session> session);
+  void removeSession(const std::string &targetUserId);
+  void evictSessions();
+  // These take sessionsMutex. Sessions are marked dirty after they are
+  // changed and their own mutex is released, so a storeDirty pickling the
+  // previous state before the change can't clear its mark.
+  std::shared_ptr<Session> loadSessionForUse(
+      const std::string &targetUserId,
+      const std::string &errorPrefix);
+  void markSessionsDirty(const std::vector<std::string> &targetUserIds);
+  // The session's mutex has to be held for these
+  bool sessionMatches(
+      OlmSession *session,
+      const EncryptedData &encryptedData,
+      const OlmBuffer &theirIdentityKey);
+  EncryptedData encryptWithRandom(
+      OlmSession *session,
+      const std::string &content,
+      std::uint8_t *random,
+      size_t randomLength);
 
 public:
   const std::string id;
@@ -38,7 +107,13 @@ public:
       const std::string &oneTimeKeys);
 
   std::string getIdentityKeys();
+  // Publishes all the keys from the pool, generating only the ones missing to
+  // reach the requested amount. Throws if it's more than Olm can hold.
   std::string getOneTimeKeys(size_t oneTimeKeysAmount = 50);
+  // Refills the pool of one-time keys if it's below the watermark. Returns
+  // whether any keys were generated.
+  bool replenishOneTimeKeys();
+  size_t getPublishedOneTimeKeysCount();
 
   void initializeInboundForReceivingSession(
       const std::string &targetUserId,
@@ -54,18 +129,35 @@ public:
   std::shared_ptr<Session> getSessionByUserId(const std::string &userId);
   bool matchesInboundSession(
       const std::string &targetUserId,
-      EncryptedData encryptedData,
-      const OlmBuffer &theirIdentityKey) const;
+      const EncryptedData &encryptedData,
+      const OlmBuffer &theirIdentityKey);
 
   Persist storeAsB64(const std::string &secretKey);
+  // Pickles, with the key the module was last stored or restored with, only
+  // the sessions changed since then. The account is left empty if it didn't
+  // change.
+  Persist storeDirty();
+  // Marks what a persist from storeDirty holds as changed again, when storing
+  // it failed, so the next storeDirty includes it
+  void markDirty(const Persist &persist);
   void restoreFromB64(const std::string &secretKey, Persist persist);
 
   EncryptedData
   encrypt(const std::string &targetUserId, const std::string &content);
   std::string decrypt(
       const std::string &targetUserId,
-      EncryptedData encryptedData,
+      const EncryptedData &encryptedData,
       const OlmBuffer &theirIdentityKey);
+  // Encrypts the same content for every target with a single call for the
+  // random bytes. Throws without encrypting anything if any session is
+  // missing.
+  std::vector<EncryptedData> encryptForMany(
+      const std::vector<std::string> &targetUserIds,
+      const std::string &content);
+  // Messages are decrypted in order. One failing to decrypt doesn't stop the
+  // rest, its error is returned in its place.
+  std::vector<DecryptResult>
+  decryptMany(const std::vector<IncomingEncryptedData> &messages);
 };
 
 } // namespace crypto
@@ -11,6 +11,8 @@ namespace crypto {
 struct Persist {
   OlmBuffer account;
   std::unordered_map<std::string, OlmBuffer> sessions;
+  // Stored along with the account
+  size_t publishedOneTimeKeysCount = 0;
 
   bool isEmpty() const {
     return (this->account.size() == 0);
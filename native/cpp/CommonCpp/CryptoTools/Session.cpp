@@ -109,5 +109,9 @@ OlmSession *Session::getOlmSession() {
   return this->olmSession;
 }
 
+std::mutex &Session::getMutex() {
+  return this->mutex;
+}
+
 } // namespace crypto
 } // namespace comm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "Tools.h"
@@ -14,6 +15,8 @@ class Session {
 
   OlmSession *olmSession = nullptr;
   OlmBuffer olmSessionBuffer;
+  // An Olm session can't be used by several threads at once
+  std::mutex mutex;
 
   Session(OlmAccount *account, std::uint8_t *ownerIdentityKeys)
       : ownerUserAccount(account), ownerIdentityKeys(ownerIdentityKeys) {
@@ -38,6 +41,7 @@ public:
       const std::string &secretKey,
       OlmBuffer &b64);
   OlmSession *getOlmSession();
+  std::mutex &getMutex();
 };
 
 } // namespace crypto
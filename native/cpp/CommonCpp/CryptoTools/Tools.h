@@ -26,6 +26,18 @@ struct EncryptedData {
   size_t messageType;
 };
 
+struct IncomingEncryptedData {
+  std::string targetUserId;
+  EncryptedData encryptedData;
+  OlmBuffer theirIdentityKey;
+};
+
+// The error is empty if the message was decrypted
+struct DecryptResult {
+  std::string decryptedMessage;
+  std::string error;
+};
+
 class Tools {
 private:
   static std::string
@@ -0,0 +1,88 @@
+#include "CryptoModule.h"
+#include "PlatformSpecificTools.h"
+#include "Tools.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The benchmark only needs random bytes, not secure ones
+namespace comm {
+
+void PlatformSpecificTools::generateSecureRandomBytes(
+    crypto::OlmBuffer &buffer,
+    size_t size) {
+  static std::mt19937 generator(std::random_device{}());
+  buffer.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    buffer[i] = static_cast<uint8_t>(generator());
+  }
+}
+
+std::string PlatformSpecificTools::getDeviceOS() {
+  return "benchmark";
+}
+
+} // namespace comm
+
+using namespace comm::crypto;
+
+namespace {
+
+const size_t messagesCount = 10000;
+const size_t messageSize = 200;
+
+template <typename F> double measureNsPerIteration(size_t iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    f(i);
+  }
+  auto duration = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(duration).count() /
+      iterations;
+}
+
+} // namespace
+
+int main() {
+  CryptoModule sender("sender");
+  CryptoModule receiver("receiver");
+  Keys senderKeys = CryptoModule::keysFromStrings(
+      sender.getIdentityKeys(), sender.getOneTimeKeys(1));
+  Keys receiverKeys = CryptoModule::keysFromStrings(
+      receiver.getIdentityKeys(), receiver.getOneTimeKeys(1));
+
+  sender.initializeOutboundForSendingSession(
+      receiver.id, receiverKeys.identityKeys, receiverKeys.oneTimeKeys);
+  std::string content = Tools::generateRandomString(messageSize);
+  EncryptedData preKeyMessage = sender.encrypt(receiver.id, content);
+  receiver.initializeInboundForReceivingSession(
+      sender.id, preKeyMessage.message, senderKeys.identityKeys);
+
+  double matchesNs = measureNsPerIteration(messagesCount, [&](size_t) {
+    receiver.matchesInboundSession(
+        sender.id, preKeyMessage, senderKeys.identityKeys);
+  });
+  receiver.decrypt(sender.id, preKeyMessage, senderKeys.identityKeys);
+
+  // a reply makes the following messages regular ones
+  EncryptedData reply = receiver.encrypt(sender.id, content);
+  sender.decrypt(receiver.id, reply, receiverKeys.identityKeys);
+
+  std::vector<EncryptedData> messages;
+  messages.reserve(messagesCount);
+  for (size_t i = 0; i < messagesCount; ++i) {
+    messages.push_back(sender.encrypt(receiver.id, content));
+  }
+  double decryptNs = measureNsPerIteration(messagesCount, [&](size_t i) {
+    receiver.decrypt(sender.id, messages[i], senderKeys.identityKeys);
+  });
+
+  std::cout << "matchesInboundSession: " << matchesNs << " ns/call"
+            << std::endl;
+  std::cout << "decrypt (" << messageSize << " B): " << decryptNs
+            << " ns/message" << std::endl;
+  return 0;
+}
@@ -14,6 +14,11 @@ public:
     thread_local SQLiteQueryExecutor instance;
     return instance;
   }
+
+  // Has to be called on a thread which executes read-only queries only
+  static void registerReaderThread() {
+    SQLiteQueryExecutor::registerReaderThread();
+  }
 };
 
 } // namespace comm
@@ -33,10 +33,20 @@ public:
   virtual void removeAllMessages() const = 0;
   virtual std::vector<std::pair<Message, std::vector<Media>>>
   getAllMessages() const = 0;
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesForThread(std::string threadID, int64_t beforeTime, int limit)
+      const = 0;
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getLatestMessagesPerThread(int limit) const = 0;
+  virtual std::vector<std::pair<Message, std::vector<Media>>> searchMessages(
+      std::string query,
+      folly::Optional<std::string> threadID,
+      int limit) const = 0;
   virtual void removeMessages(const std::vector<std::string> &ids) const = 0;
   virtual void
   removeMessagesForThreads(const std::vector<std::string> &threadIDs) const = 0;
   virtual void replaceMessage(const Message &message) const = 0;
+  virtual void replaceMessages(const std::vector<Message> &messages) const = 0;
   virtual void rekeyMessage(std::string from, std::string to) const = 0;
   virtual void removeAllMedia() const = 0;
   virtual void
@@ -45,16 +55,27 @@ public:
   virtual void
   removeMediaForThreads(const std::vector<std::string> &thread_ids) const = 0;
   virtual void replaceMedia(const Media &media) const = 0;
+  virtual void
+  replaceMediaItems(const std::vector<Media> &mediaItems) const = 0;
   virtual void rekeyMediaContainers(std::string from, std::string to) const = 0;
   virtual std::vector<Thread> getAllThreads() const = 0;
+  virtual std::vector<Thread> getThreadsOfMember(std::string userID) const = 0;
   virtual void removeThreads(std::vector<std::string> ids) const = 0;
   virtual void replaceThread(const Thread &thread) const = 0;
+  // Returns false if there is no thread with the given ID
+  virtual bool
+  updateThreadUnreadStatus(std::string threadID, bool unread) const = 0;
   virtual void removeAllThreads() const = 0;
   virtual void beginTransaction() const = 0;
   virtual void commitTransaction() const = 0;
   virtual void rollbackTransaction() const = 0;
+  // Applies a part of the pending incremental migrations, returns whether
+  // there is anything left to apply
+  virtual bool runIncrementalMigrationStep() const = 0;
   virtual std::vector<OlmPersistSession> getOlmPersistSessionsData() const = 0;
   virtual folly::Optional<std::string> getOlmPersistAccountData() const = 0;
+  virtual size_t getOlmPersistPublishedOneTimeKeysCount() const = 0;
+  // Runs in its own transaction unless one is in progress already
   virtual void storeOlmPersistData(crypto::Persist persist) const = 0;
   virtual void setNotifyToken(std::string token) const = 0;
   virtual void clearNotifyToken() const = 0;
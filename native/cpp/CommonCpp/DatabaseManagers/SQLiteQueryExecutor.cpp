@@ -4,20 +4,35 @@
 #include "sqlite_orm.h"
 
 #include "entities/Media.h"
+#include "entities/MessageSearchIndex.h"
 #include "entities/Metadata.h"
+#include "entities/ThreadMember.h"
 #include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <sstream>
 #include <string>
 #include <system_error>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
 
 #define ACCOUNT_ID 1
+#define PUBLISHED_ONE_TIME_KEYS_COUNT_KEY "olm_published_one_time_keys_count"
+// Keeps `IN (...)` lists below SQLITE_MAX_VARIABLE_NUMBER of older SQLite
+// versions
+#define MAX_SQL_VARIABLES_IN_QUERY 500
+#define SQLITE_BUSY_TIMEOUT_MS 5000
+#define MAX_INCREMENTAL_MIGRATION_FAILURES 8
+#define INCREMENTAL_MIGRATION_RETRY_DELAY_MS 1000
 
 namespace comm {
 
@@ -26,6 +41,11 @@ using namespace sqlite_orm;
 std::string SQLiteQueryExecutor::sqliteFilePath;
 std::string SQLiteQueryExecutor::encryptionKey;
 std::once_flag SQLiteQueryExecutor::initialized;
+std::mutex SQLiteQueryExecutor::migrationMutex;
+std::atomic<bool> SQLiteQueryExecutor::incrementalMigrationsStopped{false};
+int SQLiteQueryExecutor::incrementalMigrationFailuresCount = 0;
+std::chrono::steady_clock::time_point
+    SQLiteQueryExecutor::incrementalMigrationRetryTime;
 int SQLiteQueryExecutor::sqlcipherEncryptionKeySize = 64;
 std::string SQLiteQueryExecutor::secureStoreEncryptionKeyID =
     "comm.encryptionKey";
@@ -258,6 +278,153 @@ bool create_metadata_table(sqlite3 *db) {
   return create_table(db, query, "metadata");
 }
 
+// Full-text index over the content of text messages. It doesn't store a copy
+// of the content, it's read from the messages table by rowid. Only text
+// messages are indexed, so the index must never be rebuilt with the FTS5
+// 'rebuild' command, which would index every row of the messages table.
+// The messages stored before the index was created are indexed by the
+// messages_search incremental migration, from the newest ones. Until it's
+// finished, only the rows from messages_search_indexed_from up are indexed.
+bool create_messages_search_table(sqlite3 *db) {
+  std::string query =
+      "CREATE VIRTUAL TABLE IF NOT EXISTS messages_search USING fts5( "
+      "content, "
+      "content = 'messages', "
+      "content_rowid = 'rowid', "
+      "tokenize = 'unicode61 remove_diacritics 2'); "
+      "REPLACE INTO metadata (name, data) "
+      "SELECT 'messages_search_indexed_from', MAX(rowid) + 1 FROM messages "
+      "HAVING MAX(rowid) IS NOT NULL;";
+  return create_table(db, query, "messages_search");
+}
+
+// SQL condition of the row being in messages_search, for text messages
+std::string is_indexed_in_messages_search(const std::string &row) {
+  return row +
+      ".rowid >= COALESCE((SELECT CAST(data AS INTEGER) FROM metadata "
+      "WHERE name = 'messages_search_indexed_from'), 0)";
+}
+
+// Keep messages_search in sync with every write to the messages table. REPLACE
+// doesn't fire delete triggers for the rows it overwrites, so the overwritten
+// row is removed from the index before the insert. Rows below
+// messages_search_indexed_from are left to the backfill, deleting a row
+// missing from the index or indexing it twice would corrupt the index.
+bool create_messages_search_triggers(sqlite3 *db) {
+  std::string query =
+      "CREATE TRIGGER IF NOT EXISTS messages_search_before_insert "
+      "BEFORE INSERT ON messages BEGIN "
+      "INSERT INTO messages_search (messages_search, rowid, content) "
+      "SELECT 'delete', rowid, content FROM messages "
+      "WHERE id = NEW.id AND type = 0 AND content IS NOT NULL "
+      "AND " +
+      is_indexed_in_messages_search("messages") + "; "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS messages_search_after_insert "
+      "AFTER INSERT ON messages "
+      "WHEN NEW.type = 0 AND NEW.content IS NOT NULL "
+      "AND " +
+      is_indexed_in_messages_search("NEW") + " BEGIN "
+      "INSERT INTO messages_search (rowid, content) "
+      "VALUES (NEW.rowid, NEW.content); "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS messages_search_after_delete "
+      "AFTER DELETE ON messages "
+      "WHEN OLD.type = 0 AND OLD.content IS NOT NULL "
+      "AND " +
+      is_indexed_in_messages_search("OLD") + " BEGIN "
+      "INSERT INTO messages_search (messages_search, rowid, content) "
+      "VALUES ('delete', OLD.rowid, OLD.content); "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS messages_search_after_update "
+      "AFTER UPDATE OF type, content ON messages "
+      "WHEN " +
+      is_indexed_in_messages_search("OLD") + " BEGIN "
+      "INSERT INTO messages_search (messages_search, rowid, content) "
+      "SELECT 'delete', OLD.rowid, OLD.content "
+      "WHERE OLD.type = 0 AND OLD.content IS NOT NULL; "
+      "INSERT INTO messages_search (rowid, content) "
+      "SELECT NEW.rowid, NEW.content "
+      "WHERE NEW.type = 0 AND NEW.content IS NOT NULL; "
+      "END;";
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating messages_search triggers: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+// Members of every thread, extracted from the JSON in threads.members, so
+// membership can be looked up without parsing the JSON of every thread
+bool create_thread_members_table(sqlite3 *db) {
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS thread_members ( "
+      "thread TEXT NOT NULL, "
+      "user TEXT NOT NULL, "
+      "role TEXT, "
+      "PRIMARY KEY (thread, user)) WITHOUT ROWID; "
+      "CREATE INDEX IF NOT EXISTS thread_members_idx_user "
+      "ON thread_members (user);";
+  return create_table(db, query, "thread_members");
+}
+
+// Keep thread_members in sync with every write to the threads table. Rows of
+// threads which existed before are added by the thread_members incremental
+// migration.
+bool create_thread_members_triggers(sqlite3 *db) {
+  char *error;
+  sqlite3_exec(
+      db,
+      "CREATE TRIGGER IF NOT EXISTS thread_members_before_insert "
+      "BEFORE INSERT ON threads BEGIN "
+      "DELETE FROM thread_members WHERE thread = NEW.id; "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS thread_members_after_insert "
+      "AFTER INSERT ON threads WHEN json_valid(NEW.members) BEGIN "
+      "INSERT OR REPLACE INTO thread_members (thread, user, role) "
+      "SELECT NEW.id, json_extract(member.value, '$.id'), "
+      "json_extract(member.value, '$.role') "
+      "FROM json_each(NEW.members) AS member "
+      "WHERE json_extract(member.value, '$.id') IS NOT NULL; "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS thread_members_after_update "
+      "AFTER UPDATE OF id, members ON threads BEGIN "
+      "DELETE FROM thread_members WHERE thread = OLD.id; "
+      "INSERT OR REPLACE INTO thread_members (thread, user, role) "
+      "SELECT NEW.id, json_extract(member.value, '$.id'), "
+      "json_extract(member.value, '$.role') "
+      "FROM json_each(NEW.members) AS member "
+      "WHERE json_valid(NEW.members) "
+      "AND json_extract(member.value, '$.id') IS NOT NULL; "
+      "END; "
+      "CREATE TRIGGER IF NOT EXISTS thread_members_after_delete "
+      "AFTER DELETE ON threads BEGIN "
+      "DELETE FROM thread_members WHERE thread = OLD.id; "
+      "END;",
+      nullptr,
+      nullptr,
+      &error);
+
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating thread_members triggers: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
 void set_encryption_key(sqlite3 *db) {
   std::string set_encryption_key_query =
       "PRAGMA key = \"x'" + SQLiteQueryExecutor::encryptionKey + "'\";";
@@ -296,8 +463,21 @@ void trace_queries(sqlite3 *db) {
   }
 }
 
+void set_busy_timeout(sqlite3 *db) {
+  // Connections of different threads write concurrently, a write waits for
+  // the one in progress instead of failing with SQLITE_BUSY
+  int error_code = sqlite3_busy_timeout(db, SQLITE_BUSY_TIMEOUT_MS);
+  if (error_code != SQLITE_OK) {
+    std::ostringstream error_message;
+    error_message << "Failed to set busy timeout, error code: " << error_code;
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+}
+
 void on_database_open(sqlite3 *db) {
   set_encryption_key(db);
+  set_busy_timeout(db);
   trace_queries(db);
 }
 
@@ -426,9 +606,185 @@ std::vector<std::pair<uint, SQLiteMigration>> migrations{
      {20, {create_threads_table, true}},
      {21, {update_threadID_for_pending_threads_in_drafts, true}},
      {22, {enable_write_ahead_logging_mode, false}},
-     {23, {create_metadata_table, true}}}};
+     {23, {create_metadata_table, true}},
+     {24, {create_messages_search_table, true}},
+     {25, {create_messages_search_triggers, true}},
+     {26, {create_thread_members_table, true}},
+     {27, {create_thread_members_triggers, true}}}};
+
+enum class IncrementalMigrationResult {
+  FAILED,
+  UNFINISHED,
+  FINISHED,
+};
+
+// Migrations too expensive to be applied at once on large databases. Every
+// call processes a bounded batch of rows and stores its position in the
+// metadata table, so the migration can be applied in parts while the database
+// thread is idle and resumed after the app is restarted. They are applied
+// after all the migrations above, in order, each call in a transaction.
+typedef std::function<IncrementalMigrationResult(sqlite3 *)>
+    SQLiteIncrementalMigration;
+
+std::string get_metadata(sqlite3 *db, const std::string &name) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(
+      db, "SELECT data FROM metadata WHERE name = ?;", -1, &stmt, nullptr);
+  sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+  std::string data;
+  if (sqlite3_step(stmt) == SQLITE_ROW &&
+      sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+    data = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+  return data;
+}
+
+bool set_metadata(
+    sqlite3 *db,
+    const std::string &name,
+    const std::string &data) {
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(
+      db,
+      "REPLACE INTO metadata (name, data) VALUES (?, ?);",
+      -1,
+      &stmt,
+      nullptr);
+  sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+  sqlite3_bind_text(stmt, 2, data.c_str(), -1, SQLITE_TRANSIENT);
+  bool success = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  return success;
+}
+
+// Adds members of the threads stored before thread_members was created,
+// THREAD_MEMBERS_BACKFILL_BATCH_SIZE threads per step, in rowid order.
+// Threads written in the meantime are handled by the triggers, adding them
+// again is a no-op.
+#define THREAD_MEMBERS_BACKFILL_BATCH_SIZE 100
+IncrementalMigrationResult backfill_thread_members(sqlite3 *db) {
+  const std::string positionKey = "thread_members_backfill_position";
+  std::string position = get_metadata(db, positionKey);
+  int64_t batch_start = position.empty() ? 0 : std::stoll(position);
+
+  sqlite3_stmt *batch_end_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "SELECT MAX(rowid) FROM ( "
+      "SELECT rowid FROM threads WHERE rowid > ? ORDER BY rowid LIMIT ?);",
+      -1,
+      &batch_end_stmt,
+      nullptr);
+  sqlite3_bind_int64(batch_end_stmt, 1, batch_start);
+  sqlite3_bind_int(batch_end_stmt, 2, THREAD_MEMBERS_BACKFILL_BATCH_SIZE);
+  if (sqlite3_step(batch_end_stmt) != SQLITE_ROW) {
+    sqlite3_finalize(batch_end_stmt);
+    return IncrementalMigrationResult::FAILED;
+  }
+  bool finished = sqlite3_column_type(batch_end_stmt, 0) == SQLITE_NULL;
+  int64_t batch_end = sqlite3_column_int64(batch_end_stmt, 0);
+  sqlite3_finalize(batch_end_stmt);
+  if (finished) {
+    return IncrementalMigrationResult::FINISHED;
+  }
+
+  sqlite3_stmt *backfill_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "INSERT OR REPLACE INTO thread_members (thread, user, role) "
+      "SELECT threads.id, json_extract(member.value, '$.id'), "
+      "json_extract(member.value, '$.role') "
+      "FROM threads, json_each(threads.members) AS member "
+      "WHERE threads.rowid > ? AND threads.rowid <= ? "
+      "AND json_valid(threads.members) "
+      "AND json_extract(member.value, '$.id') IS NOT NULL;",
+      -1,
+      &backfill_stmt,
+      nullptr);
+  sqlite3_bind_int64(backfill_stmt, 1, batch_start);
+  sqlite3_bind_int64(backfill_stmt, 2, batch_end);
+  int rc = sqlite3_step(backfill_stmt);
+  sqlite3_finalize(backfill_stmt);
+  if (rc != SQLITE_DONE ||
+      !set_metadata(db, positionKey, std::to_string(batch_end))) {
+    return IncrementalMigrationResult::FAILED;
+  }
+  return IncrementalMigrationResult::UNFINISHED;
+}
+
+// Indexes the messages stored before messages_search was created,
+// MESSAGES_SEARCH_BACKFILL_BATCH_SIZE rows per step, from the newest ones, so
+// recent messages can be searched first. Searches are served in the meantime,
+// only missing older results.
+#define MESSAGES_SEARCH_BACKFILL_BATCH_SIZE 500
+IncrementalMigrationResult backfill_messages_search(sqlite3 *db) {
+  const std::string positionKey = "messages_search_indexed_from";
+  std::string position = get_metadata(db, positionKey);
+  if (position.empty()) {
+    return IncrementalMigrationResult::FINISHED;
+  }
+  int64_t batch_end = std::stoll(position);
+
+  sqlite3_stmt *batch_start_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "SELECT MIN(rowid) FROM ( "
+      "SELECT rowid FROM messages WHERE rowid < ? "
+      "ORDER BY rowid DESC LIMIT ?);",
+      -1,
+      &batch_start_stmt,
+      nullptr);
+  sqlite3_bind_int64(batch_start_stmt, 1, batch_end);
+  sqlite3_bind_int(batch_start_stmt, 2, MESSAGES_SEARCH_BACKFILL_BATCH_SIZE);
+  if (sqlite3_step(batch_start_stmt) != SQLITE_ROW) {
+    sqlite3_finalize(batch_start_stmt);
+    return IncrementalMigrationResult::FAILED;
+  }
+  bool finished = sqlite3_column_type(batch_start_stmt, 0) == SQLITE_NULL;
+  int64_t batch_start = sqlite3_column_int64(batch_start_stmt, 0);
+  sqlite3_finalize(batch_start_stmt);
+  if (finished) {
+    // Without the position every row is treated as indexed
+    int rc = sqlite3_exec(
+        db,
+        "DELETE FROM metadata WHERE name = 'messages_search_indexed_from';",
+        nullptr,
+        nullptr,
+        nullptr);
+    return rc == SQLITE_OK ? IncrementalMigrationResult::FINISHED
+                           : IncrementalMigrationResult::FAILED;
+  }
+
+  sqlite3_stmt *backfill_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "INSERT INTO messages_search (rowid, content) "
+      "SELECT rowid, content FROM messages "
+      "WHERE rowid >= ? AND rowid < ? "
+      "AND type = 0 AND content IS NOT NULL;",
+      -1,
+      &backfill_stmt,
+      nullptr);
+  sqlite3_bind_int64(backfill_stmt, 1, batch_start);
+  sqlite3_bind_int64(backfill_stmt, 2, batch_end);
+  int rc = sqlite3_step(backfill_stmt);
+  sqlite3_finalize(backfill_stmt);
+  if (rc != SQLITE_DONE ||
+      !set_metadata(db, positionKey, std::to_string(batch_start))) {
+    return IncrementalMigrationResult::FAILED;
+  }
+  return IncrementalMigrationResult::UNFINISHED;
+}
+
+std::vector<std::pair<std::string, SQLiteIncrementalMigration>>
+    incrementalMigrations{
+        {"messages_search", backfill_messages_search},
+        {"thread_members", backfill_thread_members}};
 
 void SQLiteQueryExecutor::migrate() {
+  // Executors are created per thread, only one of them at a time can migrate
+  std::lock_guard<std::mutex> lock(SQLiteQueryExecutor::migrationMutex);
   validate_encryption();
 
   sqlite3 *db;
@@ -452,6 +808,12 @@ void SQLiteQueryExecutor::migrate() {
   version_msg << "db version: " << current_user_version << std::endl;
   Logger::log(version_msg.str());
 
+  const auto pending_migrations_count = std::count_if(
+      migrations.begin(), migrations.end(), [=](const auto &migration) {
+        return migration.first > current_user_version;
+      });
+  int applied_migrations_count = 0;
+
   for (const auto &[idx, migration] : migrations) {
     if (idx <= current_user_version) {
       continue;
@@ -459,6 +821,7 @@ void SQLiteQueryExecutor::migrate() {
     const auto &[applyMigration, shouldBeInTransaction] = migration;
 
     std::stringstream migration_msg;
+    auto migration_start = std::chrono::steady_clock::now();
 
     if (shouldBeInTransaction) {
       sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
@@ -480,15 +843,97 @@ void SQLiteQueryExecutor::migrate() {
     if (shouldBeInTransaction) {
       sqlite3_exec(db, "END TRANSACTION;", nullptr, nullptr, nullptr);
     }
-    migration_msg << "migration " << idx << " succeeded." << std::endl;
+    applied_migrations_count++;
+    migration_msg << "migration " << idx << " (" << applied_migrations_count
+                  << "/" << pending_migrations_count << ") succeeded in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - migration_start)
+                         .count()
+                  << "ms." << std::endl;
     Logger::log(migration_msg.str());
   }
 
   sqlite3_close(db);
 }
 
-auto &SQLiteQueryExecutor::getStorage() {
-  static auto storage = make_storage(
+bool SQLiteQueryExecutor::runIncrementalMigrationStep() const {
+  if (SQLiteQueryExecutor::incrementalMigrationsStopped) {
+    return false;
+  }
+  // After a failure the step is retried once a task is executed after the
+  // delay, which doubles with every failure in a row
+  if (std::chrono::steady_clock::now() <
+      SQLiteQueryExecutor::incrementalMigrationRetryTime) {
+    return false;
+  }
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+
+  bool unfinished = false;
+  for (const auto &[name, applyMigrationStep] : incrementalMigrations) {
+    const std::string finishedKey = "incremental_migration_finished/" + name;
+    const std::string durationKey = "incremental_migration_duration/" + name;
+    if (!get_metadata(db, finishedKey).empty()) {
+      continue;
+    }
+
+    auto step_start = std::chrono::steady_clock::now();
+    sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+    auto result = applyMigrationStep(db);
+    if (result == IncrementalMigrationResult::FAILED) {
+      std::string error = sqlite3_errmsg(db);
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      int failuresCount =
+          ++SQLiteQueryExecutor::incrementalMigrationFailuresCount;
+      if (failuresCount >= MAX_INCREMENTAL_MIGRATION_FAILURES) {
+        Logger::log(
+            "incremental migration " + name + " failed " +
+            std::to_string(failuresCount) +
+            " times in a row, it will be retried after restart.");
+        SQLiteQueryExecutor::incrementalMigrationsStopped = true;
+        return false;
+      }
+      Logger::log(
+          "incremental migration " + name + " failed: " + error +
+          ", it will be retried.");
+      SQLiteQueryExecutor::incrementalMigrationRetryTime =
+          std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(
+              INCREMENTAL_MIGRATION_RETRY_DELAY_MS << (failuresCount - 1));
+      return false;
+    }
+    SQLiteQueryExecutor::incrementalMigrationFailuresCount = 0;
+    // Time spent on the migration is summed across steps and app launches
+    std::string previous_duration = get_metadata(db, durationKey);
+    int64_t duration =
+        (previous_duration.empty() ? 0 : std::stoll(previous_duration)) +
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - step_start)
+            .count();
+    set_metadata(db, durationKey, std::to_string(duration));
+    if (result == IncrementalMigrationResult::FINISHED) {
+      set_metadata(db, finishedKey, "1");
+    }
+    sqlite3_exec(db, "END TRANSACTION;", nullptr, nullptr, nullptr);
+
+    if (result == IncrementalMigrationResult::FINISHED) {
+      std::stringstream migration_msg;
+      migration_msg << "incremental migration " << name << " succeeded in "
+                    << duration << "ms." << std::endl;
+      Logger::log(migration_msg.str());
+    }
+    // The next migration, if any, is applied in the next step
+    unfinished = true;
+    break;
+  }
+
+  if (!unfinished) {
+    SQLiteQueryExecutor::incrementalMigrationsStopped = true;
+  }
+  return unfinished;
+}
+
+auto make_comm_storage() {
+  return make_storage(
       SQLiteQueryExecutor::sqliteFilePath,
       make_table(
           "drafts",
@@ -539,11 +984,200 @@ auto &SQLiteQueryExecutor::getStorage() {
       make_table(
           "metadata",
           make_column("name", &Metadata::name, unique(), primary_key()),
-          make_column("data", &Metadata::data)));
-  storage.on_open = on_database_open;
+          make_column("data", &Metadata::data)),
+      make_table(
+          "messages_search",
+          make_column(
+              "messages_search", &MessageSearchIndex::messages_search)),
+      make_table(
+          "thread_members",
+          make_column("thread", &ThreadMember::thread),
+          make_column("user", &ThreadMember::user),
+          make_column("role", &ThreadMember::role),
+          primary_key(&ThreadMember::thread, &ThreadMember::user)));
+}
+
+thread_local sqlite3 *readerConnection = nullptr;
+
+void on_reader_database_open(sqlite3 *db) {
+  on_database_open(db);
+  char *error;
+  sqlite3_exec(db, "PRAGMA query_only = ON;", nullptr, nullptr, &error);
+  if (error) {
+    std::ostringstream error_message;
+    error_message << "Failed to make reader connection read-only: " << error;
+    sqlite3_free(error);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  readerConnection = db;
+}
+
+thread_local sqlite3 *writerConnection = nullptr;
+
+void on_writer_database_open(sqlite3 *db) {
+  on_database_open(db);
+  writerConnection = db;
+}
+
+thread_local bool isReaderThread = false;
+
+auto &SQLiteQueryExecutor::getStorage() {
+  // Besides the database thread, messages are written directly from the
+  // threads handling notifications. SQLite built with SQLITE_THREADSAFE=2
+  // doesn't allow a connection to be used from more than one thread, so
+  // every thread has its own connection, kept open together with the
+  // statements cached on it.
+  thread_local auto storage = make_comm_storage();
+  if (!storage.is_opened()) {
+    storage.on_open = on_writer_database_open;
+    storage.open_forever();
+  }
+  return storage;
+}
+
+sqlite3 *SQLiteQueryExecutor::getConnection() {
+  SQLiteQueryExecutor::getStorage();
+  return writerConnection;
+}
+
+auto &get_reader_thread_storage() {
+  // Every reader thread keeps its own connection open, with WAL enabled it
+  // reads the last committed state without waiting for the writer.
+  thread_local auto storage = make_comm_storage();
+  if (!storage.is_opened()) {
+    storage.on_open = on_reader_database_open;
+    storage.open_forever();
+  }
   return storage;
 }
 
+auto &SQLiteQueryExecutor::getReadStorage() {
+  if (!isReaderThread) {
+    return SQLiteQueryExecutor::getStorage();
+  }
+  return get_reader_thread_storage();
+}
+
+sqlite3 *SQLiteQueryExecutor::getReadConnection() {
+  get_reader_thread_storage();
+  return readerConnection;
+}
+
+void SQLiteQueryExecutor::registerReaderThread() {
+  isReaderThread = true;
+}
+
+namespace {
+struct StatementCounters {
+  const std::string name;
+  std::atomic<uint64_t> executionsCount{0};
+  // microseconds
+  std::atomic<uint64_t> totalExecutionTime{0};
+  std::atomic<uint64_t> maxExecutionTime{0};
+
+  explicit StatementCounters(std::string name) : name(std::move(name)) {
+  }
+};
+
+std::mutex statementCountersMutex;
+std::vector<std::shared_ptr<StatementCounters>> statementCounters;
+
+// The copies of a statement prepared on different threads share the counters
+std::shared_ptr<StatementCounters>
+getStatementCounters(const std::string &name) {
+  std::lock_guard<std::mutex> lock(statementCountersMutex);
+  for (const auto &counters : statementCounters) {
+    if (counters->name == name) {
+      return counters;
+    }
+  }
+  auto counters = std::make_shared<StatementCounters>(name);
+  statementCounters.push_back(counters);
+  return counters;
+}
+
+// Statement prepared once on the storage connection and re-bound before each
+// execution, instead of serializing and preparing the SQL on every call.
+// Like the storages, cached statements are thread-local, a statement is only
+// ever executed on the connection of the thread which prepared it.
+template <typename Storage, typename Statement> class CachedStatement {
+  Storage &storage;
+  Statement statement;
+  std::shared_ptr<StatementCounters> counters;
+
+  // Resets the statement, so it doesn't keep a read transaction open, and
+  // records the execution time, also when the execution throws.
+  class ExecutionScope {
+    sqlite3_stmt *stmt;
+    StatementCounters &counters;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    ExecutionScope(sqlite3_stmt *stmt, StatementCounters &counters)
+        : stmt(stmt),
+          counters(counters),
+          start(std::chrono::steady_clock::now()) {
+    }
+
+    ~ExecutionScope() {
+      sqlite3_reset(this->stmt);
+      uint64_t executionTime =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - this->start)
+              .count();
+      this->counters.executionsCount++;
+      this->counters.totalExecutionTime += executionTime;
+      uint64_t maxExecutionTime = this->counters.maxExecutionTime;
+      while (executionTime > maxExecutionTime &&
+             !this->counters.maxExecutionTime.compare_exchange_weak(
+                 maxExecutionTime, executionTime)) {
+      }
+    }
+  };
+
+public:
+  template <typename Prepare>
+  CachedStatement(const std::string &name, Storage &storage, Prepare prepare)
+      : storage(storage),
+        statement(prepare()),
+        counters(getStatementCounters(name)) {
+  }
+
+  template <typename Bind> auto execute(Bind bind) {
+    ExecutionScope scope(this->statement.stmt, *this->counters);
+    bind(this->statement);
+    return this->storage.execute(this->statement);
+  }
+};
+
+template <typename Storage, typename Prepare>
+CachedStatement<Storage, std::invoke_result_t<Prepare>> makeCachedStatement(
+    const std::string &name,
+    Storage &storage,
+    Prepare prepare) {
+  return CachedStatement<Storage, std::invoke_result_t<Prepare>>(
+      name, storage, prepare);
+}
+
+// Calls `apply` with consecutive parts of `ids`, each short enough to be bound
+// as a single `IN (...)` list
+template <typename Apply>
+void forEachChunk(const std::vector<std::string> &ids, Apply apply) {
+  if (ids.size() <= MAX_SQL_VARIABLES_IN_QUERY) {
+    apply(ids);
+    return;
+  }
+  for (size_t chunkStart = 0; chunkStart < ids.size();
+       chunkStart += MAX_SQL_VARIABLES_IN_QUERY) {
+    size_t chunkEnd =
+        std::min(chunkStart + MAX_SQL_VARIABLES_IN_QUERY, ids.size());
+    apply(std::vector<std::string>(
+        ids.begin() + chunkStart, ids.begin() + chunkEnd));
+  }
+}
+} // namespace
+
 void SQLiteQueryExecutor::initialize(std::string &databasePath) {
   std::call_once(SQLiteQueryExecutor::initialized, [&databasePath]() {
     SQLiteQueryExecutor::sqliteFilePath = databasePath;
@@ -569,13 +1203,20 @@ SQLiteQueryExecutor::SQLiteQueryExecutor() {
 
 std::string SQLiteQueryExecutor::getDraft(std::string key) const {
   std::unique_ptr<Draft> draft =
-      SQLiteQueryExecutor::getStorage().get_pointer<Draft>(key);
+      SQLiteQueryExecutor::getReadStorage().get_pointer<Draft>(key);
   return (draft == nullptr) ? "" : draft->text;
 }
 
 std::unique_ptr<Thread>
 SQLiteQueryExecutor::getThread(std::string threadID) const {
-  return SQLiteQueryExecutor::getStorage().get_pointer<Thread>(threadID);
+  thread_local auto statement = makeCachedStatement(
+      "getThread", SQLiteQueryExecutor::getStorage(), [&threadID]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            get_pointer<Thread>(threadID));
+      });
+  return statement.execute([&threadID](auto &preparedStatement) {
+    get<0>(preparedStatement) = threadID;
+  });
 }
 
 void SQLiteQueryExecutor::updateDraft(std::string key, std::string text) const {
@@ -585,19 +1226,20 @@ void SQLiteQueryExecutor::updateDraft(std::string key, std::string text) const {
 
 bool SQLiteQueryExecutor::moveDraft(std::string oldKey, std::string newKey)
     const {
-  std::unique_ptr<Draft> draft =
-      SQLiteQueryExecutor::getStorage().get_pointer<Draft>(oldKey);
-  if (draft == nullptr) {
+  // The text of the draft isn't read, it can be long
+  if (!SQLiteQueryExecutor::getStorage().count<Draft>(
+          where(c(&Draft::key) == oldKey))) {
     return false;
   }
-  draft->key = newKey;
-  SQLiteQueryExecutor::getStorage().replace(*draft);
-  SQLiteQueryExecutor::getStorage().remove<Draft>(oldKey);
+  SQLiteQueryExecutor::getStorage().remove_all<Draft>(
+      where(c(&Draft::key) == newKey));
+  SQLiteQueryExecutor::getStorage().update_all(
+      set(c(&Draft::key) = newKey), where(c(&Draft::key) == oldKey));
   return true;
 }
 
 std::vector<Draft> SQLiteQueryExecutor::getAllDrafts() const {
-  return SQLiteQueryExecutor::getStorage().get_all<Draft>();
+  return SQLiteQueryExecutor::getReadStorage().get_all<Draft>();
 }
 
 void SQLiteQueryExecutor::removeAllDrafts() const {
@@ -611,7 +1253,7 @@ void SQLiteQueryExecutor::removeAllMessages() const {
 std::vector<std::pair<Message, std::vector<Media>>>
 SQLiteQueryExecutor::getAllMessages() const {
 
-  auto rows = SQLiteQueryExecutor::getStorage().select(
+  auto rows = SQLiteQueryExecutor::getReadStorage().select(
       columns(
           &Message::id,
           &Message::local_id,
@@ -633,33 +1275,14 @@ SQLiteQueryExecutor::getAllMessages() const {
   std::vector<std::pair<Message, std::vector<Media>>> allMessages;
   allMessages.reserve(rows.size());
 
-  std::string prev_msg_idx{};
+  // Rows are ordered by message ID, a message with many media spans
+  // consecutive rows. Columns are moved out of the rows, not copied.
   for (auto &row : rows) {
-    auto msg_id = std::get<0>(row);
-    if (msg_id == prev_msg_idx) {
-      allMessages.back().second.push_back(Media{
-          std::get<8>(row),
-          std::move(std::get<9>(row)),
-          std::move(std::get<10>(row)),
-          std::move(std::get<11>(row)),
-          std::move(std::get<12>(row)),
-          std::move(std::get<13>(row)),
-      });
-    } else {
-      std::vector<Media> mediaForMsg;
-      if (!std::get<8>(row).empty()) {
-        mediaForMsg.push_back(Media{
-            std::get<8>(row),
-            std::move(std::get<9>(row)),
-            std::move(std::get<10>(row)),
-            std::move(std::get<11>(row)),
-            std::move(std::get<12>(row)),
-            std::move(std::get<13>(row)),
-        });
-      }
+    if (allMessages.empty() ||
+        allMessages.back().first.id != std::get<0>(row)) {
       allMessages.push_back(std::make_pair(
           Message{
-              msg_id,
+              std::move(std::get<0>(row)),
               std::move(std::get<1>(row)),
               std::move(std::get<2>(row)),
               std::move(std::get<3>(row)),
@@ -667,36 +1290,250 @@ SQLiteQueryExecutor::getAllMessages() const {
               std::move(std::get<5>(row)),
               std::move(std::get<6>(row)),
               std::get<7>(row)},
-          mediaForMsg));
-
-      prev_msg_idx = msg_id;
+          std::vector<Media>{}));
+    }
+    if (!std::get<8>(row).empty()) {
+      allMessages.back().second.push_back(Media{
+          std::move(std::get<8>(row)),
+          std::move(std::get<9>(row)),
+          std::move(std::get<10>(row)),
+          std::move(std::get<11>(row)),
+          std::move(std::get<12>(row)),
+          std::move(std::get<13>(row)),
+      });
     }
   }
 
   return allMessages;
 }
 
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::attachMediaToMessages(std::vector<Message> messages) {
+  std::unordered_map<std::string, std::vector<Media>> mediaForMessages;
+  for (size_t chunkStart = 0; chunkStart < messages.size();
+       chunkStart += MAX_SQL_VARIABLES_IN_QUERY) {
+    size_t chunkEnd =
+        std::min(chunkStart + MAX_SQL_VARIABLES_IN_QUERY, messages.size());
+    std::vector<std::string> messageIDs;
+    messageIDs.reserve(chunkEnd - chunkStart);
+    for (size_t i = chunkStart; i < chunkEnd; i++) {
+      messageIDs.push_back(messages[i].id);
+    }
+    auto media = SQLiteQueryExecutor::getReadStorage().get_all<Media>(
+        where(in(&Media::container, messageIDs)));
+    for (auto &mediaInfo : media) {
+      mediaForMessages[mediaInfo.container].push_back(std::move(mediaInfo));
+    }
+  }
+
+  std::vector<std::pair<Message, std::vector<Media>>> messagesWithMedia;
+  messagesWithMedia.reserve(messages.size());
+  for (auto &message : messages) {
+    std::vector<Media> mediaForMessage;
+    auto mediaIt = mediaForMessages.find(message.id);
+    if (mediaIt != mediaForMessages.end()) {
+      mediaForMessage = std::move(mediaIt->second);
+    }
+    messagesWithMedia.push_back(
+        std::make_pair(std::move(message), std::move(mediaForMessage)));
+  }
+  return messagesWithMedia;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getMessagesForThread(
+    std::string threadID,
+    int64_t beforeTime,
+    int limit) const {
+  // Served by the messages_idx_thread_time index, SQLite walks the index
+  // backwards from `beforeTime` and stops after `limit` rows.
+  auto messages = SQLiteQueryExecutor::getReadStorage().get_all<Message>(
+      where(c(&Message::thread) == threadID && c(&Message::time) < beforeTime),
+      order_by(&Message::time).desc(),
+      sqlite_orm::limit(limit));
+  return SQLiteQueryExecutor::attachMediaToMessages(std::move(messages));
+}
+
+std::unique_ptr<std::string> column_text_ptr(sqlite3_stmt *stmt, int column) {
+  if (sqlite3_column_type(stmt, column) == SQLITE_NULL) {
+    return nullptr;
+  }
+  return std::make_unique<std::string>(
+      reinterpret_cast<const char *>(sqlite3_column_text(stmt, column)));
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getLatestMessagesPerThread(int limit) const {
+  // A single pass over the messages_idx_thread_time index numbering messages
+  // within every thread. sqlite_orm doesn't support window functions, so the
+  // query runs on the raw reader connection.
+  sqlite3 *db = SQLiteQueryExecutor::getReadConnection();
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(
+      db,
+      "SELECT id, local_id, thread, user, type, future_type, content, time "
+      "FROM (SELECT *, ROW_NUMBER() OVER ( "
+      "PARTITION BY thread ORDER BY time DESC) AS thread_position "
+      "FROM messages) "
+      "WHERE thread_position <= ?;",
+      -1,
+      &stmt,
+      nullptr);
+  if (rc != SQLITE_OK) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to prepare latest messages query: " +
+            std::string(sqlite3_errmsg(db)));
+  }
+  sqlite3_bind_int(stmt, 1, limit);
+
+  std::vector<Message> messages;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    std::unique_ptr<int> future_type;
+    if (sqlite3_column_type(stmt, 5) != SQLITE_NULL) {
+      future_type = std::make_unique<int>(sqlite3_column_int(stmt, 5));
+    }
+    messages.push_back(Message{
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)),
+        column_text_ptr(stmt, 1),
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 2)),
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3)),
+        sqlite3_column_int(stmt, 4),
+        std::move(future_type),
+        column_text_ptr(stmt, 6),
+        sqlite3_column_int64(stmt, 7)});
+  }
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to read latest messages: " + std::string(sqlite3_errmsg(db)));
+  }
+  return SQLiteQueryExecutor::attachMediaToMessages(std::move(messages));
+}
+
+// Turns text typed by the user into an FTS5 query matching messages which
+// contain all of its words, the last one possibly not typed completely yet.
+// Every word is quoted, so characters with a special meaning in the FTS5
+// query syntax are matched literally.
+std::string fts_query_from_search_text(const std::string &text) {
+  std::istringstream words(text);
+  std::ostringstream ftsQuery;
+  std::string word;
+  bool first = true;
+  while (words >> word) {
+    if (!first) {
+      ftsQuery << ' ';
+    }
+    first = false;
+    ftsQuery << '"';
+    for (char character : word) {
+      if (character == '"') {
+        ftsQuery << '"';
+      }
+      ftsQuery << character;
+    }
+    ftsQuery << '"';
+  }
+  if (!first) {
+    ftsQuery << '*';
+  }
+  return ftsQuery.str();
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::searchMessages(
+    std::string query,
+    folly::Optional<std::string> threadID,
+    int limit) const {
+  std::string ftsQuery = fts_query_from_search_text(query);
+  if (ftsQuery.empty()) {
+    return {};
+  }
+  auto matchesQuery = is_equal(&MessageSearchIndex::messages_search, ftsQuery);
+  auto searchIndexJoin = inner_join<MessageSearchIndex>(
+      on(is_equal(rowid<MessageSearchIndex>(), rowid<Message>())));
+
+  std::vector<Message> messages;
+  if (threadID.hasValue()) {
+    messages = SQLiteQueryExecutor::getReadStorage().get_all<Message>(
+        searchIndexJoin,
+        where(matchesQuery && c(&Message::thread) == threadID.value()),
+        order_by(&Message::time).desc(),
+        sqlite_orm::limit(limit));
+  } else {
+    messages = SQLiteQueryExecutor::getReadStorage().get_all<Message>(
+        searchIndexJoin,
+        where(matchesQuery),
+        order_by(&Message::time).desc(),
+        sqlite_orm::limit(limit));
+  }
+  return SQLiteQueryExecutor::attachMediaToMessages(std::move(messages));
+}
+
 void SQLiteQueryExecutor::removeMessages(
     const std::vector<std::string> &ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Message>(
-      where(in(&Message::id, ids)));
+  forEachChunk(ids, [](const std::vector<std::string> &chunk) {
+    SQLiteQueryExecutor::getStorage().remove_all<Message>(
+        where(in(&Message::id, chunk)));
+  });
 }
 
 void SQLiteQueryExecutor::removeMessagesForThreads(
     const std::vector<std::string> &threadIDs) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Message>(
-      where(in(&Message::thread, threadIDs)));
+  forEachChunk(threadIDs, [](const std::vector<std::string> &chunk) {
+    SQLiteQueryExecutor::getStorage().remove_all<Message>(
+        where(in(&Message::thread, chunk)));
+  });
 }
 
 void SQLiteQueryExecutor::replaceMessage(const Message &message) const {
-  SQLiteQueryExecutor::getStorage().replace(message);
+  // The statement keeps a reference to the bound object, it's replaced with
+  // the current argument before every execution.
+  thread_local auto statement = makeCachedStatement(
+      "replaceMessage", SQLiteQueryExecutor::getStorage(), [&message]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            replace(std::cref(message)));
+      });
+  statement.execute([&message](auto &preparedStatement) {
+    preparedStatement.t.obj = std::cref(message);
+  });
+}
+
+void SQLiteQueryExecutor::replaceMessages(
+    const std::vector<Message> &messages) const {
+  // Every message row binds 8 variables
+  const size_t chunkSize = MAX_SQL_VARIABLES_IN_QUERY / 8;
+  for (size_t chunkStart = 0; chunkStart < messages.size();
+       chunkStart += chunkSize) {
+    size_t chunkEnd = std::min(chunkStart + chunkSize, messages.size());
+    SQLiteQueryExecutor::getStorage().replace_range(
+        messages.begin() + chunkStart, messages.begin() + chunkEnd);
+  }
 }
 
 void SQLiteQueryExecutor::rekeyMessage(std::string from, std::string to) const {
-  auto msg = SQLiteQueryExecutor::getStorage().get<Message>(from);
-  msg.id = to;
-  SQLiteQueryExecutor::getStorage().replace(msg);
-  SQLiteQueryExecutor::getStorage().remove<Message>(from);
+  // Same as in the JS message store, a message stored under the new ID is
+  // replaced, even if there is no message to rekey. The message isn't read,
+  // its row is updated in place.
+  thread_local auto removeStatement = makeCachedStatement(
+      "rekeyMessage/remove", SQLiteQueryExecutor::getStorage(), [&to]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            remove_all<Message>(where(c(&Message::id) == to)));
+      });
+  thread_local auto updateStatement = makeCachedStatement(
+      "rekeyMessage/update", SQLiteQueryExecutor::getStorage(), [&]() {
+        return SQLiteQueryExecutor::getStorage().prepare(update_all(
+            set(c(&Message::id) = to), where(c(&Message::id) == from)));
+      });
+  removeStatement.execute(
+      [&to](auto &preparedStatement) { get<0>(preparedStatement) = to; });
+  updateStatement.execute([&](auto &preparedStatement) {
+    get<0>(preparedStatement) = to;
+    get<1>(preparedStatement) = from;
+  });
 }
 
 void SQLiteQueryExecutor::removeAllMedia() const {
@@ -705,44 +1542,192 @@ void SQLiteQueryExecutor::removeAllMedia() const {
 
 void SQLiteQueryExecutor::removeMediaForMessages(
     const std::vector<std::string> &msg_ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(in(&Media::container, msg_ids)));
+  forEachChunk(msg_ids, [](const std::vector<std::string> &chunk) {
+    SQLiteQueryExecutor::getStorage().remove_all<Media>(
+        where(in(&Media::container, chunk)));
+  });
 }
 
 void SQLiteQueryExecutor::removeMediaForMessage(std::string msg_id) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(c(&Media::container) == msg_id));
+  thread_local auto statement = makeCachedStatement(
+      "removeMediaForMessage", SQLiteQueryExecutor::getStorage(), [&msg_id]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            remove_all<Media>(where(c(&Media::container) == msg_id)));
+      });
+  statement.execute([&msg_id](auto &preparedStatement) {
+    get<0>(preparedStatement) = msg_id;
+  });
 }
 
 void SQLiteQueryExecutor::removeMediaForThreads(
     const std::vector<std::string> &thread_ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(in(&Media::thread, thread_ids)));
+  forEachChunk(thread_ids, [](const std::vector<std::string> &chunk) {
+    SQLiteQueryExecutor::getStorage().remove_all<Media>(
+        where(in(&Media::thread, chunk)));
+  });
 }
 
 void SQLiteQueryExecutor::replaceMedia(const Media &media) const {
-  SQLiteQueryExecutor::getStorage().replace(media);
+  thread_local auto statement = makeCachedStatement(
+      "replaceMedia", SQLiteQueryExecutor::getStorage(), [&media]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            replace(std::cref(media)));
+      });
+  statement.execute([&media](auto &preparedStatement) {
+    preparedStatement.t.obj = std::cref(media);
+  });
+}
+
+void SQLiteQueryExecutor::replaceMediaItems(
+    const std::vector<Media> &mediaItems) const {
+  // Every media row binds 6 variables
+  const size_t chunkSize = MAX_SQL_VARIABLES_IN_QUERY / 6;
+  for (size_t chunkStart = 0; chunkStart < mediaItems.size();
+       chunkStart += chunkSize) {
+    size_t chunkEnd = std::min(chunkStart + chunkSize, mediaItems.size());
+    SQLiteQueryExecutor::getStorage().replace_range(
+        mediaItems.begin() + chunkStart, mediaItems.begin() + chunkEnd);
+  }
 }
 
 void SQLiteQueryExecutor::rekeyMediaContainers(std::string from, std::string to)
     const {
-  SQLiteQueryExecutor::getStorage().update_all(
-      set(c(&Media::container) = to), where(c(&Media::container) == from));
+  thread_local auto statement = makeCachedStatement(
+      "rekeyMediaContainers", SQLiteQueryExecutor::getStorage(), [&]() {
+        return SQLiteQueryExecutor::getStorage().prepare(update_all(
+            set(c(&Media::container) = to),
+            where(c(&Media::container) == from)));
+      });
+  statement.execute([&](auto &preparedStatement) {
+    get<0>(preparedStatement) = to;
+    get<1>(preparedStatement) = from;
+  });
 }
 
 std::vector<Thread> SQLiteQueryExecutor::getAllThreads() const {
-  return SQLiteQueryExecutor::getStorage().get_all<Thread>();
+  return SQLiteQueryExecutor::getReadStorage().get_all<Thread>();
 };
 
 void SQLiteQueryExecutor::removeThreads(std::vector<std::string> ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Thread>(
-      where(in(&Thread::id, ids)));
+  forEachChunk(ids, [](const std::vector<std::string> &chunk) {
+    SQLiteQueryExecutor::getStorage().remove_all<Thread>(
+        where(in(&Thread::id, chunk)));
+  });
 };
 
 void SQLiteQueryExecutor::replaceThread(const Thread &thread) const {
-  SQLiteQueryExecutor::getStorage().replace(thread);
+  thread_local auto statement = makeCachedStatement(
+      "replaceThread", SQLiteQueryExecutor::getStorage(), [&thread]() {
+        return SQLiteQueryExecutor::getStorage().prepare(
+            replace(std::cref(thread)));
+      });
+  statement.execute([&thread](auto &preparedStatement) {
+    preparedStatement.t.obj = std::cref(thread);
+  });
 };
 
+std::vector<Thread>
+SQLiteQueryExecutor::getThreadsOfMember(std::string userID) const {
+  auto &storage = SQLiteQueryExecutor::getReadStorage();
+  sqlite3 *db = SQLiteQueryExecutor::getReadConnection();
+  if (!get_metadata(db, "incremental_migration_finished/thread_members")
+           .empty()) {
+    return storage.get_all<Thread>(where(in(
+        &Thread::id,
+        select(
+            &ThreadMember::thread,
+            where(c(&ThreadMember::user) == userID)))));
+  }
+
+  // Threads stored before thread_members was created may still be missing
+  // from it, so their members are read from the JSON until it's backfilled
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(
+      db,
+      "SELECT DISTINCT threads.id "
+      "FROM threads, json_each(threads.members) AS member "
+      "WHERE json_valid(threads.members) "
+      "AND json_extract(member.value, '$.id') = ?;",
+      -1,
+      &stmt,
+      nullptr);
+  if (rc != SQLITE_OK) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to prepare thread members query: " +
+            std::string(sqlite3_errmsg(db)));
+  }
+  sqlite3_bind_text(stmt, 1, userID.c_str(), -1, SQLITE_TRANSIENT);
+  std::vector<std::string> threadIDs;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    threadIDs.push_back(
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+  }
+  sqlite3_finalize(stmt);
+  if (rc != SQLITE_DONE) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to read thread members: " + std::string(sqlite3_errmsg(db)));
+  }
+
+  std::vector<Thread> threads;
+  forEachChunk(threadIDs, [&](const std::vector<std::string> &chunk) {
+    std::vector<Thread> chunkThreads =
+        storage.get_all<Thread>(where(in(&Thread::id, chunk)));
+    std::move(
+        chunkThreads.begin(), chunkThreads.end(), std::back_inserter(threads));
+  });
+  return threads;
+}
+
+bool SQLiteQueryExecutor::updateThreadUnreadStatus(
+    std::string threadID,
+    bool unread) const {
+  // sqlite_orm doesn't support JSON functions, so the statement is executed
+  // on the raw handle of the connection of this thread. This way it's part of
+  // the transaction in progress, if any.
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  auto fail = [&](const std::string &reason) {
+    return std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to " + reason + " unread status of thread " + threadID +
+            ": " + std::string(sqlite3_errmsg(db)));
+  };
+
+  sqlite3_stmt *stmt;
+  int rc = sqlite3_prepare_v2(
+      db,
+      "UPDATE threads "
+      "SET current_user = json_set(current_user, '$.unread', json(?)) "
+      "WHERE id = ?;",
+      -1,
+      &stmt,
+      nullptr);
+  if (rc != SQLITE_OK) {
+    throw fail("prepare update of");
+  }
+  if (sqlite3_bind_text(
+          stmt, 1, unread ? "true" : "false", -1, SQLITE_STATIC) !=
+          SQLITE_OK ||
+      sqlite3_bind_text(stmt, 2, threadID.c_str(), -1, SQLITE_TRANSIENT) !=
+          SQLITE_OK) {
+    std::system_error error = fail("bind");
+    sqlite3_finalize(stmt);
+    throw error;
+  }
+  rc = sqlite3_step(stmt);
+  if (rc != SQLITE_DONE) {
+    std::system_error error = fail("update");
+    sqlite3_finalize(stmt);
+    throw error;
+  }
+  sqlite3_finalize(stmt);
+  return sqlite3_changes(db) > 0;
+}
+
 void SQLiteQueryExecutor::removeAllThreads() const {
   SQLiteQueryExecutor::getStorage().remove_all<Thread>();
 };
@@ -779,15 +1764,45 @@ SQLiteQueryExecutor::getOlmPersistAccountData() const {
       : folly::Optional<std::string>(result[0].account_data);
 }
 
+size_t SQLiteQueryExecutor::getOlmPersistPublishedOneTimeKeysCount() const {
+  std::unique_ptr<Metadata> entry =
+      SQLiteQueryExecutor::getStorage().get_pointer<Metadata>(
+          PUBLISHED_ONE_TIME_KEYS_COUNT_KEY);
+  return (entry == nullptr) ? 0 : std::stoul(entry->data);
+}
+
 void SQLiteQueryExecutor::storeOlmPersistData(crypto::Persist persist) const {
-  OlmPersistAccount persistAccount = {
-      ACCOUNT_ID, std::string(persist.account.begin(), persist.account.end())};
-  SQLiteQueryExecutor::getStorage().replace(persistAccount);
-  for (auto it = persist.sessions.begin(); it != persist.sessions.end(); it++) {
-    OlmPersistSession persistSession = {
-        it->first, std::string(it->second.begin(), it->second.end())};
-    SQLiteQueryExecutor::getStorage().replace(persistSession);
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  // An empty account means only the sessions changed (see
+  // CryptoModule::storeDirty)
+  auto store = [&]() {
+    if (!persist.account.empty()) {
+      OlmPersistAccount persistAccount = {
+          ACCOUNT_ID,
+          std::string(persist.account.begin(), persist.account.end())};
+      storage.replace(persistAccount);
+      Metadata publishedOneTimeKeysCount{
+          PUBLISHED_ONE_TIME_KEYS_COUNT_KEY,
+          std::to_string(persist.publishedOneTimeKeysCount)};
+      storage.replace(publishedOneTimeKeysCount);
+    }
+    for (auto it = persist.sessions.begin(); it != persist.sessions.end();
+         it++) {
+      OlmPersistSession persistSession = {
+          it->first, std::string(it->second.begin(), it->second.end())};
+      storage.replace(persistSession);
+    }
+  };
+  // Joins the transaction in progress, if any, e.g. when the sessions are
+  // stored together with the messages decrypted with them
+  if (!sqlite3_get_autocommit(SQLiteQueryExecutor::getConnection())) {
+    store();
+    return;
   }
+  storage.transaction([&]() {
+    store();
+    return true;
+  });
 }
 
 void SQLiteQueryExecutor::setNotifyToken(std::string token) const {
@@ -798,6 +1813,20 @@ void SQLiteQueryExecutor::setNotifyToken(std::string token) const {
   SQLiteQueryExecutor::getStorage().replace(entry);
 }
 
+std::vector<SQLiteStatementStats> SQLiteQueryExecutor::getStatementsStats() {
+  std::lock_guard<std::mutex> lock(statementCountersMutex);
+  std::vector<SQLiteStatementStats> stats;
+  stats.reserve(statementCounters.size());
+  for (const auto &counters : statementCounters) {
+    stats.push_back(SQLiteStatementStats{
+        counters->name,
+        counters->executionsCount,
+        counters->totalExecutionTime,
+        counters->maxExecutionTime});
+  }
+  return stats;
+}
+
 void SQLiteQueryExecutor::clearNotifyToken() const {
   SQLiteQueryExecutor::getStorage().remove<Metadata>("notify_token");
 }
@@ -4,16 +4,43 @@
 #include "DatabaseQueryExecutor.h"
 #include "entities/Draft.h"
 
+#include <sqlite3.h>
+
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <string>
+#include <vector>
 
 namespace comm {
 
+// Counters of a cached prepared statement, times are in microseconds
+struct SQLiteStatementStats {
+  std::string name;
+  uint64_t executionsCount;
+  uint64_t totalExecutionTime;
+  uint64_t maxExecutionTime;
+};
+
 class SQLiteQueryExecutor : public DatabaseQueryExecutor {
   void migrate();
   static auto &getStorage();
+  static auto &getReadStorage();
+  // Raw handles of the connections of the calling thread, for the queries
+  // sqlite_orm can't express
+  static sqlite3 *getConnection();
+  static sqlite3 *getReadConnection();
+  static std::vector<std::pair<Message, std::vector<Media>>>
+  attachMediaToMessages(std::vector<Message> messages);
 
   static std::once_flag initialized;
+  static std::mutex migrationMutex;
+  // Set once all the incremental migrations are applied or a step failed too
+  // many times in a row
+  static std::atomic<bool> incrementalMigrationsStopped;
+  // Incremental migration steps only run on the database thread
+  static int incrementalMigrationFailuresCount;
+  static std::chrono::steady_clock::time_point incrementalMigrationRetryTime;
   static int sqlcipherEncryptionKeySize;
   static std::string secureStoreEncryptionKeyID;
 
@@ -23,6 +50,11 @@ public:
 
   SQLiteQueryExecutor();
   static void initialize(std::string &databasePath);
+  // Summed up over the connections of all the threads
+  static std::vector<SQLiteStatementStats> getStatementsStats();
+  // Makes queries which only read data use a separate read-only connection
+  // when executed on the calling thread
+  static void registerReaderThread();
   std::unique_ptr<Thread> getThread(std::string threadID) const override;
   std::string getDraft(std::string key) const override;
   void updateDraft(std::string key, std::string text) const override;
@@ -32,10 +64,21 @@ public:
   void removeAllMessages() const override;
   std::vector<std::pair<Message, std::vector<Media>>>
   getAllMessages() const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getMessagesForThread(
+      std::string threadID,
+      int64_t beforeTime,
+      int limit) const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getLatestMessagesPerThread(int limit) const override;
+  std::vector<std::pair<Message, std::vector<Media>>> searchMessages(
+      std::string query,
+      folly::Optional<std::string> threadID,
+      int limit) const override;
   void removeMessages(const std::vector<std::string> &ids) const override;
   void removeMessagesForThreads(
       const std::vector<std::string> &threadIDs) const override;
   void replaceMessage(const Message &message) const override;
+  void replaceMessages(const std::vector<Message> &messages) const override;
   void rekeyMessage(std::string from, std::string to) const override;
   void removeAllMedia() const override;
   void removeMediaForMessages(
@@ -44,16 +87,22 @@ public:
   void removeMediaForThreads(
       const std::vector<std::string> &thread_ids) const override;
   void replaceMedia(const Media &media) const override;
+  void replaceMediaItems(const std::vector<Media> &mediaItems) const override;
   void rekeyMediaContainers(std::string from, std::string to) const override;
   std::vector<Thread> getAllThreads() const override;
+  std::vector<Thread> getThreadsOfMember(std::string userID) const override;
   void removeThreads(std::vector<std::string> ids) const override;
   void replaceThread(const Thread &thread) const override;
+  bool
+  updateThreadUnreadStatus(std::string threadID, bool unread) const override;
   void removeAllThreads() const override;
   void beginTransaction() const override;
   void commitTransaction() const override;
   void rollbackTransaction() const override;
+  bool runIncrementalMigrationStep() const override;
   std::vector<OlmPersistSession> getOlmPersistSessionsData() const override;
   folly::Optional<std::string> getOlmPersistAccountData() const override;
+  size_t getOlmPersistPublishedOneTimeKeysCount() const override;
   void storeOlmPersistData(crypto::Persist persist) const override;
   void setNotifyToken(std::string token) const override;
   void clearNotifyToken() const override;
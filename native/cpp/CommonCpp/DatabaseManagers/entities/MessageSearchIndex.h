@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+namespace comm {
+
+// Row of the messages_search FTS5 table. Only its hidden column named after
+// the table is mapped, comparing it with a query is the same as MATCH.
+struct MessageSearchIndex {
+  std::string messages_search;
+};
+
+} // namespace comm
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace comm {
+
+// Row of thread_members, which is only written by the triggers on threads
+struct ThreadMember {
+  std::string thread;
+  std::string user;
+  std::unique_ptr<std::string> role;
+};
+
+} // namespace comm
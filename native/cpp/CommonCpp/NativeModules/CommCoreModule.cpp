@@ -4,20 +4,33 @@
 #include "InternalModules/GlobalNetworkSingleton.h"
 #include "InternalModules/NetworkModule.h"
 #include "Logger.h"
+#include "MessageOperationsUtilities.h"
 #include "MessageStoreOperations.h"
 #include "ThreadStoreOperations.h"
 
 #include <folly/Optional.h>
+#include <folly/json.h>
 
 #include "../DatabaseManagers/entities/Media.h"
 
 #include <ReactCommon/TurboModuleUtils.h>
+#include <algorithm>
+#include <charconv>
 #include <future>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace comm {
 
 using namespace facebook::react;
 
+// Tasks scheduled from the JS thread are rejected instead of waiting for the
+// worker queues to drain, so JS is never blocked
+static const char *const queueFullError =
+    "too many pending operations, try again later";
+
 jsi::Value CommCoreModule::getDraft(jsi::Runtime &rt, const jsi::String &key) {
   std::string keyStr = key.utf8(rt);
   return createPromiseAsJSIValue(
@@ -39,7 +52,9 @@ jsi::Value CommCoreModule::getDraft(jsi::Runtime &rt, const jsi::String &key) {
             promise->resolve(std::move(draft));
           });
         };
-        this->databaseThread->scheduleTask(job);
+        if (!this->scheduleDatabaseReadTask(job, TaskPriority::INTERACTIVE)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -64,7 +79,19 @@ CommCoreModule::updateDraft(jsi::Runtime &rt, const jsi::Object &draft) {
             }
           });
         };
-        this->databaseThread->scheduleTask(job);
+        // Only the latest text of a draft has to be written, the earlier
+        // updates still waiting in the queue are resolved without writing
+        taskType onCoalesced = [=]() {
+          this->jsInvoker_->invokeAsync([=]() { promise->resolve(true); });
+        };
+        bool scheduled = this->databaseThread->tryScheduleTask(
+            job,
+            TaskPriority::INTERACTIVE,
+            "updateDraft/" + keyStr,
+            onCoalesced);
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -94,7 +121,10 @@ jsi::Value CommCoreModule::moveDraft(
             }
           });
         };
-        this->databaseThread->scheduleTask(job);
+        if (!this->databaseThread->tryScheduleTask(
+                job, TaskPriority::INTERACTIVE)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -134,7 +164,9 @@ jsi::Value CommCoreModule::getAllDrafts(jsi::Runtime &rt) {
             promise->resolve(std::move(jsiDrafts));
           });
         };
-        this->databaseThread->scheduleTask(job);
+        if (!this->scheduleDatabaseReadTask(job, TaskPriority::INTERACTIVE)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -156,79 +188,201 @@ jsi::Value CommCoreModule::removeAllDrafts(jsi::Runtime &rt) {
             promise->resolve(jsi::Value::undefined());
           });
         };
-        this->databaseThread->scheduleTask(job);
+        if (!this->databaseThread->tryScheduleTask(
+                job, TaskPriority::INTERACTIVE)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
-jsi::Array CommCoreModule::getAllMessagesSync(jsi::Runtime &rt) {
-  std::promise<std::vector<std::pair<Message, std::vector<Media>>>>
-      messagesResult;
-  auto messagesResultFuture = messagesResult.get_future();
+// Property names are created once per conversion rather than once per
+// row, and every value is created directly from the row being converted.
+struct MessagePropNames {
+  jsi::PropNameID id, localID, thread, user, type, futureType, content, time,
+      mediaInfos, mediaID, mediaURI, mediaType, mediaExtras;
+
+  explicit MessagePropNames(jsi::Runtime &rt)
+      : id(jsi::PropNameID::forAscii(rt, "id")),
+        localID(jsi::PropNameID::forAscii(rt, "local_id")),
+        thread(jsi::PropNameID::forAscii(rt, "thread")),
+        user(jsi::PropNameID::forAscii(rt, "user")),
+        type(jsi::PropNameID::forAscii(rt, "type")),
+        futureType(jsi::PropNameID::forAscii(rt, "future_type")),
+        content(jsi::PropNameID::forAscii(rt, "content")),
+        time(jsi::PropNameID::forAscii(rt, "time")),
+        mediaInfos(jsi::PropNameID::forAscii(rt, "media_infos")),
+        mediaID(jsi::PropNameID::forAscii(rt, "id")),
+        mediaURI(jsi::PropNameID::forAscii(rt, "uri")),
+        mediaType(jsi::PropNameID::forAscii(rt, "type")),
+        mediaExtras(jsi::PropNameID::forAscii(rt, "extras")) {
+  }
+};
 
-  this->databaseThread->scheduleTask([&messagesResult]() {
-    messagesResult.set_value(
-        DatabaseManager::getQueryExecutor().getAllMessages());
-  });
+struct ThreadPropNames {
+  jsi::PropNameID id, type, name, description, color, creationTime,
+      parentThreadID, containingThreadID, community, members, roles,
+      currentUser, sourceMessageID, repliesCount;
+
+  explicit ThreadPropNames(jsi::Runtime &rt)
+      : id(jsi::PropNameID::forAscii(rt, "id")),
+        type(jsi::PropNameID::forAscii(rt, "type")),
+        name(jsi::PropNameID::forAscii(rt, "name")),
+        description(jsi::PropNameID::forAscii(rt, "description")),
+        color(jsi::PropNameID::forAscii(rt, "color")),
+        creationTime(jsi::PropNameID::forAscii(rt, "creationTime")),
+        parentThreadID(jsi::PropNameID::forAscii(rt, "parentThreadID")),
+        containingThreadID(
+            jsi::PropNameID::forAscii(rt, "containingThreadID")),
+        community(jsi::PropNameID::forAscii(rt, "community")),
+        members(jsi::PropNameID::forAscii(rt, "members")),
+        roles(jsi::PropNameID::forAscii(rt, "roles")),
+        currentUser(jsi::PropNameID::forAscii(rt, "currentUser")),
+        sourceMessageID(jsi::PropNameID::forAscii(rt, "sourceMessageID")),
+        repliesCount(jsi::PropNameID::forAscii(rt, "repliesCount")) {
+  }
+};
 
-  auto messagesVector = messagesResultFuture.get();
-  size_t numMessages{messagesVector.size()};
-  jsi::Array jsiMessages = jsi::Array(rt, numMessages);
+jsi::Value
+optionalStringToJSI(jsi::Runtime &rt, const std::unique_ptr<std::string> &str) {
+  return str ? jsi::Value(jsi::String::createFromUtf8(rt, *str))
+             : jsi::Value::null();
+}
+
+jsi::Array parseDBMessages(
+    jsi::Runtime &rt,
+    const std::vector<std::pair<Message, std::vector<Media>>> &messagesVector) {
+  const MessagePropNames propNames(rt);
+  jsi::Array jsiMessages = jsi::Array(rt, messagesVector.size());
 
   size_t writeIndex = 0;
   for (const auto &[message, media] : messagesVector) {
-    auto jsiMessage = jsi::Object(rt);
-    jsiMessage.setProperty(rt, "id", message.id);
-
+    jsi::Object jsiMessage = jsi::Object(rt);
+    jsiMessage.setProperty(
+        rt, propNames.id, jsi::String::createFromUtf8(rt, message.id));
     if (message.local_id) {
-      auto local_id = message.local_id.get();
-      jsiMessage.setProperty(rt, "local_id", *local_id);
+      jsiMessage.setProperty(
+          rt,
+          propNames.localID,
+          jsi::String::createFromUtf8(rt, *message.local_id));
     }
-
-    jsiMessage.setProperty(rt, "thread", message.thread);
-    jsiMessage.setProperty(rt, "user", message.user);
-    jsiMessage.setProperty(rt, "type", std::to_string(message.type));
-
+    jsiMessage.setProperty(
+        rt, propNames.thread, jsi::String::createFromUtf8(rt, message.thread));
+    jsiMessage.setProperty(
+        rt, propNames.user, jsi::String::createFromUtf8(rt, message.user));
+    jsiMessage.setProperty(
+        rt,
+        propNames.type,
+        jsi::String::createFromAscii(rt, std::to_string(message.type)));
     if (message.future_type) {
-      auto future_type = message.future_type.get();
-      jsiMessage.setProperty(rt, "future_type", std::to_string(*future_type));
+      jsiMessage.setProperty(
+          rt,
+          propNames.futureType,
+          jsi::String::createFromAscii(
+              rt, std::to_string(*message.future_type)));
     }
-
     if (message.content) {
-      auto content = message.content.get();
-      jsiMessage.setProperty(rt, "content", *content);
+      jsiMessage.setProperty(
+          rt,
+          propNames.content,
+          jsi::String::createFromUtf8(rt, *message.content));
     }
-    jsiMessage.setProperty(rt, "time", std::to_string(message.time));
+    jsiMessage.setProperty(
+        rt,
+        propNames.time,
+        jsi::String::createFromAscii(rt, std::to_string(message.time)));
 
     size_t media_idx = 0;
     jsi::Array jsiMediaArray = jsi::Array(rt, media.size());
     for (const auto &media_info : media) {
-      auto jsiMedia = jsi::Object(rt);
-      jsiMedia.setProperty(rt, "id", media_info.id);
-      jsiMedia.setProperty(rt, "uri", media_info.uri);
-      jsiMedia.setProperty(rt, "type", media_info.type);
-      jsiMedia.setProperty(rt, "extras", media_info.extras);
-
+      jsi::Object jsiMedia = jsi::Object(rt);
+      jsiMedia.setProperty(
+          rt,
+          propNames.mediaID,
+          jsi::String::createFromUtf8(rt, media_info.id));
+      jsiMedia.setProperty(
+          rt,
+          propNames.mediaURI,
+          jsi::String::createFromUtf8(rt, media_info.uri));
+      jsiMedia.setProperty(
+          rt,
+          propNames.mediaType,
+          jsi::String::createFromUtf8(rt, media_info.type));
+      jsiMedia.setProperty(
+          rt,
+          propNames.mediaExtras,
+          jsi::String::createFromUtf8(rt, media_info.extras));
       jsiMediaArray.setValueAtIndex(rt, media_idx++, jsiMedia);
     }
 
-    jsiMessage.setProperty(rt, "media_infos", jsiMediaArray);
+    jsiMessage.setProperty(rt, propNames.mediaInfos, jsiMediaArray);
     jsiMessages.setValueAtIndex(rt, writeIndex++, jsiMessage);
   }
 
   return jsiMessages;
 }
 
-jsi::Value CommCoreModule::getAllMessages(jsi::Runtime &rt) {
+jsi::Array
+parseDBThreads(jsi::Runtime &rt, const std::vector<Thread> &threads) {
+  const ThreadPropNames propNames(rt);
+  jsi::Array jsiThreads = jsi::Array(rt, threads.size());
+
+  size_t writeIdx = 0;
+  for (const Thread &thread : threads) {
+    jsi::Object jsiThread = jsi::Object(rt);
+    jsiThread.setProperty(
+        rt, propNames.id, jsi::String::createFromUtf8(rt, thread.id));
+    jsiThread.setProperty(rt, propNames.type, thread.type);
+    jsiThread.setProperty(
+        rt, propNames.name, optionalStringToJSI(rt, thread.name));
+    jsiThread.setProperty(
+        rt, propNames.description, optionalStringToJSI(rt, thread.description));
+    jsiThread.setProperty(
+        rt, propNames.color, jsi::String::createFromUtf8(rt, thread.color));
+    jsiThread.setProperty(
+        rt,
+        propNames.creationTime,
+        jsi::String::createFromAscii(rt, std::to_string(thread.creation_time)));
+    jsiThread.setProperty(
+        rt,
+        propNames.parentThreadID,
+        optionalStringToJSI(rt, thread.parent_thread_id));
+    jsiThread.setProperty(
+        rt,
+        propNames.containingThreadID,
+        optionalStringToJSI(rt, thread.containing_thread_id));
+    jsiThread.setProperty(
+        rt, propNames.community, optionalStringToJSI(rt, thread.community));
+    jsiThread.setProperty(
+        rt, propNames.members, jsi::String::createFromUtf8(rt, thread.members));
+    jsiThread.setProperty(
+        rt, propNames.roles, jsi::String::createFromUtf8(rt, thread.roles));
+    jsiThread.setProperty(
+        rt,
+        propNames.currentUser,
+        jsi::String::createFromUtf8(rt, thread.current_user));
+    jsiThread.setProperty(
+        rt,
+        propNames.sourceMessageID,
+        optionalStringToJSI(rt, thread.source_message_id));
+    jsiThread.setProperty(rt, propNames.repliesCount, thread.replies_count);
+
+    jsiThreads.setValueAtIndex(rt, writeIdx++, jsiThread);
+  }
+
+  return jsiThreads;
+}
+
+jsi::Value CommCoreModule::getMessagesAsync(
+    jsi::Runtime &rt,
+    std::function<std::vector<std::pair<Message, std::vector<Media>>>()> query,
+    const TaskPriority priority) {
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [=, &innerRt]() {
           std::string error;
           std::vector<std::pair<Message, std::vector<Media>>> messagesVector;
-          size_t numMessages;
           try {
-            messagesVector =
-                DatabaseManager::getQueryExecutor().getAllMessages();
-            numMessages = messagesVector.size();
+            messagesVector = query();
           } catch (std::system_error &e) {
             error = e.what();
           }
@@ -236,64 +390,99 @@ jsi::Value CommCoreModule::getAllMessages(jsi::Runtime &rt) {
               std::vector<std::pair<Message, std::vector<Media>>>>(
               std::move(messagesVector));
           this->jsInvoker_->invokeAsync(
-              [messagesVectorPtr, &innerRt, promise, error, numMessages]() {
+              [messagesVectorPtr, &innerRt, promise, error]() {
                 if (error.size()) {
                   promise->reject(error);
                   return;
                 }
-                jsi::Array jsiMessages = jsi::Array(innerRt, numMessages);
-                size_t writeIndex = 0;
-                for (const auto &[message, media] : *messagesVectorPtr) {
-                  auto jsiMessage = jsi::Object(innerRt);
-                  jsiMessage.setProperty(innerRt, "id", message.id);
-
-                  if (message.local_id) {
-                    auto local_id = message.local_id.get();
-                    jsiMessage.setProperty(innerRt, "local_id", *local_id);
-                  }
-
-                  jsiMessage.setProperty(innerRt, "thread", message.thread);
-                  jsiMessage.setProperty(innerRt, "user", message.user);
-                  jsiMessage.setProperty(
-                      innerRt, "type", std::to_string(message.type));
+                promise->resolve(parseDBMessages(innerRt, *messagesVectorPtr));
+              });
+        };
+        if (!this->scheduleDatabaseReadTask(job, priority)) {
+          promise->reject(queueFullError);
+        }
+      });
+}
 
-                  if (message.future_type) {
-                    auto future_type = message.future_type.get();
-                    jsiMessage.setProperty(
-                        innerRt, "future_type", std::to_string(*future_type));
-                  }
+jsi::Array CommCoreModule::getAllMessagesSync(jsi::Runtime &rt) {
+  std::promise<std::vector<std::pair<Message, std::vector<Media>>>>
+      messagesResult;
+  auto messagesResultFuture = messagesResult.get_future();
 
-                  if (message.content) {
-                    auto content = message.content.get();
-                    jsiMessage.setProperty(innerRt, "content", *content);
-                  }
+  bool scheduled = this->scheduleDatabaseReadTask([&messagesResult]() {
+    messagesResult.set_value(
+        DatabaseManager::getQueryExecutor().getAllMessages());
+  });
+  if (!scheduled) {
+    throw jsi::JSError(rt, queueFullError);
+  }
 
-                  jsiMessage.setProperty(
-                      innerRt, "time", std::to_string(message.time));
+  auto messagesVector = messagesResultFuture.get();
+  return parseDBMessages(rt, messagesVector);
+}
 
-                  size_t media_idx = 0;
-                  jsi::Array jsiMediaArray = jsi::Array(innerRt, media.size());
-                  for (const auto &media_info : media) {
-                    auto jsiMedia = jsi::Object(innerRt);
-                    jsiMedia.setProperty(innerRt, "id", media_info.id);
-                    jsiMedia.setProperty(innerRt, "uri", media_info.uri);
-                    jsiMedia.setProperty(innerRt, "type", media_info.type);
-                    jsiMedia.setProperty(innerRt, "extras", media_info.extras);
+jsi::Value CommCoreModule::getAllMessages(jsi::Runtime &rt) {
+  return this->getMessagesAsync(rt, []() {
+    return DatabaseManager::getQueryExecutor().getAllMessages();
+  });
+}
 
-                    jsiMediaArray.setValueAtIndex(
-                        innerRt, media_idx++, jsiMedia);
-                  }
+jsi::Value CommCoreModule::getMessagesForThread(
+    jsi::Runtime &rt,
+    const jsi::String &threadID,
+    const jsi::String &beforeTime,
+    double limit) {
+  std::string threadIDStr = threadID.utf8(rt);
+  std::string beforeTimeStr = beforeTime.utf8(rt);
+  int64_t beforeTimeValue;
+  auto parseResult = std::from_chars(
+      beforeTimeStr.data(),
+      beforeTimeStr.data() + beforeTimeStr.size(),
+      beforeTimeValue);
+  if (parseResult.ec != std::errc() ||
+      parseResult.ptr != beforeTimeStr.data() + beforeTimeStr.size()) {
+    return createPromiseAsJSIValue(
+        rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+          promise->reject("invalid beforeTime: " + beforeTimeStr);
+        });
+  }
+  int limitValue = static_cast<int>(limit);
+  return this->getMessagesAsync(
+      rt,
+      [=]() {
+        return DatabaseManager::getQueryExecutor().getMessagesForThread(
+            threadIDStr, beforeTimeValue, limitValue);
+      },
+      TaskPriority::INTERACTIVE);
+}
 
-                  jsiMessage.setProperty(innerRt, "media_infos", jsiMediaArray);
+jsi::Value
+CommCoreModule::getLatestMessagesPerThread(jsi::Runtime &rt, double limit) {
+  int limitValue = static_cast<int>(limit);
+  return this->getMessagesAsync(rt, [=]() {
+    return DatabaseManager::getQueryExecutor().getLatestMessagesPerThread(
+        limitValue);
+  });
+}
 
-                  jsiMessages.setValueAtIndex(
-                      innerRt, writeIndex++, jsiMessage);
-                }
-                promise->resolve(std::move(jsiMessages));
-              });
-        };
-        this->databaseThread->scheduleTask(job);
-      });
+jsi::Value CommCoreModule::searchMessages(
+    jsi::Runtime &rt,
+    const jsi::String &query,
+    const std::optional<jsi::String> &threadID,
+    double limit) {
+  std::string queryStr = query.utf8(rt);
+  folly::Optional<std::string> threadIDStr;
+  if (threadID.has_value()) {
+    threadIDStr = threadID->utf8(rt);
+  }
+  int limitValue = static_cast<int>(limit);
+  return this->getMessagesAsync(
+      rt,
+      [=]() {
+        return DatabaseManager::getQueryExecutor().searchMessages(
+            queryStr, threadIDStr, limitValue);
+      },
+      TaskPriority::INTERACTIVE);
 }
 
 #define REKEY_OPERATION "rekey"
@@ -364,10 +553,12 @@ jsi::Value CommCoreModule::processMessageStoreOperations(
 
           if (!error.size()) {
             try {
-              DatabaseManager::getQueryExecutor().beginTransaction();
+              MessageStoreOperationsPlanner planner;
               for (const auto &operation : *messageStoreOpsPtr) {
-                operation->execute();
+                operation->addToPlan(planner);
               }
+              DatabaseManager::getQueryExecutor().beginTransaction();
+              planner.execute();
               DatabaseManager::getQueryExecutor().commitTransaction();
             } catch (std::system_error &e) {
               error = e.what();
@@ -383,7 +574,9 @@ jsi::Value CommCoreModule::processMessageStoreOperations(
             }
           });
         };
-        this->databaseThread->scheduleTask(job);
+        if (!this->databaseThread->tryScheduleTask(job)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -403,15 +596,17 @@ bool CommCoreModule::processMessageStoreOperationsSync(
     return false;
   }
 
-  this->databaseThread->scheduleTask(
+  bool scheduled = this->databaseThread->tryScheduleTask(
       [=, &messageStoreOps, &operationsResult, &rt]() {
         std::string error = operationsError;
         if (!error.size()) {
           try {
-            DatabaseManager::getQueryExecutor().beginTransaction();
+            MessageStoreOperationsPlanner planner;
             for (const auto &operation : messageStoreOps) {
-              operation->execute();
+              operation->addToPlan(planner);
             }
+            DatabaseManager::getQueryExecutor().beginTransaction();
+            planner.execute();
             DatabaseManager::getQueryExecutor().commitTransaction();
           } catch (std::system_error &e) {
             error = e.what();
@@ -420,19 +615,20 @@ bool CommCoreModule::processMessageStoreOperationsSync(
         }
         operationsResult.set_value(error.size() == 0);
       });
+  if (!scheduled) {
+    return false;
+  }
   return operationsResultFuture.get();
 }
 
 jsi::Value CommCoreModule::getAllThreads(jsi::Runtime &rt) {
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        this->databaseThread->scheduleTask([=, &innerRt]() {
+        bool scheduled = this->scheduleDatabaseReadTask([=, &innerRt]() {
           std::string error;
           std::vector<Thread> threadsVector;
-          size_t numThreads;
           try {
             threadsVector = DatabaseManager::getQueryExecutor().getAllThreads();
-            numThreads = threadsVector.size();
           } catch (std::system_error &e) {
             error = e.what();
           }
@@ -443,136 +639,61 @@ jsi::Value CommCoreModule::getAllThreads(jsi::Runtime &rt) {
               promise->reject(error);
               return;
             }
-
-            jsi::Array jsiThreads = jsi::Array(innerRt, numThreads);
-            size_t writeIdx = 0;
-            for (const Thread &thread : *threadsVectorPtr) {
-              jsi::Object jsiThread = jsi::Object(innerRt);
-              jsiThread.setProperty(innerRt, "id", thread.id);
-              jsiThread.setProperty(innerRt, "type", thread.type);
-              jsiThread.setProperty(
-                  innerRt,
-                  "name",
-                  thread.name
-                      ? jsi::String::createFromUtf8(innerRt, *thread.name)
-                      : jsi::Value::null());
-              jsiThread.setProperty(
-                  innerRt,
-                  "description",
-                  thread.description ? jsi::String::createFromUtf8(
-                                           innerRt, *thread.description)
-                                     : jsi::Value::null());
-              jsiThread.setProperty(innerRt, "color", thread.color);
-              jsiThread.setProperty(
-                  innerRt,
-                  "creationTime",
-                  std::to_string(thread.creation_time));
-              jsiThread.setProperty(
-                  innerRt,
-                  "parentThreadID",
-                  thread.parent_thread_id
-                      ? jsi::String::createFromUtf8(
-                            innerRt, *thread.parent_thread_id)
-                      : jsi::Value::null());
-              jsiThread.setProperty(
-                  innerRt,
-                  "containingThreadID",
-                  thread.containing_thread_id
-                      ? jsi::String::createFromUtf8(
-                            innerRt, *thread.containing_thread_id)
-                      : jsi::Value::null());
-              jsiThread.setProperty(
-                  innerRt,
-                  "community",
-                  thread.community
-                      ? jsi::String::createFromUtf8(innerRt, *thread.community)
-                      : jsi::Value::null());
-              jsiThread.setProperty(innerRt, "members", thread.members);
-              jsiThread.setProperty(innerRt, "roles", thread.roles);
-              jsiThread.setProperty(
-                  innerRt, "currentUser", thread.current_user);
-              jsiThread.setProperty(
-                  innerRt,
-                  "sourceMessageID",
-                  thread.source_message_id
-                      ? jsi::String::createFromUtf8(
-                            innerRt, *thread.source_message_id)
-                      : jsi::Value::null());
-              jsiThread.setProperty(
-                  innerRt, "repliesCount", thread.replies_count);
-
-              jsiThreads.setValueAtIndex(innerRt, writeIdx++, jsiThread);
-            }
-            promise->resolve(std::move(jsiThreads));
+            promise->resolve(parseDBThreads(innerRt, *threadsVectorPtr));
           });
         });
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 };
 
+jsi::Value CommCoreModule::getThreadsOfMember(
+    jsi::Runtime &rt,
+    const jsi::String &userID) {
+  std::string userIDStr = userID.utf8(rt);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          std::vector<Thread> threadsVector;
+          try {
+            threadsVector =
+                DatabaseManager::getQueryExecutor().getThreadsOfMember(
+                    userIDStr);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          auto threadsVectorPtr =
+              std::make_shared<std::vector<Thread>>(std::move(threadsVector));
+          this->jsInvoker_->invokeAsync([=, &innerRt]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(parseDBThreads(innerRt, *threadsVectorPtr));
+          });
+        };
+        if (!this->scheduleDatabaseReadTask(job, TaskPriority::INTERACTIVE)) {
+          promise->reject(queueFullError);
+        }
+      });
+}
+
 jsi::Array CommCoreModule::getAllThreadsSync(jsi::Runtime &rt) {
   std::promise<std::vector<Thread>> threadsResult;
   auto threadsResultFuture = threadsResult.get_future();
 
-  this->databaseThread->scheduleTask([&threadsResult]() {
+  bool scheduled = this->scheduleDatabaseReadTask([&threadsResult]() {
     threadsResult.set_value(
         DatabaseManager::getQueryExecutor().getAllThreads());
   });
-
-  auto threadsVector = threadsResultFuture.get();
-  size_t numThreads{threadsVector.size()};
-  jsi::Array jsiThreads = jsi::Array(rt, numThreads);
-
-  size_t writeIdx = 0;
-  for (const Thread &thread : threadsVector) {
-    jsi::Object jsiThread = jsi::Object(rt);
-    jsiThread.setProperty(rt, "id", thread.id);
-    jsiThread.setProperty(rt, "type", thread.type);
-    jsiThread.setProperty(
-        rt,
-        "name",
-        thread.name ? jsi::String::createFromUtf8(rt, *thread.name)
-                    : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "description",
-        thread.description
-            ? jsi::String::createFromUtf8(rt, *thread.description)
-            : jsi::Value::null());
-    jsiThread.setProperty(rt, "color", thread.color);
-    jsiThread.setProperty(
-        rt, "creationTime", std::to_string(thread.creation_time));
-    jsiThread.setProperty(
-        rt,
-        "parentThreadID",
-        thread.parent_thread_id
-            ? jsi::String::createFromUtf8(rt, *thread.parent_thread_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "containingThreadID",
-        thread.containing_thread_id
-            ? jsi::String::createFromUtf8(rt, *thread.containing_thread_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "community",
-        thread.community ? jsi::String::createFromUtf8(rt, *thread.community)
-                         : jsi::Value::null());
-    jsiThread.setProperty(rt, "members", thread.members);
-    jsiThread.setProperty(rt, "roles", thread.roles);
-    jsiThread.setProperty(rt, "currentUser", thread.current_user);
-    jsiThread.setProperty(
-        rt,
-        "sourceMessageID",
-        thread.source_message_id
-            ? jsi::String::createFromUtf8(rt, *thread.source_message_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(rt, "repliesCount", thread.replies_count);
-
-    jsiThreads.setValueAtIndex(rt, writeIdx++, jsiThread);
+  if (!scheduled) {
+    throw jsi::JSError(rt, queueFullError);
   }
 
-  return jsiThreads;
+  auto threadsVector = threadsResultFuture.get();
+  return parseDBThreads(rt, threadsVector);
 }
 
 std::vector<std::unique_ptr<ThreadStoreOperationBase>>
@@ -696,7 +817,7 @@ jsi::Value CommCoreModule::processThreadStoreOperations(
   }
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        this->databaseThread->scheduleTask([=]() {
+        bool scheduled = this->databaseThread->tryScheduleTask([=]() {
           std::string error = operationsError;
           if (!error.size()) {
             try {
@@ -718,6 +839,9 @@ jsi::Value CommCoreModule::processThreadStoreOperations(
             }
           });
         });
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -734,7 +858,7 @@ bool CommCoreModule::processThreadStoreOperationsSync(
   } catch (std::runtime_error &e) {
     return false;
   }
-  this->databaseThread->scheduleTask(
+  bool scheduled = this->databaseThread->tryScheduleTask(
       [=, &threadStoreOps, &operationsResult, &rt]() {
         std::string error = operationsError;
         if (!error.size()) {
@@ -751,6 +875,9 @@ bool CommCoreModule::processThreadStoreOperationsSync(
         }
         operationsResult.set_value(error.size() == 0);
       });
+  if (!scheduled) {
+    return false;
+  }
   return operationsResultFuture.get();
 }
 
@@ -768,7 +895,7 @@ jsi::Value CommCoreModule::initializeCryptoAccount(
 
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        this->databaseThread->scheduleTask([=]() {
+        bool scheduled = this->databaseThread->tryScheduleTask([=]() {
           crypto::Persist persist;
           std::string error;
           try {
@@ -788,6 +915,9 @@ jsi::Value CommCoreModule::initializeCryptoAccount(
                 persist.sessions.insert(std::make_pair(
                     sessionsDataItem.target_user_id, sessionDataBuffer));
               }
+              persist.publishedOneTimeKeysCount =
+                  DatabaseManager::getQueryExecutor()
+                      .getOlmPersistPublishedOneTimeKeysCount();
             }
           } catch (std::system_error &e) {
             error = e.what();
@@ -795,11 +925,16 @@ jsi::Value CommCoreModule::initializeCryptoAccount(
 
           this->cryptoThread->scheduleTask([=]() {
             std::string error;
-            this->cryptoModule.reset(new crypto::CryptoModule(
-                userIdStr, storedSecretKey.value(), persist));
+            auto cryptoModule = std::make_shared<crypto::CryptoModule>(
+                userIdStr, storedSecretKey.value(), persist);
+            // Read without waiting for the crypto thread by the tasks on the
+            // crypto session threads
+            std::atomic_store(&this->cryptoModule, cryptoModule);
+            // so the keys are ready by the time they have to be published
+            this->scheduleOneTimeKeysReplenishing();
             if (persist.isEmpty()) {
               crypto::Persist newPersist =
-                  this->cryptoModule->storeAsB64(storedSecretKey.value());
+                  cryptoModule->storeAsB64(storedSecretKey.value());
               this->databaseThread->scheduleTask([=]() {
                 std::string error;
                 try {
@@ -818,8 +953,6 @@ jsi::Value CommCoreModule::initializeCryptoAccount(
               });
 
             } else {
-              this->cryptoModule->restoreFromB64(
-                  storedSecretKey.value(), persist);
               this->jsInvoker_->invokeAsync([=]() {
                 if (error.size()) {
                   promise->reject(error);
@@ -830,6 +963,9 @@ jsi::Value CommCoreModule::initializeCryptoAccount(
             }
           });
         });
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -837,10 +973,14 @@ void CommCoreModule::initializeNetworkModule(
     const std::string &userId,
     const std::string &deviceToken,
     const std::string &hostname) {
-  GlobalNetworkSingleton::instance.scheduleOrRun(
+  bool scheduled = GlobalNetworkSingleton::instance.tryScheduleOrRun(
       [=](NetworkModule &networkModule) {
         networkModule.initializeNetworkModule(userId, deviceToken, hostname);
-      });
+      },
+      TaskPriority::INTERACTIVE);
+  if (!scheduled) {
+    Logger::log("Dropped initializing the network module, queue is full");
+  }
 }
 
 jsi::Value CommCoreModule::getUserPublicKey(jsi::Runtime &rt) {
@@ -849,10 +989,12 @@ jsi::Value CommCoreModule::getUserPublicKey(jsi::Runtime &rt) {
         taskType job = [=, &innerRt]() {
           std::string error;
           std::string result;
-          if (this->cryptoModule == nullptr) {
+          std::shared_ptr<crypto::CryptoModule> cryptoModule =
+              std::atomic_load(&this->cryptoModule);
+          if (cryptoModule == nullptr) {
             error = "user has not been initialized";
           } else {
-            result = this->cryptoModule->getIdentityKeys();
+            result = cryptoModule->getIdentityKeys();
           }
           this->jsInvoker_->invokeAsync([=, &innerRt]() {
             if (error.size()) {
@@ -862,7 +1004,9 @@ jsi::Value CommCoreModule::getUserPublicKey(jsi::Runtime &rt) {
             promise->resolve(jsi::String::createFromUtf8(innerRt, result));
           });
         };
-        this->cryptoThread->scheduleTask(job);
+        if (!this->cryptoThread->tryScheduleTask(job)) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
@@ -872,35 +1016,591 @@ jsi::Value CommCoreModule::getUserOneTimeKeys(jsi::Runtime &rt) {
         taskType job = [=, &innerRt]() {
           std::string error;
           std::string result;
-          if (this->cryptoModule == nullptr) {
+          std::shared_ptr<crypto::CryptoModule> cryptoModule =
+              std::atomic_load(&this->cryptoModule);
+          if (cryptoModule == nullptr) {
             error = "user has not been initialized";
           } else {
-            result = this->cryptoModule->getOneTimeKeys();
+            result = cryptoModule->getOneTimeKeys();
           }
-          this->jsInvoker_->invokeAsync([=, &innerRt]() {
+          if (error.size()) {
+            this->jsInvoker_->invokeAsync([=]() { promise->reject(error); });
+            return;
+          }
+          // The generated keys have to be persisted before they're published,
+          // otherwise the sessions other devices create with them can't be
+          // opened after a restart
+          this->persistCryptoChanges([=, &innerRt](const std::string &error) {
             if (error.size()) {
               promise->reject(error);
               return;
             }
             promise->resolve(jsi::String::createFromUtf8(innerRt, result));
           });
+          this->scheduleOneTimeKeysReplenishing();
         };
-        this->cryptoThread->scheduleTask(job);
+        if (!this->cryptoThread->tryScheduleTask(job)) {
+          promise->reject(queueFullError);
+        }
+      });
+}
+
+// Splits the items into at most `batchesCount` batches of indices, keeping all
+// the items of one user in the same batch and in their original order, so
+// each session is used by one thread only
+static std::vector<std::vector<size_t>> batchIndicesByUser(
+    const std::vector<std::string> &userIDs,
+    size_t batchesCount) {
+  std::unordered_map<std::string, size_t> batchIndexByUser;
+  std::vector<std::vector<size_t>> batches;
+  for (size_t idx = 0; idx < userIDs.size(); idx++) {
+    auto batchIndexIt = batchIndexByUser.find(userIDs[idx]);
+    size_t batchIndex;
+    if (batchIndexIt != batchIndexByUser.end()) {
+      batchIndex = batchIndexIt->second;
+    } else {
+      batchIndex = batchIndexByUser.size() % batchesCount;
+      batchIndexByUser.insert({userIDs[idx], batchIndex});
+    }
+    if (batchIndex == batches.size()) {
+      batches.emplace_back();
+    }
+    batches[batchIndex].push_back(idx);
+  }
+  return batches;
+}
+
+jsi::Value CommCoreModule::encryptForMany(
+    jsi::Runtime &rt,
+    const jsi::Array &userIDs,
+    const jsi::String &content) {
+  std::vector<std::string> userIDsVector;
+  size_t userIDsCount = userIDs.size(rt);
+  userIDsVector.reserve(userIDsCount);
+  for (size_t idx = 0; idx < userIDsCount; idx++) {
+    userIDsVector.push_back(
+        userIDs.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  std::string contentStr = content.utf8(rt);
+
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        std::vector<std::vector<size_t>> batches = batchIndicesByUser(
+            userIDsVector, this->cryptoSessionThreads.size());
+        auto encryptedMessages =
+            std::make_shared<std::vector<crypto::EncryptedData>>(
+                userIDsVector.size());
+        auto errors =
+            std::make_shared<std::vector<std::string>>(batches.size());
+        std::vector<taskType> tasks;
+        for (size_t batchIdx = 0; batchIdx < batches.size(); batchIdx++) {
+          std::vector<size_t> batch = std::move(batches[batchIdx]);
+          tasks.push_back([=]() {
+            std::shared_ptr<crypto::CryptoModule> cryptoModule =
+                std::atomic_load(&this->cryptoModule);
+            if (cryptoModule == nullptr) {
+              (*errors)[batchIdx] = "user has not been initialized";
+              return;
+            }
+            std::vector<std::string> batchUserIDs;
+            batchUserIDs.reserve(batch.size());
+            for (size_t idx : batch) {
+              batchUserIDs.push_back(userIDsVector[idx]);
+            }
+            try {
+              std::vector<crypto::EncryptedData> batchMessages =
+                  cryptoModule->encryptForMany(batchUserIDs, contentStr);
+              for (size_t idx = 0; idx < batch.size(); idx++) {
+                (*encryptedMessages)[batch[idx]] =
+                    std::move(batchMessages[idx]);
+              }
+            } catch (std::runtime_error &e) {
+              (*errors)[batchIdx] = e.what();
+            }
+          });
+        }
+
+        taskType onEncrypted = [=, &innerRt]() {
+          // The advanced sessions are stored before the messages can be sent
+          this->persistCryptoChanges([=, &innerRt](const std::string &error) {
+            for (const std::string &batchError : *errors) {
+              if (batchError.size()) {
+                promise->reject(batchError);
+                return;
+              }
+            }
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Array jsiMessages(innerRt, encryptedMessages->size());
+            for (size_t idx = 0; idx < encryptedMessages->size(); idx++) {
+              const crypto::EncryptedData &encryptedMessage =
+                  (*encryptedMessages)[idx];
+              jsi::Object jsiMessage(innerRt);
+              jsiMessage.setProperty(
+                  innerRt,
+                  "message",
+                  jsi::String::createFromUtf8(
+                      innerRt,
+                      encryptedMessage.message.data(),
+                      encryptedMessage.message.size()));
+              jsiMessage.setProperty(
+                  innerRt,
+                  "messageType",
+                  static_cast<double>(encryptedMessage.messageType));
+              jsiMessages.setValueAtIndex(innerRt, idx, jsiMessage);
+            }
+            promise->resolve(std::move(jsiMessages));
+          });
+        };
+        // The tasks are spread over the session threads from the crypto thread,
+        // where waiting for space in their queues doesn't block JS
+        bool scheduled = this->cryptoThread->tryScheduleTask(
+            [this, tasks = std::move(tasks), onEncrypted]() {
+              this->scheduleCryptoSessionTasks(tasks, onEncrypted);
+            },
+            TaskPriority::INTERACTIVE);
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
+      });
+}
+
+jsi::Value
+CommCoreModule::decryptMany(jsi::Runtime &rt, const jsi::Array &messages) {
+  auto messagesVector =
+      std::make_shared<std::vector<crypto::IncomingEncryptedData>>();
+  std::vector<std::string> userIDs;
+  size_t messagesCount = messages.size(rt);
+  messagesVector->reserve(messagesCount);
+  userIDs.reserve(messagesCount);
+  for (size_t idx = 0; idx < messagesCount; idx++) {
+    jsi::Object message = messages.getValueAtIndex(rt, idx).asObject(rt);
+    std::string userID =
+        message.getProperty(rt, "userID").asString(rt).utf8(rt);
+    std::string encryptedMessage =
+        message.getProperty(rt, "message").asString(rt).utf8(rt);
+    size_t messageType = static_cast<size_t>(
+        message.getProperty(rt, "messageType").asNumber());
+    std::string identityKeys =
+        message.getProperty(rt, "identityKeys").asString(rt).utf8(rt);
+    userIDs.push_back(userID);
+    messagesVector->push_back(crypto::IncomingEncryptedData{
+        userID,
+        {crypto::OlmBuffer(encryptedMessage.begin(), encryptedMessage.end()),
+         messageType},
+        crypto::OlmBuffer(identityKeys.begin(), identityKeys.end())});
+  }
+  std::vector<std::vector<size_t>> batches =
+      batchIndicesByUser(userIDs, this->cryptoSessionThreads.size());
+
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        auto results = std::make_shared<std::vector<crypto::DecryptResult>>(
+            messagesCount);
+        auto errors =
+            std::make_shared<std::vector<std::string>>(batches.size());
+        std::vector<taskType> tasks;
+        for (size_t batchIdx = 0; batchIdx < batches.size(); batchIdx++) {
+          std::vector<size_t> batch = batches[batchIdx];
+          tasks.push_back([=]() {
+            std::shared_ptr<crypto::CryptoModule> cryptoModule =
+                std::atomic_load(&this->cryptoModule);
+            if (cryptoModule == nullptr) {
+              (*errors)[batchIdx] = "user has not been initialized";
+              return;
+            }
+            std::vector<crypto::IncomingEncryptedData> batchMessages;
+            batchMessages.reserve(batch.size());
+            for (size_t idx : batch) {
+              batchMessages.push_back((*messagesVector)[idx]);
+            }
+            std::vector<crypto::DecryptResult> batchResults =
+                cryptoModule->decryptMany(batchMessages);
+            for (size_t idx = 0; idx < batch.size(); idx++) {
+              (*results)[batch[idx]] = std::move(batchResults[idx]);
+            }
+          });
+        }
+
+        taskType onDecrypted = [=, &innerRt]() {
+          this->persistCryptoChanges([=, &innerRt](const std::string &error) {
+            for (const std::string &batchError : *errors) {
+              if (batchError.size()) {
+                promise->reject(batchError);
+                return;
+              }
+            }
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            // Every message gets either the decrypted content or its error
+            jsi::Array jsiResults(innerRt, results->size());
+            for (size_t idx = 0; idx < results->size(); idx++) {
+              const crypto::DecryptResult &result = (*results)[idx];
+              jsi::Object jsiResult(innerRt);
+              if (result.error.size()) {
+                jsiResult.setProperty(
+                    innerRt,
+                    "error",
+                    jsi::String::createFromUtf8(innerRt, result.error));
+              } else {
+                jsiResult.setProperty(
+                    innerRt,
+                    "message",
+                    jsi::String::createFromUtf8(
+                        innerRt, result.decryptedMessage));
+              }
+              jsiResults.setValueAtIndex(innerRt, idx, jsiResult);
+            }
+            promise->resolve(std::move(jsiResults));
+          });
+        };
+        // The tasks are spread over the session threads from the crypto thread,
+        // where waiting for space in their queues doesn't block JS
+        bool scheduled = this->cryptoThread->tryScheduleTask(
+            [this, tasks = std::move(tasks), onDecrypted]() {
+              this->scheduleCryptoSessionTasks(tasks, onDecrypted);
+            },
+            TaskPriority::INTERACTIVE);
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
+void CommCoreModule::scheduleCryptoSessionTasks(
+    std::vector<taskType> tasks,
+    const taskType onDone) {
+  if (tasks.empty()) {
+    onDone();
+    return;
+  }
+  auto remainingTasksCount =
+      std::make_shared<std::atomic<size_t>>(tasks.size());
+  for (taskType &task : tasks) {
+    size_t threadIndex =
+        this->nextCryptoSessionThread++ % this->cryptoSessionThreads.size();
+    this->cryptoSessionThreads[threadIndex]->scheduleTask(
+        [=, task = std::move(task)]() {
+          task();
+          if (--*remainingTasksCount == 0) {
+            onDone();
+          }
+        },
+        TaskPriority::INTERACTIVE);
+  }
+}
+
+void CommCoreModule::scheduleOneTimeKeysReplenishing() {
+  taskType job = [=]() {
+    std::shared_ptr<crypto::CryptoModule> cryptoModule =
+        std::atomic_load(&this->cryptoModule);
+    if (cryptoModule == nullptr) {
+      return;
+    }
+    try {
+      if (!cryptoModule->replenishOneTimeKeys()) {
+        return;
+      }
+    } catch (std::runtime_error &e) {
+      Logger::log("Error generating one-time keys: " + std::string(e.what()));
+      return;
+    }
+    this->persistCryptoChanges([](const std::string &error) {
+      if (error.size()) {
+        Logger::log("Error storing generated one-time keys: " + error);
+      }
+    });
+  };
+  // The pool is refilled once, however many times it was requested before
+  this->cryptoThread->scheduleTask(
+      job, TaskPriority::BACKGROUND, "replenishOneTimeKeys", nullptr);
+}
+
+void CommCoreModule::persistCryptoChanges(
+    std::function<void(const std::string &error)> onPersisted) {
+  std::shared_ptr<crypto::CryptoModule> cryptoModule =
+      std::atomic_load(&this->cryptoModule);
+  if (cryptoModule == nullptr) {
+    this->jsInvoker_->invokeAsync(
+        [=]() { onPersisted("user has not been initialized"); });
+    return;
+  }
+  crypto::Persist dirtyPersist;
+  try {
+    dirtyPersist = cryptoModule->storeDirty();
+  } catch (std::runtime_error &e) {
+    std::string error = e.what();
+    this->jsInvoker_->invokeAsync([=]() { onPersisted(error); });
+    return;
+  }
+  this->databaseThread->scheduleTask([=]() {
+    std::string error;
+    try {
+      DatabaseManager::getQueryExecutor().storeOlmPersistData(dirtyPersist);
+    } catch (std::system_error &e) {
+      error = e.what();
+    }
+    this->jsInvoker_->invokeAsync([=]() { onPersisted(error); });
+  });
+}
+
+// Returns false if the payload isn't an encrypted message, e.g. when it's a
+// message of the socket protocol
+static bool parseIncomingEncryptedMessage(
+    const std::string &payload,
+    crypto::IncomingEncryptedData &encryptedMessage) {
+  folly::dynamic envelope;
+  try {
+    envelope = folly::parseJson(payload);
+  } catch (const folly::json::parse_error &e) {
+    return false;
+  }
+  if (!envelope.isObject()) {
+    return false;
+  }
+  const folly::dynamic *userID = envelope.get_ptr("userID");
+  const folly::dynamic *message = envelope.get_ptr("message");
+  const folly::dynamic *messageType = envelope.get_ptr("messageType");
+  const folly::dynamic *identityKeys = envelope.get_ptr("identityKeys");
+  if (!userID || !userID->isString() || !message || !message->isString() ||
+      !messageType || !messageType->isInt() || !identityKeys ||
+      !identityKeys->isString()) {
+    return false;
+  }
+  const std::string &messageStr = message->getString();
+  const std::string &identityKeysStr = identityKeys->getString();
+  encryptedMessage = crypto::IncomingEncryptedData{
+      userID->getString(),
+      {crypto::OlmBuffer(messageStr.begin(), messageStr.end()),
+       static_cast<size_t>(messageType->getInt())},
+      crypto::OlmBuffer(identityKeysStr.begin(), identityKeysStr.end())};
+  return true;
+}
+
+void CommCoreModule::processIncomingMessages(
+    std::vector<std::string> payloads,
+    std::function<void(ProcessedIncomingMessages)> onProcessed) {
+  auto payloadsPtr =
+      std::make_shared<std::vector<std::string>>(std::move(payloads));
+  // The payloads are parsed on the crypto thread. The gRPC thread calling
+  // this must not block, so if the crypto thread's queue is full the
+  // payloads are left for JS.
+  bool scheduled = this->cryptoThread->tryScheduleTask([=]() {
+    std::shared_ptr<crypto::CryptoModule> cryptoModule =
+        std::atomic_load(&this->cryptoModule);
+    // Indices in `payloadsPtr` of the encrypted messages, in order
+    auto encryptedIndices = std::make_shared<std::vector<size_t>>();
+    auto encryptedMessages =
+        std::make_shared<std::vector<crypto::IncomingEncryptedData>>();
+    std::vector<std::string> userIDs;
+    for (size_t idx = 0; cryptoModule != nullptr && idx < payloadsPtr->size();
+         idx++) {
+      crypto::IncomingEncryptedData encryptedMessage;
+      if (!parseIncomingEncryptedMessage(
+              (*payloadsPtr)[idx], encryptedMessage)) {
+        continue;
+      }
+      userIDs.push_back(encryptedMessage.targetUserId);
+      encryptedIndices->push_back(idx);
+      encryptedMessages->push_back(std::move(encryptedMessage));
+    }
+
+    // Messages which fail to decrypt are left for JS. Olm doesn't advance
+    // the session then, so JS can still retry them.
+    auto decryptedMessages =
+        std::make_shared<std::vector<std::string>>(userIDs.size());
+    auto decrypted = std::make_shared<std::vector<char>>(userIDs.size(), 0);
+    std::vector<taskType> tasks;
+    for (std::vector<size_t> &batch :
+         batchIndicesByUser(userIDs, this->cryptoSessionThreads.size())) {
+      tasks.push_back([=]() {
+        for (size_t idx : batch) {
+          const crypto::IncomingEncryptedData &encryptedMessage =
+              (*encryptedMessages)[idx];
+          try {
+            (*decryptedMessages)[idx] = cryptoModule->decrypt(
+                encryptedMessage.targetUserId,
+                encryptedMessage.encryptedData,
+                encryptedMessage.theirIdentityKey);
+            (*decrypted)[idx] = 1;
+          } catch (std::runtime_error &e) {
+            Logger::log(
+                "Failed to decrypt an incoming message: " +
+                std::string(e.what()));
+          }
+        }
+      });
+    }
+
+    taskType onDecrypted = [=]() {
+      crypto::Persist dirtyPersist;
+      bool cryptoStateChanged = false;
+      bool cryptoStatePickled = true;
+      if (!encryptedIndices->empty()) {
+        try {
+          dirtyPersist = cryptoModule->storeDirty();
+          cryptoStateChanged = true;
+        } catch (std::runtime_error &e) {
+          Logger::log(
+              "Failed to store the crypto state: " + std::string(e.what()));
+          cryptoStatePickled = false;
+        }
+      }
+      this->databaseThread->scheduleTask([=]() {
+        ProcessedIncomingMessages processedMessages;
+        std::vector<ClientDBMessageInfo> clientDBMessageInfos;
+        std::vector<std::string> storedMessages;
+        std::unordered_set<std::string> threadIDs;
+        size_t encryptedIdx = 0;
+        for (size_t idx = 0; idx < payloadsPtr->size(); idx++) {
+          if (encryptedIdx == encryptedIndices->size() ||
+              (*encryptedIndices)[encryptedIdx] != idx) {
+            processedMessages.unprocessedPayloads.push_back(
+                (*payloadsPtr)[idx]);
+            continue;
+          }
+          if (!(*decrypted)[encryptedIdx]) {
+            processedMessages.unprocessedPayloads.push_back(
+                (*payloadsPtr)[idx]);
+            encryptedIdx++;
+            continue;
+          }
+          std::string &decryptedMessage = (*decryptedMessages)[encryptedIdx];
+          encryptedIdx++;
+          // A payload is stored whole or not at all, so JS gets all of its
+          // messages if any of them is invalid
+          std::vector<ClientDBMessageInfo> messageInfos =
+              MessageOperationsUtilities::translateStringToClientDBMessageInfos(
+                  decryptedMessage, false);
+          if (messageInfos.empty()) {
+            processedMessages.decryptedPayloads.push_back(
+                std::move(decryptedMessage));
+            continue;
+          }
+          for (ClientDBMessageInfo &messageInfo : messageInfos) {
+            processedMessages.messageIDs.push_back(messageInfo.first.id);
+            if (threadIDs.insert(messageInfo.first.thread).second) {
+              processedMessages.threadIDs.push_back(messageInfo.first.thread);
+            }
+            clientDBMessageInfos.push_back(std::move(messageInfo));
+          }
+          storedMessages.push_back(std::move(decryptedMessage));
+        }
+
+        // The advanced sessions are stored together with the messages, so
+        // after a restart the messages are neither decrypted again nor lost.
+        // If that fails, the decrypted messages are handed to JS instead.
+        bool stored = false;
+        if (cryptoStatePickled) {
+          bool transactionStarted = false;
+          try {
+            DatabaseManager::getQueryExecutor().beginTransaction();
+            transactionStarted = true;
+            if (cryptoStateChanged) {
+              DatabaseManager::getQueryExecutor().storeOlmPersistData(
+                  dirtyPersist);
+            }
+            MessageOperationsUtilities::replaceClientDBMessageInfos(
+                clientDBMessageInfos);
+            DatabaseManager::getQueryExecutor().commitTransaction();
+            stored = true;
+          } catch (std::system_error &e) {
+            if (transactionStarted) {
+              DatabaseManager::getQueryExecutor().rollbackTransaction();
+            }
+            Logger::log(
+                "Failed to store incoming messages: " + std::string(e.what()));
+            if (cryptoStateChanged) {
+              cryptoModule->markDirty(dirtyPersist);
+            }
+          }
+        }
+        if (!stored) {
+          processedMessages.messageIDs.clear();
+          processedMessages.threadIDs.clear();
+          std::move(
+              storedMessages.begin(),
+              storedMessages.end(),
+              std::back_inserter(processedMessages.decryptedPayloads));
+        }
+        onProcessed(std::move(processedMessages));
+      });
+    };
+    this->scheduleCryptoSessionTasks(std::move(tasks), onDecrypted);
+  });
+  if (!scheduled) {
+    ProcessedIncomingMessages processedMessages;
+    processedMessages.unprocessedPayloads = std::move(*payloadsPtr);
+    onProcessed(std::move(processedMessages));
+  }
+}
+
 jsi::Object
 CommCoreModule::openSocket(jsi::Runtime &rt, const jsi::String &endpoint) {
-  auto hostObject =
-      std::make_shared<GRPCStreamHostObject>(rt, this->jsInvoker_);
+  auto hostObject = GRPCStreamHostObject::create(
+      rt,
+      this->jsInvoker_,
+      [this](
+          std::vector<std::string> payloads,
+          std::function<void(ProcessedIncomingMessages)> onProcessed) {
+        this->processIncomingMessages(
+            std::move(payloads), std::move(onProcessed));
+      });
   return jsi::Object::createFromHostObject(rt, hostObject);
 }
 
+bool CommCoreModule::scheduleDatabaseReadTask(
+    const taskType task,
+    const TaskPriority priority) {
+  size_t threadIndex =
+      this->nextDatabaseReadThread++ % this->databaseReadThreads.size();
+  // The read sees the results of the writes scheduled before it, the same as
+  // if it was executed on the database thread: an interactive read doesn't
+  // wait for the background writes, which would be executed after it. The
+  // writes scheduled later don't delay it.
+  std::vector<uint64_t> writesMark =
+      this->databaseThread->markScheduledTasks(priority);
+  return this->databaseReadThreads[threadIndex]->tryScheduleTask(
+      [this, task, writesMark]() {
+        this->databaseThread->waitForTasks(writesMark);
+        task();
+      },
+      priority);
+}
+
 CommCoreModule::CommCoreModule(
     std::shared_ptr<facebook::react::CallInvoker> jsInvoker)
     : facebook::react::CommCoreModuleSchemaCxxSpecJSI(jsInvoker),
       databaseThread(std::make_unique<WorkerThread>("database")),
       cryptoThread(std::make_unique<WorkerThread>("crypto")) {
+  for (size_t i = 0; i < this->databaseReadThreadsCount; i++) {
+    auto readThread = std::make_unique<WorkerThread>(
+        "database-read-" + std::to_string(i));
+    readThread->scheduleTask([]() { DatabaseManager::registerReaderThread(); });
+    this->databaseReadThreads.push_back(std::move(readThread));
+  }
+  size_t cryptoSessionThreadsCount = std::min(
+      std::max(std::thread::hardware_concurrency(), 1u),
+      this->maxCryptoSessionThreadsCount);
+  for (size_t i = 0; i < cryptoSessionThreadsCount; i++) {
+    this->cryptoSessionThreads.push_back(std::make_unique<WorkerThread>(
+        "crypto-session-" + std::to_string(i)));
+  }
+  // Expensive migrations are applied in parts, whenever the database thread
+  // has nothing else to do
+  this->databaseThread->setIdleTask([]() {
+    try {
+      return DatabaseManager::getQueryExecutor().runIncrementalMigrationStep();
+    } catch (const std::system_error &e) {
+      Logger::log(
+          "Error applying incremental migrations: " + std::string(e.what()));
+      return false;
+    }
+  });
   GlobalNetworkSingleton::instance.enableMultithreading();
 }
 
@@ -915,43 +1615,51 @@ CommCoreModule::setNotifyToken(jsi::Runtime &rt, const jsi::String &token) {
       rt,
       [this,
        notifyToken](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        this->databaseThread->scheduleTask([this, notifyToken, promise]() {
-          std::string error;
-          try {
-            DatabaseManager::getQueryExecutor().setNotifyToken(notifyToken);
-          } catch (std::system_error &e) {
-            error = e.what();
-          }
+        bool scheduled = this->databaseThread->tryScheduleTask(
+            [this, notifyToken, promise]() {
+              std::string error;
+              try {
+                DatabaseManager::getQueryExecutor().setNotifyToken(notifyToken);
+              } catch (std::system_error &e) {
+                error = e.what();
+              }
 
-          this->jsInvoker_->invokeAsync([error, promise]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(jsi::Value::undefined());
-            }
-          });
-        });
+              this->jsInvoker_->invokeAsync([error, promise]() {
+                if (error.size()) {
+                  promise->reject(error);
+                } else {
+                  promise->resolve(jsi::Value::undefined());
+                }
+              });
+            });
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 }
 
 jsi::Value CommCoreModule::clearNotifyToken(jsi::Runtime &rt) {
   return createPromiseAsJSIValue(
       rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        this->databaseThread->scheduleTask([this, promise]() {
-          std::string error;
-          try {
-            DatabaseManager::getQueryExecutor().clearNotifyToken();
-          } catch (std::system_error &e) {
-            error = e.what();
-          }
-          this->jsInvoker_->invokeAsync([error, promise]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(jsi::Value::undefined());
-            }
-          });
-        });
+        bool scheduled = this->databaseThread->tryScheduleTask(
+            [this, promise]() {
+              std::string error;
+              try {
+                DatabaseManager::getQueryExecutor().clearNotifyToken();
+              } catch (std::system_error &e) {
+                error = e.what();
+              }
+              this->jsInvoker_->invokeAsync([error, promise]() {
+                if (error.size()) {
+                  promise->reject(error);
+                } else {
+                  promise->resolve(jsi::Value::undefined());
+                }
+              });
+            });
+        if (!scheduled) {
+          promise->reject(queueFullError);
+        }
       });
 };
 
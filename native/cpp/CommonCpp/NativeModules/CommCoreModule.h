@@ -1,12 +1,19 @@
 #pragma once
 
 #include "../CryptoTools/CryptoModule.h"
+#include "../DatabaseManagers/entities/Media.h"
+#include "../DatabaseManagers/entities/Message.h"
 #include "../Tools/CommSecureStore.h"
 #include "../Tools/WorkerThread.h"
 #include "../_generated/NativeModules.h"
 #include "../grpc/Client.h"
+#include "../grpc/GRPCStreamHostObject.h"
 #include <jsi/jsi.h>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <vector>
 
 namespace comm {
 
@@ -15,15 +22,65 @@ namespace jsi = facebook::jsi;
 class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
   const int codeVersion{142};
 
+  const size_t databaseReadThreadsCount{2};
+
+  // Execute the read-only queries, each on its own connection, so they don't
+  // wait behind the writes scheduled after them. Declared before the
+  // database thread, which hands reads over to them, so they outlive it.
+  std::vector<std::unique_ptr<WorkerThread>> databaseReadThreads;
+  std::atomic<size_t> nextDatabaseReadThread{0};
+  // Executes all the writes (and the reads which are part of them)
   std::unique_ptr<WorkerThread> databaseThread;
+  const unsigned maxCryptoSessionThreadsCount{4};
+
+  // Executes the operations on the crypto account
   std::unique_ptr<WorkerThread> cryptoThread;
+  // Execute the operations on the sessions with different users in parallel,
+  // one thread per core
+  std::vector<std::unique_ptr<WorkerThread>> cryptoSessionThreads;
+  std::atomic<size_t> nextCryptoSessionThread{0};
 
   CommSecureStore secureStore;
   const std::string secureStoreAccountDataKey = "cryptoAccountDataKey";
-  std::unique_ptr<crypto::CryptoModule> cryptoModule;
+  // Replaced with std::atomic_store and read with std::atomic_load, as it's
+  // used from several threads
+  std::shared_ptr<crypto::CryptoModule> cryptoModule;
 
   std::unique_ptr<network::Client> networkClient;
 
+  // Schedules the task on a database read thread, where it waits for the
+  // writes it depends on. Never blocks, returns false if the read thread's
+  // queue is full
+  bool scheduleDatabaseReadTask(
+      const taskType task,
+      const TaskPriority priority = TaskPriority::BACKGROUND);
+  // Runs the query on a database read thread and resolves the returned promise
+  // with the messages converted to JS objects.
+  jsi::Value getMessagesAsync(
+      jsi::Runtime &rt,
+      std::function<std::vector<std::pair<Message, std::vector<Media>>>()>
+          query,
+      const TaskPriority priority = TaskPriority::BACKGROUND);
+  // Runs the tasks on the crypto session threads and calls `onDone` on the
+  // thread finishing last. Called on the crypto thread
+  void scheduleCryptoSessionTasks(
+      std::vector<taskType> tasks,
+      const taskType onDone);
+  // Refills the crypto module's pool of one-time keys on the crypto thread, at
+  // background priority
+  void scheduleOneTimeKeysReplenishing();
+  // Called on the crypto thread after the crypto module changed. Stores the
+  // changed state on the database thread, then calls `onPersisted` on the JS
+  // thread with the error, if any.
+  void persistCryptoChanges(
+      std::function<void(const std::string &error)> onPersisted);
+  // Native stage of the socket's incoming messages pipeline. Decrypts the
+  // messages on the crypto session threads, then stores the advanced sessions
+  // and the messages on the database thread, where `onProcessed` is called.
+  void processIncomingMessages(
+      std::vector<std::string> payloads,
+      std::function<void(ProcessedIncomingMessages)> onProcessed);
+
   jsi::Value getDraft(jsi::Runtime &rt, const jsi::String &key) override;
   jsi::Value updateDraft(jsi::Runtime &rt, const jsi::Object &draft) override;
   jsi::Value moveDraft(
@@ -34,6 +91,18 @@ class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
   jsi::Value removeAllDrafts(jsi::Runtime &rt) override;
   jsi::Value getAllMessages(jsi::Runtime &rt) override;
   jsi::Array getAllMessagesSync(jsi::Runtime &rt) override;
+  jsi::Value getMessagesForThread(
+      jsi::Runtime &rt,
+      const jsi::String &threadID,
+      const jsi::String &beforeTime,
+      double limit) override;
+  jsi::Value
+  getLatestMessagesPerThread(jsi::Runtime &rt, double limit) override;
+  jsi::Value searchMessages(
+      jsi::Runtime &rt,
+      const jsi::String &query,
+      const std::optional<jsi::String> &threadID,
+      double limit) override;
   jsi::Value processMessageStoreOperations(
       jsi::Runtime &rt,
       const jsi::Array &operations) override;
@@ -42,6 +111,8 @@ class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
       const jsi::Array &operations) override;
   jsi::Value getAllThreads(jsi::Runtime &rt) override;
   jsi::Array getAllThreadsSync(jsi::Runtime &rt) override;
+  jsi::Value
+  getThreadsOfMember(jsi::Runtime &rt, const jsi::String &userID) override;
   jsi::Value processThreadStoreOperations(
       jsi::Runtime &rt,
       const jsi::Array &operations) override;
@@ -52,6 +123,12 @@ class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
   initializeCryptoAccount(jsi::Runtime &rt, const jsi::String &userId) override;
   jsi::Value getUserPublicKey(jsi::Runtime &rt) override;
   jsi::Value getUserOneTimeKeys(jsi::Runtime &rt) override;
+  jsi::Value encryptForMany(
+      jsi::Runtime &rt,
+      const jsi::Array &userIDs,
+      const jsi::String &content) override;
+  jsi::Value
+  decryptMany(jsi::Runtime &rt, const jsi::Array &messages) override;
   jsi::Object
   openSocket(jsi::Runtime &rt, const jsi::String &endpoint) override;
   double getCodeVersion(jsi::Runtime &rt) override;
@@ -3,25 +3,38 @@
 namespace comm {
 GlobalNetworkSingleton GlobalNetworkSingleton::instance;
 
-NetworkModule &GlobalNetworkSingleton::networkModule() {
-  static thread_local NetworkModule module;
-  return module;
-}
-
 void GlobalNetworkSingleton::scheduleOrRun(
     std::function<void(NetworkModule &)> &&task) {
   if (this->thread != nullptr) {
-    this->thread->scheduleTask(
-        [=, task = std::move(task)]() { task(this->networkModule()); });
+    this->thread->scheduleTask([=, task = std::move(task)]() {
+      std::lock_guard<std::mutex> lock(this->networkModuleMutex);
+      task(this->networkModule);
+    });
   } else {
-    task(this->networkModule());
+    std::lock_guard<std::mutex> lock(this->networkModuleMutex);
+    task(this->networkModule);
+  }
+}
+
+bool GlobalNetworkSingleton::tryScheduleOrRun(
+    std::function<void(NetworkModule &)> &&task,
+    const TaskPriority priority) {
+  if (this->thread != nullptr) {
+    return this->thread->tryScheduleTask(
+        [=, task = std::move(task)]() {
+          std::lock_guard<std::mutex> lock(this->networkModuleMutex);
+          task(this->networkModule);
+        },
+        priority);
   }
+  std::lock_guard<std::mutex> lock(this->networkModuleMutex);
+  task(this->networkModule);
+  return true;
 }
 
 void GlobalNetworkSingleton::enableMultithreading() {
   if (this->thread == nullptr) {
     this->thread = std::make_unique<WorkerThread>("network");
-    this->networkModule().close();
   }
 }
 } // namespace comm
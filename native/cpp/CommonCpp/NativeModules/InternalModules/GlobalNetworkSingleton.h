@@ -4,15 +4,24 @@
 #include "NetworkModule.h"
 #include <functional>
 #include <memory>
+#include <mutex>
 
 namespace comm {
 class GlobalNetworkSingleton {
   std::unique_ptr<WorkerThread> thread;
-  static NetworkModule &networkModule();
+  // The same module is used before and after enabling multithreading, tasks
+  // run before that are serialized with this mutex
+  std::mutex networkModuleMutex;
+  NetworkModule networkModule;
 
 public:
   static GlobalNetworkSingleton instance;
   void scheduleOrRun(std::function<void(NetworkModule &)> &&task);
+  // Never waits for space in the network thread's queue, so it's safe to
+  // call from the JS thread. Returns false if the task was dropped
+  bool tryScheduleOrRun(
+      std::function<void(NetworkModule &)> &&task,
+      const TaskPriority priority = TaskPriority::BACKGROUND);
   void enableMultithreading();
 };
 } // namespace comm
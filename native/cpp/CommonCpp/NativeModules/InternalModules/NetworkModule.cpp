@@ -1,4 +1,5 @@
 #include "NetworkModule.h"
+#include "../../grpc/ChannelManager.h"
 #include "Logger.h"
 
 namespace comm {
@@ -15,11 +16,18 @@ void NetworkModule::initializeNetworkModule(
       (host.substr(0, 5) == "https")
       ? grpc::SslCredentials(grpc::SslCredentialsOptions())
       : grpc::InsecureChannelCredentials();
+  // The channel to the host is shared and outlives the client, so this
+  // doesn't reconnect. Reinitializing is a sign the app needs the connection
+  // now though, so pending reconnection attempts are made right away.
+  network::ChannelManager::getInstance().resetConnectionBackoff();
   this->networkClient.reset(
       new network::Client(host, "50051", credentials, userId, deviceToken));
 }
 
 void NetworkModule::sendPong() {
+  if (!this->networkClient) {
+    return;
+  }
   this->networkClient->sendPong();
 }
 
@@ -34,26 +42,37 @@ void NetworkModule::close() {
   this->networkClient.reset();
 }
 
-grpc::Status NetworkModule::send(
+void NetworkModule::send(
     std::string sessionID,
     std::string toDeviceID,
     std::string payload,
-    std::vector<std::string> blobHashes) {
+    std::vector<std::string> blobHashes,
+    std::function<void(grpc::Status)> onDone,
+    const bool ordered) {
 
   if (!this->networkClient) {
-    return grpc::Status::CANCELLED;
+    onDone(grpc::Status::CANCELLED);
+    return;
   }
-  return this->networkClient->send(sessionID, toDeviceID, payload, blobHashes);
+  this->networkClient->send(
+      sessionID, toDeviceID, payload, blobHashes, std::move(onDone), ordered);
 }
 
 void NetworkModule::setOnReadDoneCallback(
-    std::function<void(std::string)> callback) {
+    std::function<void(std::vector<std::string>)> callback) {
   if (!this->networkClient) {
     return;
   }
   this->networkClient->setOnReadDoneCallback(callback);
 }
 
+std::function<void()> NetworkModule::getConfirmMessagesDeliveredCallback() {
+  if (!this->networkClient) {
+    return []() {};
+  }
+  return this->networkClient->getConfirmMessagesDeliveredCallback();
+}
+
 void NetworkModule::setOnOpenCallback(std::function<void()> callback) {
   if (!this->networkClient) {
     return;
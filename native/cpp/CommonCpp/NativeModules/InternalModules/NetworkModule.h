@@ -15,15 +15,21 @@ public:
       const std::string &deviceToken,
       const std::string &hostname = "");
   void sendPong();
-  grpc::Status send(
+  void send(
       std::string sessionID,
       std::string toDeviceID,
       std::string payload,
-      std::vector<std::string> blobHashes);
+      std::vector<std::string> blobHashes,
+      std::function<void(grpc::Status)> onDone,
+      const bool ordered = true);
   void close();
   void get(std::string sessionID);
   void closeGetStream();
-  void setOnReadDoneCallback(std::function<void(std::string)> callback);
+  void setOnReadDoneCallback(
+      std::function<void(std::vector<std::string>)> callback);
+  // The callback confirms the batch to the stream opened last, from any
+  // thread. It does nothing once the stream is gone.
+  std::function<void()> getConfirmMessagesDeliveredCallback();
   void setOnOpenCallback(std::function<void()> callback);
   void setOnCloseCallback(std::function<void()> callback);
   void assignSetReadyStateCallback(std::function<void(SocketStatus)> callback);
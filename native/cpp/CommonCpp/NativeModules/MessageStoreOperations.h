@@ -3,12 +3,137 @@
 #include "../DatabaseManagers/entities/Media.h"
 #include "../DatabaseManagers/entities/Message.h"
 #include "DatabaseManager.h"
+#include <iterator>
+#include <map>
+#include <memory>
+#include <unordered_set>
 #include <vector>
 
 namespace comm {
+
+// Collapses a batch of message store operations before touching the
+// database. Work made moot by a later operation in the same batch (e.g. a
+// message replaced several times, or replaced and then removed) is dropped,
+// and the remaining rows are written with multi-row statements. Rekeys depend
+// on the rows already stored, so each of them ends a step of the plan.
+class MessageStoreOperationsPlanner {
+  struct Step {
+    bool removeAll = false;
+    std::unordered_set<std::string> removedMessageIDs;
+    std::unordered_set<std::string> removedThreadIDs;
+    std::map<std::string, std::pair<Message, std::vector<Media>>>
+        replacedMessages;
+    std::unique_ptr<std::pair<std::string, std::string>> rekey;
+  };
+
+  std::vector<Step> steps;
+
+  static void executeStep(Step &step) {
+    const auto &queryExecutor = DatabaseManager::getQueryExecutor();
+    if (step.removeAll) {
+      queryExecutor.removeAllMessages();
+      queryExecutor.removeAllMedia();
+    }
+    if (!step.removedMessageIDs.empty()) {
+      std::vector<std::string> ids(
+          step.removedMessageIDs.begin(), step.removedMessageIDs.end());
+      queryExecutor.removeMessages(ids);
+      queryExecutor.removeMediaForMessages(ids);
+    }
+    if (!step.removedThreadIDs.empty()) {
+      std::vector<std::string> threadIDs(
+          step.removedThreadIDs.begin(), step.removedThreadIDs.end());
+      queryExecutor.removeMessagesForThreads(threadIDs);
+      queryExecutor.removeMediaForThreads(threadIDs);
+    }
+    if (!step.replacedMessages.empty()) {
+      std::vector<std::string> ids;
+      std::vector<Message> messages;
+      std::vector<Media> mediaItems;
+      ids.reserve(step.replacedMessages.size());
+      messages.reserve(step.replacedMessages.size());
+      for (auto &[id, messageWithMedia] : step.replacedMessages) {
+        ids.push_back(id);
+        messages.push_back(std::move(messageWithMedia.first));
+        std::move(
+            messageWithMedia.second.begin(),
+            messageWithMedia.second.end(),
+            std::back_inserter(mediaItems));
+      }
+      queryExecutor.removeMediaForMessages(ids);
+      queryExecutor.replaceMessages(messages);
+      queryExecutor.replaceMediaItems(mediaItems);
+    }
+    if (step.rekey) {
+      queryExecutor.rekeyMessage(step.rekey->first, step.rekey->second);
+      queryExecutor.rekeyMediaContainers(
+          step.rekey->first, step.rekey->second);
+    }
+  }
+
+public:
+  MessageStoreOperationsPlanner() {
+    this->steps.emplace_back();
+  }
+
+  void removeAll() {
+    Step &step = this->steps.back();
+    step.removeAll = true;
+    step.removedMessageIDs.clear();
+    step.removedThreadIDs.clear();
+    step.replacedMessages.clear();
+  }
+
+  void removeMessages(const std::vector<std::string> &ids) {
+    Step &step = this->steps.back();
+    for (const auto &id : ids) {
+      step.replacedMessages.erase(id);
+      step.removedMessageIDs.insert(id);
+    }
+  }
+
+  void removeMessagesForThreads(const std::vector<std::string> &threadIDs) {
+    Step &step = this->steps.back();
+    std::unordered_set<std::string> threadIDsSet(
+        threadIDs.begin(), threadIDs.end());
+    step.removedThreadIDs.insert(threadIDs.begin(), threadIDs.end());
+    for (auto it = step.replacedMessages.begin();
+         it != step.replacedMessages.end();) {
+      if (!threadIDsSet.count(it->second.first.thread)) {
+        it++;
+        continue;
+      }
+      // The stored row may still belong to a different thread
+      step.removedMessageIDs.insert(it->first);
+      it = step.replacedMessages.erase(it);
+    }
+  }
+
+  void replaceMessage(Message &&message, std::vector<Media> &&media) {
+    std::string id = message.id;
+    this->steps.back().replacedMessages[id] =
+        std::make_pair(std::move(message), std::move(media));
+  }
+
+  void rekeyMessage(const std::string &from, const std::string &to) {
+    this->steps.back().rekey =
+        std::make_unique<std::pair<std::string, std::string>>(from, to);
+    this->steps.emplace_back();
+  }
+
+  // Has to be called inside of a transaction
+  void execute() {
+    for (auto &step : this->steps) {
+      executeStep(step);
+    }
+    this->steps.clear();
+    this->steps.emplace_back();
+  }
+};
+
 class MessageStoreOperationBase {
 public:
-  virtual void execute() = 0;
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) = 0;
   virtual ~MessageStoreOperationBase(){};
 };
 
@@ -23,10 +148,8 @@ public:
     }
   }
 
-  virtual void execute() override {
-    DatabaseManager::getQueryExecutor().removeMessages(this->msg_ids_to_remove);
-    DatabaseManager::getQueryExecutor().removeMediaForMessages(
-        this->msg_ids_to_remove);
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) override {
+    planner.removeMessages(this->msg_ids_to_remove);
   }
 
 private:
@@ -47,10 +170,8 @@ public:
     }
   }
 
-  virtual void execute() override {
-    DatabaseManager::getQueryExecutor().removeMessagesForThreads(
-        this->thread_ids);
-    DatabaseManager::getQueryExecutor().removeMediaForThreads(this->thread_ids);
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) override {
+    planner.removeMessagesForThreads(this->thread_ids);
   }
 
 private:
@@ -120,12 +241,13 @@ public:
     }
   }
 
-  virtual void execute() override {
-    DatabaseManager::getQueryExecutor().removeMediaForMessage(msg->id);
-    for (auto &&media : this->media_vector) {
-      DatabaseManager::getQueryExecutor().replaceMedia(std::move(*media));
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) override {
+    std::vector<Media> media;
+    media.reserve(this->media_vector.size());
+    for (auto &&media_info : this->media_vector) {
+      media.push_back(std::move(*media_info));
     }
-    DatabaseManager::getQueryExecutor().replaceMessage(std::move(*this->msg));
+    planner.replaceMessage(std::move(*this->msg), std::move(media));
   }
 
 private:
@@ -140,10 +262,8 @@ public:
     this->to = payload.getProperty(rt, "to").asString(rt).utf8(rt);
   }
 
-  virtual void execute() override {
-    DatabaseManager::getQueryExecutor().rekeyMessage(this->from, this->to);
-    DatabaseManager::getQueryExecutor().rekeyMediaContainers(
-        this->from, this->to);
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) override {
+    planner.rekeyMessage(this->from, this->to);
   }
 
 private:
@@ -153,9 +273,8 @@ private:
 
 class RemoveAllMessagesOperation : public MessageStoreOperationBase {
 public:
-  virtual void execute() override {
-    DatabaseManager::getQueryExecutor().removeAllMessages();
-    DatabaseManager::getQueryExecutor().removeAllMedia();
+  virtual void addToPlan(MessageStoreOperationsPlanner &planner) override {
+    planner.removeAll();
   }
 };
 
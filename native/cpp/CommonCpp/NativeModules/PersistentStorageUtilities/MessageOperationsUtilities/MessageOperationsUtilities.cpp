@@ -4,7 +4,9 @@
 
 #include <folly/String.h>
 #include <folly/json.h>
+#include <iterator>
 #include <stdexcept>
+#include <system_error>
 
 namespace comm {
 ClientDBMessageInfo
@@ -77,7 +79,8 @@ Media MessageOperationsUtilities::translateMediaToClientDBMediaInfo(
 
 std::vector<ClientDBMessageInfo>
 MessageOperationsUtilities::translateStringToClientDBMessageInfos(
-    std::string &rawMessageInfosString) {
+    std::string &rawMessageInfosString,
+    const bool skipInvalidMessages) {
   std::vector<ClientDBMessageInfo> clientDBMessageInfos;
   folly::dynamic rawMessageInfos;
   try {
@@ -89,6 +92,13 @@ MessageOperationsUtilities::translateStringToClientDBMessageInfos(
         std::string(e.what()));
     return clientDBMessageInfos;
   }
+  // Iterating over an object or a scalar would throw
+  if (!rawMessageInfos.isArray()) {
+    Logger::log(
+        "Expected an array of messages, got a JSON " +
+        std::string(rawMessageInfos.typeName()));
+    return clientDBMessageInfos;
+  }
   for (const auto &messageInfo : rawMessageInfos) {
     try {
       clientDBMessageInfos.push_back(
@@ -97,10 +107,16 @@ MessageOperationsUtilities::translateStringToClientDBMessageInfos(
       Logger::log(
           "Invalid type conversion when parsing message. Details: " +
           std::string(e.what()));
+      if (!skipInvalidMessages) {
+        return {};
+      }
     } catch (const std::out_of_range &e) {
       Logger::log(
           "Non-existing key accessed when parsing message. Details: " +
           std::string(e.what()));
+      if (!skipInvalidMessages) {
+        return {};
+      }
     }
   }
 
@@ -111,13 +127,41 @@ void MessageOperationsUtilities::storeMessageInfos(
     std::string &rawMessageInfosString) {
   std::vector<ClientDBMessageInfo> clientDBMessageInfos =
       translateStringToClientDBMessageInfos(rawMessageInfosString);
-  for (const auto &clientDBMessageInfo : clientDBMessageInfos) {
-    DatabaseManager::getQueryExecutor().replaceMessage(
-        clientDBMessageInfo.first);
-    for (const auto &mediaInfo : clientDBMessageInfo.second) {
-      DatabaseManager::getQueryExecutor().replaceMedia(mediaInfo);
-    }
+  storeClientDBMessageInfos(clientDBMessageInfos);
+}
+
+void MessageOperationsUtilities::storeClientDBMessageInfos(
+    std::vector<ClientDBMessageInfo> &clientDBMessageInfos) {
+  if (clientDBMessageInfos.empty()) {
+    return;
+  }
+  DatabaseManager::getQueryExecutor().beginTransaction();
+  try {
+    replaceClientDBMessageInfos(clientDBMessageInfos);
+    DatabaseManager::getQueryExecutor().commitTransaction();
+  } catch (const std::system_error &e) {
+    DatabaseManager::getQueryExecutor().rollbackTransaction();
+    throw;
+  }
+}
+
+void MessageOperationsUtilities::replaceClientDBMessageInfos(
+    std::vector<ClientDBMessageInfo> &clientDBMessageInfos) {
+  if (clientDBMessageInfos.empty()) {
+    return;
+  }
+  std::vector<Message> messages;
+  std::vector<Media> mediaItems;
+  messages.reserve(clientDBMessageInfos.size());
+  for (auto &clientDBMessageInfo : clientDBMessageInfos) {
+    messages.push_back(std::move(clientDBMessageInfo.first));
+    std::move(
+        clientDBMessageInfo.second.begin(),
+        clientDBMessageInfo.second.end(),
+        std::back_inserter(mediaItems));
   }
+  DatabaseManager::getQueryExecutor().replaceMessages(messages);
+  DatabaseManager::getQueryExecutor().replaceMediaItems(mediaItems);
 }
 
 } // namespace comm
@@ -19,8 +19,18 @@ class MessageOperationsUtilities {
       const std::string &thread);
 
 public:
-  static std::vector<ClientDBMessageInfo>
-  translateStringToClientDBMessageInfos(std::string &rawMessageInfosString);
+  // Invalid messages are skipped, or make the whole result empty if
+  // skipInvalidMessages is false
+  static std::vector<ClientDBMessageInfo> translateStringToClientDBMessageInfos(
+      std::string &rawMessageInfosString,
+      const bool skipInvalidMessages = true);
   static void storeMessageInfos(std::string &rawMessageInfosString);
+  // Stores the messages and their media in a single transaction. The infos
+  // are moved from.
+  static void storeClientDBMessageInfos(
+      std::vector<ClientDBMessageInfo> &clientDBMessageInfos);
+  // Same as above, but as a part of the transaction of the caller
+  static void replaceClientDBMessageInfos(
+      std::vector<ClientDBMessageInfo> &clientDBMessageInfos);
 };
 } // namespace comm
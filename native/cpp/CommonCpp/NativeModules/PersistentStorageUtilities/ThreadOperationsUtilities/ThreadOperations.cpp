@@ -1,39 +1,26 @@
 #include "ThreadOperations.h"
 #include "../../../DatabaseManagers/DatabaseManager.h"
 #include "Logger.h"
-#include <folly/String.h>
-#include <folly/json.h>
 #include <stdexcept>
+#include <system_error>
 
 namespace comm {
 void ThreadOperations::updateSQLiteUnreadStatus(
     std::string &threadID,
     bool unread) {
-  std::unique_ptr<Thread> thread =
-      DatabaseManager::getQueryExecutor().getThread(threadID);
-  if (thread == nullptr) {
-    throw std::runtime_error(
-        "Attempted to update non-existing thread with ID:  " + threadID);
-  }
-  folly::dynamic updatedCurrentUser;
+  bool updated;
   try {
-    updatedCurrentUser = folly::parseJson(thread->current_user);
-  } catch (const folly::json::parse_error &e) {
+    updated = DatabaseManager::getQueryExecutor().updateThreadUnreadStatus(
+        threadID, unread);
+  } catch (const std::system_error &e) {
     Logger::log(
-        "Invalid json structure of current_user field of thread of id: " +
-        threadID + ". Details: " + std::string(e.what()));
+        "Failed to update unread status of thread of id: " + threadID +
+        ". Details: " + std::string(e.what()));
     return;
   }
-  updatedCurrentUser["unread"] = unread;
-  try {
-    thread->current_user = folly::toJson(updatedCurrentUser);
-  } catch (const folly::json::parse_error &e) {
-    Logger::log(
-        "Failed to serialize updated current_user JSON object. Details: " +
-        std::string(e.what()));
-    return;
+  if (!updated) {
+    throw std::runtime_error(
+        "Attempted to update non-existing thread with ID:  " + threadID);
   }
-
-  DatabaseManager::getQueryExecutor().replaceThread(*thread);
 }
 } // namespace comm
@@ -1,33 +1,246 @@
 #include "WorkerThread.h"
 #include "Logger.h"
+#include <algorithm>
 #include <sstream>
 
 namespace comm {
 
-WorkerThread::WorkerThread(const std::string name)
-    : tasks(folly::MPMCQueue<std::unique_ptr<taskType>>(100)), name(name) {
-  auto job = [this]() {
-    while (true) {
-      std::unique_ptr<taskType> lastTask;
-      this->tasks.blockingRead(lastTask);
-      if (lastTask == nullptr) {
-        break;
+WorkerThread::WorkerThread(const std::string name) : name(name) {
+  this->thread = std::make_unique<std::thread>([this]() { this->run(); });
+}
+
+void WorkerThread::run() {
+  while (true) {
+    std::shared_ptr<ScheduledTask> scheduledTask;
+    std::function<bool()> idleTask;
+    uint64_t queueLatency;
+    size_t laneIndex = 0;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->tasksAvailable.wait(lock, [this]() {
+        return this->stopped || this->idleTaskPending ||
+            std::any_of(
+                   std::begin(this->lanes),
+                   std::end(this->lanes),
+                   [](const auto &lane) { return !lane.empty(); });
+      });
+      // Lanes are ordered by priority, the interactive one goes first
+      while (laneIndex < lanesCount && this->lanes[laneIndex].empty()) {
+        laneIndex++;
       }
-      (*lastTask)();
+      if (laneIndex == lanesCount) {
+        // Tasks scheduled before stopping are still executed
+        if (this->stopped) {
+          return;
+        }
+        this->idleTaskPending = false;
+        idleTask = this->idleTask;
+      } else {
+        scheduledTask = std::move(this->lanes[laneIndex].front());
+        this->lanes[laneIndex].pop_front();
+        auto &coalescableTasks = this->coalescableTasks[laneIndex];
+        auto coalescableTaskIt =
+            coalescableTasks.find(scheduledTask->coalescingKey);
+        if (coalescableTaskIt != coalescableTasks.end() &&
+            coalescableTaskIt->second == scheduledTask) {
+          coalescableTasks.erase(coalescableTaskIt);
+        }
+
+        queueLatency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() -
+                           scheduledTask->scheduledAt)
+                           .count();
+        WorkerThreadLaneStats &laneStats = this->lanesStats[laneIndex];
+        laneStats.executedTasksCount++;
+        laneStats.totalQueueLatency += queueLatency;
+        laneStats.maxQueueLatency =
+            std::max(laneStats.maxQueueLatency, queueLatency);
+        this->idleTaskPending = static_cast<bool>(this->idleTask);
+      }
+    }
+
+    if (idleTask) {
+      bool hasMoreWork = idleTask();
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->idleTaskPending = hasMoreWork;
+      continue;
+    }
+    this->spaceAvailable.notify_all();
+
+    if (queueLatency > slowQueueLatencyThreshold) {
+      std::ostringstream stringStream;
+      stringStream << "Task waited " << queueLatency << "ms in the "
+                   << this->name << " worker thread queue";
+      Logger::log(stringStream.str());
     }
-  };
-  this->thread = std::make_unique<std::thread>(job);
+    scheduledTask->task();
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->finishedTasksCounts[laneIndex]++;
+    }
+    this->tasksFinished.notify_all();
+  }
 }
 
-void WorkerThread::scheduleTask(const taskType task) {
-  if (!this->tasks.write(std::make_unique<taskType>(std::move(task)))) {
-    throw std::runtime_error(
-        "Error scheduling task on the " + this->name + " worker thread");
+bool WorkerThread::scheduleTaskInternal(
+    const size_t laneIndex,
+    std::shared_ptr<ScheduledTask> scheduledTask,
+    const bool waitForSpace) {
+  bool coalesced = false;
+  taskType onCoalesced;
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    auto &coalescableTasks = this->coalescableTasks[laneIndex];
+    if (!scheduledTask->coalescingKey.empty()) {
+      auto queuedTaskIt = coalescableTasks.find(scheduledTask->coalescingKey);
+      if (queuedTaskIt != coalescableTasks.end()) {
+        std::shared_ptr<ScheduledTask> queuedTask = queuedTaskIt->second;
+        onCoalesced = std::move(queuedTask->onCoalesced);
+        queuedTask->task = std::move(scheduledTask->task);
+        queuedTask->onCoalesced = std::move(scheduledTask->onCoalesced);
+        this->lanesStats[laneIndex].coalescedTasksCount++;
+        coalesced = true;
+      }
+    }
+
+    if (!coalesced) {
+      if (std::this_thread::get_id() != this->thread->get_id()) {
+        auto hasSpace = [this, laneIndex]() {
+          return this->stopped ||
+              this->lanes[laneIndex].size() < maxQueuedTasksPerLane;
+        };
+        if (!waitForSpace && !hasSpace()) {
+          this->lanesStats[laneIndex].rejectedTasksCount++;
+          return false;
+        }
+        this->spaceAvailable.wait(lock, hasSpace);
+      }
+      if (this->stopped) {
+        Logger::log(
+            "Task scheduled on the stopped " + this->name +
+            " worker thread was dropped");
+        return false;
+      }
+      if (scheduledTask->coalescingKey.empty()) {
+        // A task without a key may depend on any of the queued ones, so none
+        // of them can be replaced by tasks scheduled after it
+        coalescableTasks.clear();
+      } else {
+        coalescableTasks[scheduledTask->coalescingKey] = scheduledTask;
+      }
+      this->lanes[laneIndex].push_back(std::move(scheduledTask));
+      this->scheduledTasksCounts[laneIndex]++;
+      WorkerThreadLaneStats &laneStats = this->lanesStats[laneIndex];
+      laneStats.maxQueuedTasksCount = std::max(
+          laneStats.maxQueuedTasksCount, this->lanes[laneIndex].size());
+    }
+  }
+
+  if (coalesced) {
+    if (onCoalesced) {
+      onCoalesced();
+    }
+    return true;
   }
+  this->tasksAvailable.notify_one();
+  return true;
+}
+
+void WorkerThread::scheduleTask(
+    const taskType task,
+    const TaskPriority priority) {
+  this->scheduleTaskInternal(
+      static_cast<size_t>(priority),
+      std::make_shared<ScheduledTask>(ScheduledTask{
+          std::move(task), nullptr, "", std::chrono::steady_clock::now()}),
+      true);
+}
+
+void WorkerThread::scheduleTask(
+    const taskType task,
+    const TaskPriority priority,
+    const std::string &coalescingKey,
+    const taskType onCoalesced) {
+  this->scheduleTaskInternal(
+      static_cast<size_t>(priority),
+      std::make_shared<ScheduledTask>(ScheduledTask{
+          std::move(task),
+          std::move(onCoalesced),
+          coalescingKey,
+          std::chrono::steady_clock::now()}),
+      true);
+}
+
+bool WorkerThread::tryScheduleTask(
+    const taskType task,
+    const TaskPriority priority) {
+  return this->scheduleTaskInternal(
+      static_cast<size_t>(priority),
+      std::make_shared<ScheduledTask>(ScheduledTask{
+          std::move(task), nullptr, "", std::chrono::steady_clock::now()}),
+      false);
+}
+
+bool WorkerThread::tryScheduleTask(
+    const taskType task,
+    const TaskPriority priority,
+    const std::string &coalescingKey,
+    const taskType onCoalesced) {
+  return this->scheduleTaskInternal(
+      static_cast<size_t>(priority),
+      std::make_shared<ScheduledTask>(ScheduledTask{
+          std::move(task),
+          std::move(onCoalesced),
+          coalescingKey,
+          std::chrono::steady_clock::now()}),
+      false);
+}
+
+void WorkerThread::setIdleTask(const std::function<bool()> idleTask) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->idleTask = std::move(idleTask);
+}
+
+WorkerThreadLaneStats WorkerThread::getStats(const TaskPriority priority) {
+  const size_t laneIndex = static_cast<size_t>(priority);
+  std::lock_guard<std::mutex> lock(this->mutex);
+  WorkerThreadLaneStats stats = this->lanesStats[laneIndex];
+  stats.queuedTasksCount = this->lanes[laneIndex].size();
+  return stats;
+}
+
+std::vector<uint64_t>
+WorkerThread::markScheduledTasks(const TaskPriority priority) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return std::vector<uint64_t>(
+      std::begin(this->scheduledTasksCounts),
+      std::begin(this->scheduledTasksCounts) + static_cast<size_t>(priority) +
+          1);
+}
+
+void WorkerThread::waitForTasks(const std::vector<uint64_t> &mark) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->tasksFinished.wait(lock, [this, &mark]() {
+    if (this->stopped) {
+      return true;
+    }
+    for (size_t laneIndex = 0; laneIndex < mark.size(); laneIndex++) {
+      if (this->finishedTasksCounts[laneIndex] < mark[laneIndex]) {
+        return false;
+      }
+    }
+    return true;
+  });
 }
 
 WorkerThread::~WorkerThread() {
-  this->tasks.blockingWrite(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopped = true;
+  }
+  this->tasksAvailable.notify_all();
+  this->spaceAvailable.notify_all();
+  this->tasksFinished.notify_all();
   try {
     this->thread->join();
   } catch (const std::system_error &error) {
@@ -1,22 +1,120 @@
 #pragma once
 
-#include <folly/MPMCQueue.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace comm {
 
 using taskType = std::function<void()>;
 
+enum class TaskPriority {
+  // Tasks the user is waiting for, e.g. loading a draft
+  INTERACTIVE = 0,
+  // Bulk work, e.g. persisting a sync batch
+  BACKGROUND = 1,
+};
+
+struct WorkerThreadLaneStats {
+  uint64_t executedTasksCount;
+  uint64_t coalescedTasksCount;
+  // Tasks `tryScheduleTask` didn't queue because the lane was full
+  uint64_t rejectedTasksCount;
+  size_t queuedTasksCount;
+  // The longest the queue has been since the thread was started
+  size_t maxQueuedTasksCount;
+  // Time tasks spent in the queue before being executed, in milliseconds
+  uint64_t totalQueueLatency;
+  uint64_t maxQueueLatency;
+};
+
 class WorkerThread {
+  struct ScheduledTask {
+    taskType task;
+    // Called instead of the task if it was replaced by a newer one with the
+    // same coalescing key
+    taskType onCoalesced;
+    std::string coalescingKey;
+    std::chrono::steady_clock::time_point scheduledAt;
+  };
+
+  static const size_t lanesCount = 2;
+  // `scheduleTask` blocks while a lane is full, except for tasks scheduled
+  // from the worker thread itself, which would never be able to free the
+  // space. `tryScheduleTask` doesn't queue the task then.
+  static const size_t maxQueuedTasksPerLane = 1000;
+  // Tasks waiting longer than this (in milliseconds) are logged
+  static const uint64_t slowQueueLatencyThreshold = 1000;
+
   std::unique_ptr<std::thread> thread;
-  folly::MPMCQueue<std::unique_ptr<taskType>> tasks;
   const std::string name;
 
+  std::mutex mutex;
+  std::condition_variable tasksAvailable;
+  std::condition_variable spaceAvailable;
+  std::condition_variable tasksFinished;
+  std::deque<std::shared_ptr<ScheduledTask>> lanes[lanesCount];
+  // Lanes are executed in order, so a task is finished once as many tasks
+  // as were scheduled up to it are finished in its lane
+  uint64_t scheduledTasksCounts[lanesCount] = {};
+  uint64_t finishedTasksCounts[lanesCount] = {};
+  // Queued tasks which can still be replaced, per lane
+  std::unordered_map<std::string, std::shared_ptr<ScheduledTask>>
+      coalescableTasks[lanesCount];
+  WorkerThreadLaneStats lanesStats[lanesCount] = {};
+  std::function<bool()> idleTask;
+  bool idleTaskPending = false;
+  bool stopped = false;
+
+  void run();
+  bool scheduleTaskInternal(
+      const size_t laneIndex,
+      std::shared_ptr<ScheduledTask> scheduledTask,
+      const bool waitForSpace);
+
 public:
   WorkerThread(const std::string name);
-  void scheduleTask(const taskType task);
+  void scheduleTask(
+      const taskType task,
+      const TaskPriority priority = TaskPriority::BACKGROUND);
+  // If a task with the same key and priority is still waiting in the queue
+  // (and no task without a key was scheduled after it), it's replaced by this
+  // one, keeping its place in the queue, and its `onCoalesced` callback is
+  // called instead.
+  void scheduleTask(
+      const taskType task,
+      const TaskPriority priority,
+      const std::string &coalescingKey,
+      const taskType onCoalesced);
+  // Never block, meant for the JS thread. Return false, without queueing the
+  // task, if its lane is full. Replacing a queued task always succeeds.
+  bool tryScheduleTask(
+      const taskType task,
+      const TaskPriority priority = TaskPriority::BACKGROUND);
+  bool tryScheduleTask(
+      const taskType task,
+      const TaskPriority priority,
+      const std::string &coalescingKey,
+      const taskType onCoalesced);
+  // The idle task is called whenever the queue becomes empty after executing a
+  // task, and again for as long as it returns true and no task is scheduled.
+  // It's meant for work split into short steps, so it doesn't delay the tasks
+  // scheduled in the meantime.
+  void setIdleTask(const std::function<bool()> idleTask);
+  WorkerThreadLaneStats getStats(const TaskPriority priority);
+  // Marks the tasks scheduled so far with the given priority or a higher one,
+  // the ones with a lower priority are executed after them anyway
+  std::vector<uint64_t> markScheduledTasks(const TaskPriority priority);
+  // Blocks another thread until the marked tasks are executed, without
+  // waiting for the ones scheduled after them
+  void waitForTasks(const std::vector<uint64_t> &mark);
   ~WorkerThread();
 };
 
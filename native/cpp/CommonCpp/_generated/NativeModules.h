@@ -10,6 +10,7 @@
 #pragma once
 
 #include <ReactCommon/TurboModule.h>
+#include <optional>
 
 namespace facebook {
 namespace react {
@@ -25,15 +26,21 @@ virtual jsi::Value getAllDrafts(jsi::Runtime &rt) = 0;
 virtual jsi::Value removeAllDrafts(jsi::Runtime &rt) = 0;
 virtual jsi::Value getAllMessages(jsi::Runtime &rt) = 0;
 virtual jsi::Array getAllMessagesSync(jsi::Runtime &rt) = 0;
+virtual jsi::Value getMessagesForThread(jsi::Runtime &rt, const jsi::String &threadID, const jsi::String &beforeTime, double limit) = 0;
+virtual jsi::Value getLatestMessagesPerThread(jsi::Runtime &rt, double limit) = 0;
+virtual jsi::Value searchMessages(jsi::Runtime &rt, const jsi::String &query, const std::optional<jsi::String> &threadID, double limit) = 0;
 virtual jsi::Value processMessageStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) = 0;
 virtual bool processMessageStoreOperationsSync(jsi::Runtime &rt, const jsi::Array &operations) = 0;
 virtual jsi::Value getAllThreads(jsi::Runtime &rt) = 0;
 virtual jsi::Array getAllThreadsSync(jsi::Runtime &rt) = 0;
+virtual jsi::Value getThreadsOfMember(jsi::Runtime &rt, const jsi::String &userID) = 0;
 virtual jsi::Value processThreadStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) = 0;
 virtual bool processThreadStoreOperationsSync(jsi::Runtime &rt, const jsi::Array &operations) = 0;
 virtual jsi::Value initializeCryptoAccount(jsi::Runtime &rt, const jsi::String &userId) = 0;
 virtual jsi::Value getUserPublicKey(jsi::Runtime &rt) = 0;
 virtual jsi::Value getUserOneTimeKeys(jsi::Runtime &rt) = 0;
+virtual jsi::Value encryptForMany(jsi::Runtime &rt, const jsi::Array &userIDs, const jsi::String &content) = 0;
+virtual jsi::Value decryptMany(jsi::Runtime &rt, const jsi::Array &messages) = 0;
 virtual jsi::Object openSocket(jsi::Runtime &rt, const jsi::String &endpoint) = 0;
 virtual double getCodeVersion(jsi::Runtime &rt) = 0;
 virtual jsi::Value setNotifyToken(jsi::Runtime &rt, const jsi::String &token) = 0;
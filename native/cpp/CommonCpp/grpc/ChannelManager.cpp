@@ -0,0 +1,95 @@
+#include "ChannelManager.h"
+#include "Logger.h"
+
+#include <chrono>
+#include <sstream>
+
+namespace comm {
+namespace network {
+
+const size_t ChannelManager::stateWatchTimeoutMs;
+
+ChannelManager::ChannelManager() {
+  this->stateWatcherThread = std::make_unique<std::thread>(
+      [this]() { this->watchStateChanges(); });
+}
+
+ChannelManager &ChannelManager::getInstance() {
+  static ChannelManager *instance = new ChannelManager();
+  return *instance;
+}
+
+std::shared_ptr<grpc::Channel> ChannelManager::getChannel(
+    const std::string &hostname,
+    const std::string &port,
+    std::shared_ptr<grpc::ChannelCredentials> credentials) {
+  const std::string target = hostname + ":" + port;
+  std::lock_guard<std::mutex> lock(this->channelsMutex);
+  auto channelIt = this->channels.find(target);
+  if (channelIt != this->channels.end()) {
+    return channelIt->second->channel;
+  }
+
+  grpc::ChannelArguments arguments;
+  arguments.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, keepaliveTimeMs);
+  arguments.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, keepaliveTimeoutMs);
+  arguments.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+  arguments.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+  arguments.SetInt(
+      GRPC_ARG_INITIAL_RECONNECT_BACKOFF_MS, initialReconnectBackoffMs);
+  arguments.SetInt(GRPC_ARG_MIN_RECONNECT_BACKOFF_MS, minReconnectBackoffMs);
+  arguments.SetInt(GRPC_ARG_MAX_RECONNECT_BACKOFF_MS, maxReconnectBackoffMs);
+  std::shared_ptr<grpc::Channel> channel =
+      grpc::CreateCustomChannel(target, credentials, arguments);
+
+  // Connecting right away, so the handshake is done before the first call
+  auto watchedChannel = std::make_unique<WatchedChannel>(
+      WatchedChannel{target, channel, channel->GetState(true)});
+  this->watchChannel(watchedChannel.get());
+  this->channels[target] = std::move(watchedChannel);
+  return channel;
+}
+
+void ChannelManager::resetConnectionBackoff() {
+  std::lock_guard<std::mutex> lock(this->channelsMutex);
+  for (const auto &channelIt : this->channels) {
+    grpc::experimental::ChannelResetConnectionBackoff(
+        channelIt.second->channel.get());
+  }
+}
+
+void ChannelManager::watchChannel(WatchedChannel *watchedChannel) {
+  watchedChannel->channel->NotifyOnStateChange(
+      watchedChannel->lastObservedState,
+      std::chrono::system_clock::now() +
+          std::chrono::milliseconds(stateWatchTimeoutMs),
+      &this->stateChangesQueue,
+      watchedChannel);
+}
+
+void ChannelManager::watchStateChanges() {
+  void *tag;
+  bool stateChanged;
+  while (this->stateChangesQueue.Next(&tag, &stateChanged)) {
+    // Channels are never removed, so the tag is always valid
+    WatchedChannel *watchedChannel = static_cast<WatchedChannel *>(tag);
+    grpc_connectivity_state state = watchedChannel->channel->GetState(false);
+    if (stateChanged && state == GRPC_CHANNEL_TRANSIENT_FAILURE) {
+      std::ostringstream stringStream;
+      stringStream << "Connection to " << watchedChannel->target
+                   << " failed, reconnecting";
+      Logger::log(stringStream.str());
+    }
+    // The channel goes idle when the connection is closed, e.g. by the
+    // server or after a network change. Reconnecting right away means the
+    // next call doesn't have to wait for it.
+    if (state == GRPC_CHANNEL_IDLE) {
+      state = watchedChannel->channel->GetState(true);
+    }
+    watchedChannel->lastObservedState = state;
+    this->watchChannel(watchedChannel);
+  }
+}
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include <grpcpp/grpcpp.h>
+
+namespace comm {
+namespace network {
+
+// Keeps a single long-lived HTTP/2 channel per endpoint, shared by the stubs
+// of all the services reachable there, so calls are multiplexed over one
+// connection instead of each client doing its own TCP and TLS handshakes.
+// Channels are kept alive with pings and reconnected as soon as they fail.
+class ChannelManager {
+  struct WatchedChannel {
+    const std::string target;
+    std::shared_ptr<grpc::Channel> channel;
+    grpc_connectivity_state lastObservedState;
+  };
+
+  // Pings are sent on idle connections too, so mobile networks dropping
+  // inactive NAT mappings don't silently break the connection
+  static const int keepaliveTimeMs = 30 * 1000;
+  static const int keepaliveTimeoutMs = 10 * 1000;
+  // Reconnect quickly after a network change instead of waiting for the
+  // default backoff of up to two minutes
+  static const int initialReconnectBackoffMs = 500;
+  static const int minReconnectBackoffMs = 500;
+  static const int maxReconnectBackoffMs = 10 * 1000;
+  // Watches are rearmed after this time even if the state didn't change
+  static const size_t stateWatchTimeoutMs = 60 * 1000;
+
+  std::mutex channelsMutex;
+  std::unordered_map<std::string, std::unique_ptr<WatchedChannel>> channels;
+  grpc::CompletionQueue stateChangesQueue;
+  std::unique_ptr<std::thread> stateWatcherThread;
+
+  ChannelManager();
+  void watchStateChanges();
+  void watchChannel(WatchedChannel *watchedChannel);
+
+public:
+  // Never destroyed, so the state watcher doesn't outlive gRPC's own
+  // globals at exit
+  static ChannelManager &getInstance();
+  ChannelManager(const ChannelManager &) = delete;
+  ChannelManager &operator=(const ChannelManager &) = delete;
+
+  // Credentials are only used when the channel to the endpoint is created
+  std::shared_ptr<grpc::Channel> getChannel(
+      const std::string &hostname,
+      const std::string &port,
+      std::shared_ptr<grpc::ChannelCredentials> credentials);
+  // Makes channels waiting for the next reconnection attempt try right away,
+  // e.g. after the device got back online
+  void resetConnectionBackoff();
+};
+
+} // namespace network
+} // namespace comm
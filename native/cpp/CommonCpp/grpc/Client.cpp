@@ -1,4 +1,5 @@
 #include "Client.h"
+#include "ChannelManager.h"
 #include "Logger.h"
 #include <sstream>
 
@@ -13,7 +14,7 @@ Client::Client(
     const std::string deviceToken)
     : id(id), deviceToken(deviceToken) {
   std::shared_ptr<Channel> channel =
-      grpc::CreateChannel(hostname + ":" + port, credentials);
+      ChannelManager::getInstance().getChannel(hostname, port, credentials);
   this->stub_ = TunnelbrokerService::NewStub(channel);
 }
 
@@ -66,38 +67,111 @@ void Client::sendPong() {
   }
 }
 
-grpc::Status Client::send(
+Client::~Client() {
+  std::vector<std::shared_ptr<SendCall>> queuedSends;
+  {
+    std::unique_lock<std::mutex> lock(this->sendsMutex);
+    this->closed = true;
+    queuedSends = this->queuedSends.clear();
+    for (const auto &call : this->inFlightSends) {
+      call->context.TryCancel();
+    }
+    this->inFlightSendsDone.wait(
+        lock, [this]() { return this->inFlightSends.empty(); });
+  }
+  for (const auto &call : queuedSends) {
+    call->onDone(grpc::Status::CANCELLED);
+  }
+}
+
+void Client::send(
     std::string sessionID,
     std::string toDeviceID,
     std::string payload,
-    std::vector<std::string> blobHashes) {
-  grpc::ClientContext context;
-  tunnelbroker::SendRequest request;
-  google::protobuf::Empty response;
-
-  request.set_sessionid(sessionID);
-  request.set_todeviceid(toDeviceID);
-  request.set_payload(payload);
+    std::vector<std::string> blobHashes,
+    std::function<void(grpc::Status)> onDone,
+    const bool ordered) {
+  auto call = std::make_shared<SendCall>(ordered ? toDeviceID : "");
+  call->request.set_sessionid(sessionID);
+  call->request.set_todeviceid(toDeviceID);
+  call->request.set_payload(payload);
 
   for (const auto &blob : blobHashes) {
-    request.add_blobhashes(blob);
+    call->request.add_blobhashes(blob);
+  }
+  call->onDone = std::move(onDone);
+
+  std::vector<std::shared_ptr<SendCall>> calls;
+  {
+    std::lock_guard<std::mutex> lock(this->sendsMutex);
+    this->queuedSends.push(call, call->orderingKey);
+    calls = this->dequeueSends();
+  }
+  this->startSends(calls);
+}
+
+std::vector<std::shared_ptr<Client::SendCall>> Client::dequeueSends() {
+  if (this->closed) {
+    return {};
+  }
+  std::vector<std::shared_ptr<SendCall>> calls = this->queuedSends.pop();
+  this->inFlightSends.insert(calls.begin(), calls.end());
+  return calls;
+}
+
+void Client::startSends(const std::vector<std::shared_ptr<SendCall>> &calls) {
+  // Calls are started without holding the mutex, in case gRPC completes them
+  // inline. The client isn't destroyed before they complete.
+  for (const auto &call : calls) {
+    this->stub_->async()->Send(
+        &call->context,
+        &call->request,
+        &call->response,
+        [this, call](grpc::Status status) { this->onSendDone(call, status); });
   }
+}
 
-  return this->stub_->Send(&context, request, &response);
+void Client::onSendDone(std::shared_ptr<SendCall> call, grpc::Status status) {
+  call->onDone(status);
+  std::vector<std::shared_ptr<SendCall>> calls;
+  {
+    std::lock_guard<std::mutex> lock(this->sendsMutex);
+    this->inFlightSends.erase(call);
+    this->queuedSends.onDone(call->orderingKey);
+    if (this->inFlightSends.empty()) {
+      this->inFlightSendsDone.notify_all();
+    }
+    calls = this->dequeueSends();
+  }
+  // The destructor may be running already if there is nothing to start, so
+  // the client can't be used from here on in that case
+  if (!calls.empty()) {
+    this->startSends(calls);
+  }
 }
 
 void Client::get(std::string sessionID) {
   this->clientGetReadReactor =
-      std::make_unique<ClientGetReadReactor>(this->stub_.get(), sessionID);
+      std::make_shared<ClientGetReadReactor>(this->stub_.get(), sessionID);
 }
 
-void Client::setOnReadDoneCallback(std::function<void(std::string)> callback) {
+void Client::setOnReadDoneCallback(
+    std::function<void(std::vector<std::string>)> callback) {
   if (!this->clientGetReadReactor) {
     return;
   }
   this->clientGetReadReactor->setOnReadDoneCallback(callback);
 }
 
+std::function<void()> Client::getConfirmMessagesDeliveredCallback() {
+  std::weak_ptr<ClientGetReadReactor> weakReactor = this->clientGetReadReactor;
+  return [weakReactor]() {
+    if (auto reactor = weakReactor.lock()) {
+      reactor->confirmBatchDelivered();
+    }
+  };
+}
+
 void Client::setOnOpenCallback(std::function<void()> callback) {
   if (!this->clientGetReadReactor) {
     return;
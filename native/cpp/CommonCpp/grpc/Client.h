@@ -1,11 +1,17 @@
 #pragma once
 
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 #include <grpcpp/grpcpp.h>
 
 #include "ClientGetReadReactor.h"
+#include "SendQueue.h"
 #include "_generated/tunnelbroker.grpc.pb.h"
 #include "_generated/tunnelbroker.pb.h"
 
@@ -17,10 +23,40 @@ using tunnelbroker::CheckResponseType;
 using tunnelbroker::TunnelbrokerService;
 
 class Client {
+  struct SendCall {
+    grpc::ClientContext context;
+    // Empty if the send doesn't have to keep its order
+    const std::string orderingKey;
+    tunnelbroker::SendRequest request;
+    google::protobuf::Empty response;
+    std::function<void(grpc::Status)> onDone;
+
+    explicit SendCall(std::string orderingKey) : orderingKey{orderingKey} {
+    }
+  };
+
+  // Sends are pipelined, so a burst of messages doesn't take a round trip
+  // per message. Further ones wait in the queue until a call completes.
+  static const size_t maxInFlightSendsCount = 16;
+
   std::unique_ptr<TunnelbrokerService::Stub> stub_;
   const std::string id;
   const std::string deviceToken;
-  std::unique_ptr<ClientGetReadReactor> clientGetReadReactor;
+  // Shared with the callbacks confirming delivered messages
+  std::shared_ptr<ClientGetReadReactor> clientGetReadReactor;
+
+  // Guards the sends below
+  std::mutex sendsMutex;
+  std::condition_variable inFlightSendsDone;
+  SendQueue<std::shared_ptr<SendCall>> queuedSends{maxInFlightSendsCount};
+  std::unordered_set<std::shared_ptr<SendCall>> inFlightSends;
+  bool closed = false;
+
+  // Moves as many queued sends as the window allows to the in-flight ones,
+  // expects sendsMutex to be held
+  std::vector<std::shared_ptr<SendCall>> dequeueSends();
+  void startSends(const std::vector<std::shared_ptr<SendCall>> &calls);
+  void onSendDone(std::shared_ptr<SendCall> call, grpc::Status status);
 
 public:
   Client(
@@ -29,19 +65,28 @@ public:
       std::shared_ptr<grpc::ChannelCredentials> credentials,
       const std::string id,
       const std::string deviceToken);
+  // Cancels the sends in flight and waits for them to complete
+  ~Client();
 
   CheckResponseType checkIfPrimaryDeviceOnline();
   bool becomeNewPrimaryDevice();
   void sendPong();
 
-  grpc::Status send(
+  // Returns immediately, onDone is called on a gRPC thread once the server
+  // got the message. Ordered messages to the same device reach the server in
+  // the order they were sent, one round trip each. Other messages may not.
+  void send(
       std::string sessionID,
       std::string toDeviceID,
       std::string payload,
-      std::vector<std::string> blobHashes);
+      std::vector<std::string> blobHashes,
+      std::function<void(grpc::Status)> onDone,
+      const bool ordered = true);
 
   void get(std::string sessionID);
-  void setOnReadDoneCallback(std::function<void(std::string)> callback);
+  void setOnReadDoneCallback(
+      std::function<void(std::vector<std::string>)> callback);
+  std::function<void()> getConfirmMessagesDeliveredCallback();
   void setOnOpenCallback(std::function<void()> callback);
   void setOnCloseCallback(std::function<void()> callback);
   void closeGetStream();
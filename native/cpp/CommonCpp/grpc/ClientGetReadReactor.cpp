@@ -1,5 +1,7 @@
 #include "ClientGetReadReactor.h"
 
+#include <algorithm>
+
 ClientGetReadReactor::ClientGetReadReactor(
     tunnelbroker::TunnelbrokerService::Stub *stub,
     std::string sessionID)
@@ -10,15 +12,74 @@ ClientGetReadReactor::ClientGetReadReactor(
   StartCall();
 }
 
+std::vector<std::string> ClientGetReadReactor::takeBatch() {
+  const size_t batchSize = std::min(
+      this->bufferedMessages.size(), static_cast<size_t>(maxBatchSize));
+  std::vector<std::string> batch;
+  batch.reserve(batchSize);
+  for (size_t i = 0; i < batchSize; ++i) {
+    batch.push_back(std::move(this->bufferedMessages.front()));
+    this->bufferedMessages.pop_front();
+  }
+  this->batchInDelivery = true;
+  return batch;
+}
+
 void ClientGetReadReactor::OnReadDone(bool ok) {
   if (!ok) {
     return;
   }
-  std::lock_guard<std::mutex> guard{this->onReadDoneCallbackMutex};
-  if (this->onReadDoneCallback) {
-    this->onReadDoneCallback(this->response.payload());
+  std::vector<std::string> batch;
+  std::function<void(std::vector<std::string>)> onReadDoneCallback;
+  bool readNext;
+  {
+    std::lock_guard<std::mutex> guard{this->messagesMutex};
+    this->bufferedMessages.push_back(
+        std::move(*this->response.mutable_payload()));
+    if (!this->batchInDelivery && this->onReadDoneCallback) {
+      batch = this->takeBatch();
+      onReadDoneCallback = this->onReadDoneCallback;
+    }
+    readNext = this->bufferedMessages.size() < maxBufferedMessagesCount;
+    this->readPaused = !readNext;
+    // Taken before a confirmation can see the read paused and release it
+    if (this->readPaused) {
+      AddHold();
+    }
+  }
+  if (onReadDoneCallback) {
+    onReadDoneCallback(std::move(batch));
+  }
+  if (readNext) {
+    StartRead(&(this->response));
+  }
+}
+
+void ClientGetReadReactor::confirmBatchDelivered() {
+  std::vector<std::string> batch;
+  std::function<void(std::vector<std::string>)> onReadDoneCallback;
+  bool resumeRead;
+  {
+    std::lock_guard<std::mutex> guard{this->messagesMutex};
+    this->batchInDelivery = false;
+    if (!this->bufferedMessages.empty() && this->onReadDoneCallback) {
+      batch = this->takeBatch();
+      onReadDoneCallback = this->onReadDoneCallback;
+    }
+    resumeRead = this->readPaused &&
+        this->bufferedMessages.size() < maxBufferedMessagesCount;
+    if (resumeRead) {
+      this->readPaused = false;
+    }
+  }
+  if (onReadDoneCallback) {
+    onReadDoneCallback(std::move(batch));
+  }
+  if (resumeRead) {
+    // The pending read keeps the call open once the hold is removed
+    StartRead(&(this->response));
+    RemoveHold();
   }
-  StartRead(&(this->response));
 }
 
 void ClientGetReadReactor::close() {
@@ -26,7 +87,16 @@ void ClientGetReadReactor::close() {
     std::lock_guard<std::mutex> guard{this->setReadyStateMutex};
     this->setReadyState(SocketStatus::CLOSING);
   }
+  bool readPaused;
+  {
+    std::lock_guard<std::mutex> guard{this->messagesMutex};
+    readPaused = this->readPaused;
+    this->readPaused = false;
+  }
   this->context.TryCancel();
+  if (readPaused) {
+    RemoveHold();
+  }
 }
 
 void ClientGetReadReactor::setOnOpenCallback(
@@ -36,9 +106,19 @@ void ClientGetReadReactor::setOnOpenCallback(
 }
 
 void ClientGetReadReactor::setOnReadDoneCallback(
-    std::function<void(std::string)> onReadDoneCallback) {
-  std::lock_guard<std::mutex> guard{this->onReadDoneCallbackMutex};
-  this->onReadDoneCallback = onReadDoneCallback;
+    std::function<void(std::vector<std::string>)> onReadDoneCallback) {
+  // Messages read before the callback was set are delivered now
+  std::vector<std::string> batch;
+  {
+    std::lock_guard<std::mutex> guard{this->messagesMutex};
+    this->onReadDoneCallback = onReadDoneCallback;
+    if (this->batchInDelivery || this->bufferedMessages.empty() ||
+        !onReadDoneCallback) {
+      return;
+    }
+    batch = this->takeBatch();
+  }
+  onReadDoneCallback(std::move(batch));
 }
 
 void ClientGetReadReactor::setOnCloseCallback(
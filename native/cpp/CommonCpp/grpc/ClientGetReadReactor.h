@@ -6,21 +6,39 @@
 #include "_generated/tunnelbroker.grpc.pb.h"
 #include "_generated/tunnelbroker.pb.h"
 
+#include <deque>
+#include <vector>
+
 class ClientGetReadReactor
     : public grpc::ClientReadReactor<tunnelbroker::GetResponse> {
+  // Messages are handed to the read done callback in batches, the next batch
+  // only after the previous one was confirmed as delivered. Reading from the
+  // stream is paused while too many messages are waiting. The call is held
+  // open in the meantime, so it can be resumed from outside the reactions.
+  static const size_t maxBatchSize = 100;
+  static const size_t maxBufferedMessagesCount = 1000;
+
   std::string sessionID;
   grpc::ClientContext context;
   tunnelbroker::GetRequest request;
   tunnelbroker::GetResponse response;
-  std::mutex onReadDoneCallbackMutex;
+  // Guards the messages, the state of their delivery and the read done
+  // callback
+  std::mutex messagesMutex;
   std::mutex onOpenCallbackMutex;
   std::mutex onCloseCallbackMutex;
   std::mutex setReadyStateMutex;
-  std::function<void(std::string)> onReadDoneCallback;
+  std::deque<std::string> bufferedMessages;
+  bool batchInDelivery = false;
+  bool readPaused = false;
+  std::function<void(std::vector<std::string>)> onReadDoneCallback;
   std::function<void()> onOpenCallback;
   std::function<void()> onCloseCallback;
   std::function<void(SocketStatus)> setReadyState;
 
+  // Expects messagesMutex to be held
+  std::vector<std::string> takeBatch();
+
 public:
   ClientGetReadReactor(
       tunnelbroker::TunnelbrokerService::Stub *stub,
@@ -30,10 +48,14 @@ public:
   void OnReadDone(bool ok) override;
   void OnDone(const grpc::Status &status) override;
   void close();
+  // Hands the next batch to the read done callback, if there are messages
+  // waiting, and resumes reading if it was paused. Can be called from any
+  // thread.
+  void confirmBatchDelivered();
 
   void setOnOpenCallback(std::function<void()> onOpenCallback);
-  void
-  setOnReadDoneCallback(std::function<void(std::string)> onReadDoneCallback);
+  void setOnReadDoneCallback(
+      std::function<void(std::vector<std::string>)> onReadDoneCallback);
   void setOnCloseCallback(std::function<void()> onCloseCallback);
   void assignSetReadyStateCallback(std::function<void(SocketStatus)> callback);
 };
@@ -1,94 +1,213 @@
 #include "GRPCStreamHostObject.h"
 #include "../NativeModules/InternalModules/GlobalNetworkSingleton.h"
 #include "../NativeModules/InternalModules/SocketStatus.h"
+#include "Logger.h"
 
 using namespace facebook;
 
-GRPCStreamHostObject::GRPCStreamHostObject(
+std::shared_ptr<GRPCStreamHostObject> GRPCStreamHostObject::create(
     jsi::Runtime &rt,
-    std::shared_ptr<react::CallInvoker> jsInvoker)
-    : readyState{SocketStatus::CONNECTING},
+    std::shared_ptr<react::CallInvoker> jsInvoker,
+    IncomingMessagesProcessor processIncomingMessages) {
+  // The constructor is private, so `std::make_shared` can't be used
+  std::shared_ptr<GRPCStreamHostObject> hostObject{new GRPCStreamHostObject(
+      std::move(jsInvoker), std::move(processIncomingMessages))};
+  hostObject->open(rt);
+  return hostObject;
+}
+
+GRPCStreamHostObject::GRPCStreamHostObject(
+    std::shared_ptr<react::CallInvoker> jsInvoker,
+    IncomingMessagesProcessor processIncomingMessages)
+    : readyState{std::make_shared<std::atomic<int>>(
+          SocketStatus::CONNECTING)},
       onopen{},
       onmessage{},
       onclose{},
-      send{jsi::Function::createFromHostFunction(
-          rt,
-          jsi::PropNameID::forUtf8(rt, "send"),
-          1,
-          [](jsi::Runtime &rt,
-             const jsi::Value &thisVal,
-             const jsi::Value *args,
-             size_t count) {
-            auto payload{args->asString(rt).utf8(rt)};
-            comm::GlobalNetworkSingleton::instance.scheduleOrRun(
+      onprocessed{},
+      send{},
+      close{},
+      jsInvoker{jsInvoker},
+      processIncomingMessages{std::move(processIncomingMessages)},
+      processesMessagesNatively{std::make_shared<std::atomic<bool>>(false)} {
+}
+
+// Called once the stream is owned by a shared pointer, so the callbacks can
+// get a weak reference to it. They are called on the network and gRPC
+// threads, and only lock it once they get to the JS thread, so the stream is
+// never released anywhere else.
+void GRPCStreamHostObject::open(jsi::Runtime &rt) {
+  std::weak_ptr<GRPCStreamHostObject> weakThis = this->weak_from_this();
+
+  this->send = jsi::Function::createFromHostFunction(
+      rt,
+      jsi::PropNameID::forUtf8(rt, "send"),
+      2,
+      [weakThis](
+          jsi::Runtime &rt,
+          const jsi::Value &thisVal,
+          const jsi::Value *args,
+          size_t count) {
+        auto self = weakThis.lock();
+        if (!self) {
+          return jsi::Value::undefined();
+        }
+        auto payload{args->asString(rt).utf8(rt)};
+        // The optional callback is called with null once the message
+        // is sent, or with the error message
+        uint64_t sendID = 0;
+        if (count > 1 && args[1].isObject() &&
+            args[1].asObject(rt).isFunction(rt)) {
+          sendID = ++self->lastSendID;
+          self->sendCallbacks.emplace(
+              sendID, args[1].asObject(rt).asFunction(rt));
+        }
+        auto jsInvoker = self->jsInvoker;
+        auto onDone = [weakThis, jsInvoker, &rt, sendID](grpc::Status status) {
+          if (!sendID) {
+            return;
+          }
+          std::string error = status.ok() ? "" : status.error_message();
+          jsInvoker->invokeAsync([weakThis, &rt, sendID, error]() {
+            auto self = weakThis.lock();
+            if (!self) {
+              return;
+            }
+            auto callbackIt = self->sendCallbacks.find(sendID);
+            if (callbackIt == self->sendCallbacks.end()) {
+              return;
+            }
+            jsi::Function callback = std::move(callbackIt->second);
+            self->sendCallbacks.erase(callbackIt);
+            callback.call(
+                rt,
+                error.empty() ? jsi::Value::null()
+                              : jsi::String::createFromUtf8(rt, error));
+          });
+        };
+        // Sending doesn't wait for the server, so a burst of messages
+        // is pipelined instead of taking a round trip per message. There is
+        // no real recipient device to keep the order of messages for.
+        bool scheduled =
+            comm::GlobalNetworkSingleton::instance.tryScheduleOrRun(
                 [=](comm::NetworkModule &networkModule) {
                   std::vector<std::string> blobHashes{};
                   networkModule.send(
                       "sessionID-placeholder",
                       "toDeviceID-placeholder",
                       payload,
-                      blobHashes);
+                      blobHashes,
+                      onDone,
+                      false);
                 });
-            return jsi::Value::undefined();
-          })},
-      close{jsi::Function::createFromHostFunction(
-          rt,
-          jsi::PropNameID::forUtf8(rt, "close"),
-          0,
-          [](jsi::Runtime &rt,
-             const jsi::Value &thisVal,
-             const jsi::Value *args,
-             size_t count) {
-            comm::GlobalNetworkSingleton::instance.scheduleOrRun(
+        if (!scheduled) {
+          onDone(grpc::Status(
+              grpc::StatusCode::RESOURCE_EXHAUSTED,
+              "too many pending messages"));
+        }
+        return jsi::Value::undefined();
+      });
+
+  this->close = jsi::Function::createFromHostFunction(
+      rt,
+      jsi::PropNameID::forUtf8(rt, "close"),
+      0,
+      [](jsi::Runtime &rt,
+         const jsi::Value &thisVal,
+         const jsi::Value *args,
+         size_t count) {
+        // Queued after the pending sends
+        bool scheduled =
+            comm::GlobalNetworkSingleton::instance.tryScheduleOrRun(
                 [=](comm::NetworkModule &networkModule) {
                   networkModule.closeGetStream();
                 });
+        if (!scheduled) {
+          comm::Logger::log("Dropped closing the stream, queue is full");
+        }
 
-            return jsi::Value::undefined();
-          })},
-      jsInvoker{jsInvoker} {
+        return jsi::Value::undefined();
+      });
 
-  auto onReadDoneCallback = [this, &rt](std::string data) {
-    this->jsInvoker->invokeAsync([this, &rt, data]() {
-      if (this->onmessage.isNull()) {
+  std::shared_ptr<react::CallInvoker> jsInvoker = this->jsInvoker;
+  IncomingMessagesProcessor processIncomingMessages =
+      this->processIncomingMessages;
+  std::shared_ptr<std::atomic<bool>> processesMessagesNatively =
+      this->processesMessagesNatively;
+
+  // Messages come in batches, delivered to JS with a single task. The next
+  // batch is requested once this one reaches the JS thread, so no more than
+  // a couple of batches wait in the JS queue. The rest of the backlog stays
+  // in the reactor, which stops reading when it grows too big.
+  // With native processing, the batch is confirmed once it's processed and
+  // the summary reaches the JS thread. Confirmations go straight to the
+  // reactor instead of the network thread's queue, which could drop them and
+  // stall the stream for good.
+  auto onReadDoneCallback = [weakThis,
+                             jsInvoker,
+                             processIncomingMessages,
+                             processesMessagesNatively,
+                             &rt](std::vector<std::string> messages,
+                                  std::function<void()> confirmDelivered) {
+    if (processIncomingMessages && *processesMessagesNatively) {
+      processIncomingMessages(
+          std::move(messages),
+          [weakThis, jsInvoker, &rt, confirmDelivered](
+              ProcessedIncomingMessages processedMessages) {
+            jsInvoker->invokeAsync(
+                [weakThis, &rt, confirmDelivered, processedMessages]() {
+                  // The messages are stored already, so the batch is
+                  // confirmed even if nobody listens anymore
+                  confirmDelivered();
+                  if (auto self = weakThis.lock()) {
+                    self->deliverProcessedMessages(rt, processedMessages);
+                  }
+                });
+          });
+      return;
+    }
+    jsInvoker->invokeAsync([weakThis,
+                            &rt,
+                            confirmDelivered,
+                            messages = std::move(messages)]() {
+      auto self = weakThis.lock();
+      if (!self) {
         return;
       }
-      auto msgObject = jsi::Object(rt);
-      msgObject.setProperty(rt, "data", jsi::String::createFromUtf8(rt, data));
-      this->onmessage.asObject(rt).asFunction(rt).call(rt, msgObject, 1);
+      confirmDelivered();
+      self->deliverMessages(rt, messages, false);
     });
   };
 
-  auto onOpenCallback = [this, &rt]() {
-    this->jsInvoker->invokeAsync([this, &rt]() {
-      if (this->onopen.isNull()) {
+  auto onOpenCallback = [weakThis, jsInvoker, &rt]() {
+    jsInvoker->invokeAsync([weakThis, &rt]() {
+      auto self = weakThis.lock();
+      if (!self || self->onopen.isNull()) {
         return;
       }
-      this->onopen.asObject(rt).asFunction(rt).call(
+      self->onopen.asObject(rt).asFunction(rt).call(
           rt, jsi::Value::undefined(), 0);
     });
   };
 
-  auto onCloseCallback = [this, &rt]() {
-    this->jsInvoker->invokeAsync([this, &rt]() {
-      if (this->onclose.isNull()) {
+  auto onCloseCallback = [weakThis, jsInvoker, &rt]() {
+    jsInvoker->invokeAsync([weakThis, &rt]() {
+      auto self = weakThis.lock();
+      if (!self || self->onclose.isNull()) {
         return;
       }
-      this->onclose.asObject(rt).asFunction(rt).call(
+      self->onclose.asObject(rt).asFunction(rt).call(
           rt, jsi::Value::undefined(), 0);
     });
   };
 
   // We pass the following lambda to the `NetworkModule` on the "network"
-  // thread with a reference to `this` bound in. This allows us to directly
-  // modify the value of `readyState` in a synchronous manner.
-  auto setReadyStateCallback = [this](SocketStatus newSocketStatus) {
-    if (!this) {
-      // This handles the case where `GRPCStreamHostObj` may have been freed
-      // by the JS garbage collector and `this` is no longer a valid reference.
-      return;
-    }
-    this->readyState = newSocketStatus;
+  // thread. It only holds the shared `readyState`, so it can modify it
+  // synchronously even after `GRPCStreamHostObject` was freed by the JS
+  // garbage collector.
+  std::shared_ptr<std::atomic<int>> readyState = this->readyState;
+  auto setReadyStateCallback = [readyState](SocketStatus newSocketStatus) {
+    *readyState = newSocketStatus;
   };
 
   // The reason we're queueing up the `.get()` call on the JS event loop is
@@ -105,8 +224,8 @@ GRPCStreamHostObject::GRPCStreamHostObject(
   // callback has been properly set. We queue the `get()` call on the JS
   // event loop to guarantee that the `.onopen` callback is set before the
   // socket can possibly open. This mimics the existing `WebSocket` behavior.
-  this->jsInvoker->invokeAsync([=]() {
-    comm::GlobalNetworkSingleton::instance.scheduleOrRun(
+  jsInvoker->invokeAsync([=]() {
+    bool scheduled = comm::GlobalNetworkSingleton::instance.tryScheduleOrRun(
         [=](comm::NetworkModule &networkModule) {
           // The callbacks are set after the call to `.get()` because they
           // need to be passed to the `ClientGetReadReactor` object, which is
@@ -114,22 +233,87 @@ GRPCStreamHostObject::GRPCStreamHostObject(
           networkModule.initializeNetworkModule(
               "userId-placeholder", "deviceToken-placeholder", "localhost");
           networkModule.get("sessionID-placeholder");
-          networkModule.setOnReadDoneCallback(onReadDoneCallback);
+          std::function<void()> confirmMessagesDelivered =
+              networkModule.getConfirmMessagesDeliveredCallback();
+          networkModule.setOnReadDoneCallback(
+              [onReadDoneCallback,
+               confirmMessagesDelivered](std::vector<std::string> messages) {
+                onReadDoneCallback(
+                    std::move(messages), confirmMessagesDelivered);
+              });
           networkModule.setOnOpenCallback(onOpenCallback);
           networkModule.setOnCloseCallback(onCloseCallback);
           networkModule.assignSetReadyStateCallback(setReadyStateCallback);
-        });
+        },
+        comm::TaskPriority::INTERACTIVE);
+    if (!scheduled) {
+      comm::Logger::log("Dropped opening the stream, queue is full");
+    }
   });
 }
 
+void GRPCStreamHostObject::deliverMessages(
+    jsi::Runtime &rt,
+    const std::vector<std::string> &messages,
+    bool decrypted) {
+  if (this->onmessage.isNull() || messages.empty()) {
+    return;
+  }
+  jsi::Function onmessage = this->onmessage.asObject(rt).asFunction(rt);
+  jsi::PropNameID dataPropName = jsi::PropNameID::forAscii(rt, "data");
+  for (const std::string &data : messages) {
+    auto msgObject = jsi::Object(rt);
+    msgObject.setProperty(
+        rt, dataPropName, jsi::String::createFromUtf8(rt, data));
+    if (decrypted) {
+      msgObject.setProperty(rt, "decrypted", true);
+    }
+    // A throwing handler only loses its own message, the rest of the batch
+    // is still delivered
+    try {
+      onmessage.call(rt, msgObject, 1);
+    } catch (const jsi::JSError &e) {
+      comm::Logger::log("Error in onmessage: " + e.getMessage());
+    }
+  }
+}
+
+void GRPCStreamHostObject::deliverProcessedMessages(
+    jsi::Runtime &rt,
+    const ProcessedIncomingMessages &processedMessages) {
+  if (!this->onprocessed.isNull() && processedMessages.messageIDs.size()) {
+    auto toJSIArray = [&rt](const std::vector<std::string> &strings) {
+      jsi::Array array(rt, strings.size());
+      for (size_t idx = 0; idx < strings.size(); idx++) {
+        array.setValueAtIndex(
+            rt, idx, jsi::String::createFromUtf8(rt, strings[idx]));
+      }
+      return array;
+    };
+    auto summary = jsi::Object(rt);
+    summary.setProperty(
+        rt, "messageIDs", toJSIArray(processedMessages.messageIDs));
+    summary.setProperty(
+        rt, "threadIDs", toJSIArray(processedMessages.threadIDs));
+    try {
+      this->onprocessed.asObject(rt).asFunction(rt).call(rt, summary, 1);
+    } catch (const jsi::JSError &e) {
+      comm::Logger::log("Error in onprocessed: " + e.getMessage());
+    }
+  }
+  this->deliverMessages(rt, processedMessages.unprocessedPayloads, false);
+  this->deliverMessages(rt, processedMessages.decryptedPayloads, true);
+}
+
 std::vector<jsi::PropNameID>
 GRPCStreamHostObject::getPropertyNames(jsi::Runtime &rt) {
   std::vector<jsi::PropNameID> names;
-  names.reserve(6);
+  names.reserve(7);
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"readyState"}));
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"onopen"}));
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"onmessage"}));
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"onclose"}));
+  names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"onprocessed"}));
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"close"}));
   names.push_back(jsi::PropNameID::forUtf8(rt, std::string{"send"}));
   return names;
@@ -140,7 +324,7 @@ GRPCStreamHostObject::get(jsi::Runtime &runtime, const jsi::PropNameID &name) {
   auto propName = name.utf8(runtime);
 
   if (propName == "readyState") {
-    return jsi::Value(this->readyState);
+    return jsi::Value(this->readyState->load());
   }
   if (propName == "send") {
     return this->send.asObject(runtime).asFunction(runtime);
@@ -163,6 +347,11 @@ GRPCStreamHostObject::get(jsi::Runtime &runtime, const jsi::PropNameID &name) {
         ? jsi::Value::null()
         : this->onclose.asObject(runtime).asFunction(runtime);
   }
+  if (propName == "onprocessed") {
+    return this->onprocessed.isNull()
+        ? jsi::Value::null()
+        : this->onprocessed.asObject(runtime).asFunction(runtime);
+  }
   return jsi::Value::undefined();
 }
 
@@ -183,5 +372,14 @@ void GRPCStreamHostObject::set(
       propName == "onclose" && value.isObject() &&
       value.asObject(runtime).isFunction(runtime)) {
     this->onclose = value.asObject(runtime).asFunction(runtime);
+  } else if (propName == "onprocessed") {
+    // Processing natively can be turned off by setting the callback to null
+    if (value.isObject() && value.asObject(runtime).isFunction(runtime)) {
+      this->onprocessed = value.asObject(runtime).asFunction(runtime);
+      *this->processesMessagesNatively = true;
+    } else if (value.isNull()) {
+      this->onprocessed = jsi::Value::null();
+      *this->processesMessagesNatively = false;
+    }
   }
 }
@@ -2,25 +2,75 @@
 
 #include <ReactCommon/CallInvoker.h>
 #import <jsi/jsi.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 using namespace facebook;
 
-class JSI_EXPORT GRPCStreamHostObject : public jsi::HostObject {
+struct ProcessedIncomingMessages {
+  // Stored in the database, JS only gets their IDs
+  std::vector<std::string> messageIDs;
+  std::vector<std::string> threadIDs;
+  // Passed to `onmessage` as they came
+  std::vector<std::string> unprocessedPayloads;
+  // Decrypted, but not recognized as messages, passed to `onmessage` with
+  // the `decrypted` flag set
+  std::vector<std::string> decryptedPayloads;
+};
+
+// Processes a batch of payloads off the JS thread and calls `onProcessed`,
+// on any thread, once done
+typedef std::function<void(
+    std::vector<std::string> payloads,
+    std::function<void(ProcessedIncomingMessages)> onProcessed)>
+    IncomingMessagesProcessor;
+
+class JSI_EXPORT GRPCStreamHostObject
+    : public jsi::HostObject,
+      public std::enable_shared_from_this<GRPCStreamHostObject> {
 public:
-  GRPCStreamHostObject(
+  // Callbacks only keep a weak reference to the stream, so it can be freed
+  // by the JS garbage collector while calls are pending
+  static std::shared_ptr<GRPCStreamHostObject> create(
       jsi::Runtime &rt,
-      std::shared_ptr<react::CallInvoker> jsInvoker);
+      std::shared_ptr<react::CallInvoker> jsInvoker,
+      IncomingMessagesProcessor processIncomingMessages = nullptr);
   jsi::Value get(jsi::Runtime &, const jsi::PropNameID &name) override;
   void set(jsi::Runtime &, const jsi::PropNameID &name, const jsi::Value &value)
       override;
   std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime &rt) override;
 
 private:
-  int readyState;
+  // Set on the network thread, shared with its callback so it doesn't need
+  // the stream
+  std::shared_ptr<std::atomic<int>> readyState;
   jsi::Value onopen;
   jsi::Value onmessage;
   jsi::Value onclose;
+  // Incoming messages are processed natively while it's set
+  jsi::Value onprocessed;
   jsi::Value send;
   jsi::Value close;
   std::shared_ptr<react::CallInvoker> jsInvoker;
+  // Callbacks of the sends in flight, only accessed on the JS thread
+  uint64_t lastSendID = 0;
+  std::unordered_map<uint64_t, jsi::Function> sendCallbacks;
+  IncomingMessagesProcessor processIncomingMessages;
+  std::shared_ptr<std::atomic<bool>> processesMessagesNatively;
+
+  GRPCStreamHostObject(
+      std::shared_ptr<react::CallInvoker> jsInvoker,
+      IncomingMessagesProcessor processIncomingMessages);
+  void open(jsi::Runtime &rt);
+  void deliverMessages(
+      jsi::Runtime &rt,
+      const std::vector<std::string> &messages,
+      bool decrypted);
+  void deliverProcessedMessages(
+      jsi::Runtime &rt,
+      const ProcessedIncomingMessages &processedMessages);
 };
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// Decides when queued sends are started, so that no more than
+// maxInFlightCount are in flight at a time. Sends with an ordering key are
+// started one at a time per key, in the order they were pushed, the ones
+// without it as soon as there is space. Every operation takes constant time
+// per send, however long the queue gets. Not thread-safe.
+template <typename Send> class SendQueue {
+  const size_t maxInFlightCount;
+  size_t inFlightCount = 0;
+  // Sends which can be started as soon as there is space, in the order they
+  // became ready
+  std::deque<Send> readySends;
+  // Keys with a send ready or in flight, mapped to the sends waiting for it
+  std::unordered_map<std::string, std::deque<Send>> waitingSends;
+
+public:
+  explicit SendQueue(const size_t maxInFlightCount)
+      : maxInFlightCount{maxInFlightCount} {
+  }
+
+  void push(Send send, const std::string &orderingKey) {
+    if (!orderingKey.empty()) {
+      auto waitingSendsIt = this->waitingSends.find(orderingKey);
+      if (waitingSendsIt != this->waitingSends.end()) {
+        waitingSendsIt->second.push_back(std::move(send));
+        return;
+      }
+      this->waitingSends.emplace(orderingKey, std::deque<Send>{});
+    }
+    this->readySends.push_back(std::move(send));
+  }
+
+  // Returns the sends to start now, they are in flight from then on
+  std::vector<Send> pop() {
+    std::vector<Send> sends;
+    while (!this->readySends.empty() &&
+           this->inFlightCount < this->maxInFlightCount) {
+      sends.push_back(std::move(this->readySends.front()));
+      this->readySends.pop_front();
+      this->inFlightCount++;
+    }
+    return sends;
+  }
+
+  // Called once a send returned by pop completes, with the key it was pushed
+  // with
+  void onDone(const std::string &orderingKey) {
+    this->inFlightCount--;
+    if (orderingKey.empty()) {
+      return;
+    }
+    auto waitingSendsIt = this->waitingSends.find(orderingKey);
+    if (waitingSendsIt == this->waitingSends.end()) {
+      return;
+    }
+    if (waitingSendsIt->second.empty()) {
+      this->waitingSends.erase(waitingSendsIt);
+      return;
+    }
+    this->readySends.push_back(std::move(waitingSendsIt->second.front()));
+    waitingSendsIt->second.pop_front();
+  }
+
+  // Removes and returns the sends which weren't started
+  std::vector<Send> clear() {
+    std::vector<Send> sends(
+        std::make_move_iterator(this->readySends.begin()),
+        std::make_move_iterator(this->readySends.end()));
+    this->readySends.clear();
+    for (auto &[orderingKey, waitingSends] : this->waitingSends) {
+      for (auto &send : waitingSends) {
+        sends.push_back(std::move(send));
+      }
+    }
+    this->waitingSends.clear();
+    return sends;
+  }
+
+  size_t getInFlightCount() const {
+    return this->inFlightCount;
+  }
+};
+
+} // namespace network
+} // namespace comm
@@ -2,6 +2,7 @@
 #import "../../cpp/CommonCpp/CryptoTools/Tools.h"
 #import "../../cpp/CommonCpp/Tools/Logger.h"
 #import <functional>
+#import <thread>
 
 #import <XCTest/XCTest.h>
 
@@ -311,4 +312,167 @@ void testMessagesWrapper(
   }
 }
 
+- (void)testStoreDirty {
+  try {
+    ModuleWithKeys a = initializeModuleWithKeys(100);
+    ModuleWithKeys b = initializeModuleWithKeys(101);
+    ModuleWithKeys c = initializeModuleWithKeys(102);
+    sendMessage(a, b);
+    sendMessage(a, c);
+
+    std::string pickleKey{Tools::generateRandomString(20)};
+    Persist persist = a.module->storeAsB64(pickleKey);
+    Persist dirty = a.module->storeDirty();
+    XCTAssert(
+        dirty.account.empty() && dirty.sessions.empty(),
+        @"nothing is dirty right after storing");
+
+    sendMessage(a, b);
+    dirty = a.module->storeDirty();
+    XCTAssert(dirty.account.empty(), @"account is not dirty");
+    XCTAssert(
+        dirty.sessions.size() == 1 && dirty.sessions.count(b.module->id),
+        @"only the used session is dirty");
+
+    // a persist that failed to be stored is included in the next one
+    a.module->markDirty(dirty);
+    XCTAssert(
+        a.module->storeDirty().sessions.count(b.module->id),
+        @"session is dirty again after marking");
+
+    // applying the dirty sessions on top of the full state gives the current
+    // state
+    persist.sessions[b.module->id] = dirty.sessions[b.module->id];
+    a.module.reset(new CryptoModule(a.module->id, pickleKey, persist));
+    sendMessage(a, b);
+    sendMessage(b, a);
+    sendMessage(a, c);
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testStoreDirty error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testEncryptForManyDecryptMany {
+  try {
+    ModuleWithKeys a = initializeModuleWithKeys(110);
+    ModuleWithKeys b = initializeModuleWithKeys(111);
+    ModuleWithKeys c = initializeModuleWithKeys(112);
+    sendMessage(a, b);
+    sendMessage(a, c);
+
+    std::string message{Tools::generateRandomString(50)};
+    std::vector<EncryptedData> encryptedMessages = a.module->encryptForMany(
+        {b.module->id, c.module->id, b.module->id}, message);
+    XCTAssert(encryptedMessages.size() == 3, @"message encrypted for all");
+
+    // The message encrypted for C fails, without stopping the rest
+    std::vector<DecryptResult> decryptedByB = b.module->decryptMany(
+        {{a.module->id, encryptedMessages[0], a.keys.identityKeys},
+         {a.module->id, encryptedMessages[1], a.keys.identityKeys},
+         {a.module->id, encryptedMessages[2], a.keys.identityKeys}});
+    std::string decryptedByC = c.module->decrypt(
+        a.module->id, encryptedMessages[1], a.keys.identityKeys);
+    XCTAssert(
+        decryptedByB.size() == 3 && decryptedByB[0].error.empty() &&
+            decryptedByB[0].decryptedMessage == message &&
+            decryptedByB[2].error.empty() &&
+            decryptedByB[2].decryptedMessage == message &&
+            decryptedByC == message,
+        @"messages decrypted properly");
+    XCTAssert(
+        !decryptedByB[1].error.empty() &&
+            decryptedByB[1].decryptedMessage.empty(),
+        @"error returned for the message of another session");
+  } catch (std::runtime_error &e) {
+    comm::Logger::log(
+        "testEncryptForManyDecryptMany error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testParallelSessions {
+  try {
+    ModuleWithKeys a = initializeModuleWithKeys(120);
+    std::vector<ModuleWithKeys> peers;
+    for (size_t i = 0; i < 4; ++i) {
+      peers.push_back(initializeModuleWithKeys(121 + i));
+      sendMessage(a, peers.back());
+    }
+
+    std::vector<std::vector<EncryptedData>> encryptedMessages(peers.size());
+    std::vector<std::string> messages;
+    for (size_t i = 0; i < 20; ++i) {
+      messages.push_back(Tools::generateRandomString(50));
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < peers.size(); ++i) {
+      threads.emplace_back([&, i]() {
+        for (const std::string &message : messages) {
+          encryptedMessages[i].push_back(
+              a.module->encrypt(peers[i].module->id, message));
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    for (size_t i = 0; i < peers.size(); ++i) {
+      for (size_t j = 0; j < messages.size(); ++j) {
+        std::string decrypted = peers[i].module->decrypt(
+            a.module->id, encryptedMessages[i][j], a.keys.identityKeys);
+        XCTAssert(decrypted == messages[j], @"message decrypted properly");
+      }
+    }
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testParallelSessions error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testOneTimeKeysPool {
+  try {
+    std::shared_ptr<CryptoModule> module(new CryptoModule("130"));
+    XCTAssert(module->replenishOneTimeKeys(), @"empty pool is refilled");
+    XCTAssert(!module->replenishOneTimeKeys(), @"full pool isn't refilled");
+
+    std::string oneTimeKeys = module->getOneTimeKeys(50);
+    XCTAssert(
+        module->getPublishedOneTimeKeysCount() == 50,
+        @"keys from the pool are published");
+    Keys keys =
+        CryptoModule::keysFromStrings(module->getIdentityKeys(), oneTimeKeys);
+
+    ModuleWithKeys moduleData = {module, keys};
+    ModuleWithKeys peer = initializeModuleWithKeys(131);
+    sendMessage(peer, moduleData);
+    XCTAssert(
+        module->getPublishedOneTimeKeysCount() == 49,
+        @"key used for a session is removed");
+
+    // Olm holds up to 100 keys, making room for new ones by dropping the
+    // oldest published ones
+    module->getOneTimeKeys(50);
+    XCTAssert(
+        module->getPublishedOneTimeKeysCount() == 99,
+        @"keys generated when the pool is empty are published");
+    XCTAssert(
+        module->replenishOneTimeKeys(), @"pool is refilled with 99 published");
+    XCTAssert(
+        module->getPublishedOneTimeKeysCount() == 50,
+        @"dropped published keys aren't counted");
+    bool tooManyKeysRejected = false;
+    try {
+      module->getOneTimeKeys(101);
+    } catch (std::runtime_error &e) {
+      tooManyKeysRejected = true;
+    }
+    XCTAssert(tooManyKeysRejected, @"more keys than Olm holds are rejected");
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testOneTimeKeysPool error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
 @end
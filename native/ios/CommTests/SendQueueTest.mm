@@ -0,0 +1,74 @@
+#import "../../cpp/CommonCpp/grpc/SendQueue.h"
+#import <string>
+#import <vector>
+
+#import <XCTest/XCTest.h>
+
+using namespace comm::network;
+
+@interface SendQueueTest : XCTestCase
+
+@end
+
+@implementation SendQueueTest
+
+const size_t maxInFlightCount = 16;
+
+- (void)testUnorderedSendsOverlap {
+  SendQueue<int> queue(maxInFlightCount);
+  for (int i = 0; i < 20; ++i) {
+    queue.push(i, "");
+  }
+  std::vector<int> started = queue.pop();
+  XCTAssert(
+      started.size() == maxInFlightCount,
+      @"sends without an ordering key fill the whole window");
+  XCTAssert(started.front() == 0 && started.back() == 15, @"sends start FIFO");
+  XCTAssert(queue.pop().empty(), @"nothing starts while the window is full");
+
+  queue.onDone("");
+  std::vector<int> next = queue.pop();
+  XCTAssert(
+      next.size() == 1 && next.front() == 16,
+      @"a completed send frees a slot for the next one");
+}
+
+- (void)testSendsToOneDeviceStartOneAtATime {
+  SendQueue<int> queue(maxInFlightCount);
+  queue.push(0, "device1");
+  queue.push(1, "device1");
+  queue.push(2, "device2");
+  queue.push(3, "");
+  std::vector<int> started = queue.pop();
+  XCTAssert(
+      (started == std::vector<int>{0, 2, 3}),
+      @"sends to different devices and unordered sends overlap");
+
+  queue.onDone("device1");
+  std::vector<int> next = queue.pop();
+  XCTAssert(
+      (next == std::vector<int>{1}),
+      @"the next send to a device starts once the previous one completes");
+
+  queue.onDone("device1");
+  queue.push(4, "device1");
+  XCTAssert(
+      (queue.pop() == std::vector<int>{4}),
+      @"a device without sends in flight doesn't wait");
+  XCTAssert(queue.getInFlightCount() == 3, @"in-flight sends are counted");
+}
+
+- (void)testClear {
+  SendQueue<int> queue(1);
+  queue.push(0, "device1");
+  queue.push(1, "device1");
+  queue.push(2, "");
+  queue.pop();
+  std::vector<int> cleared = queue.clear();
+  XCTAssert(cleared.size() == 2, @"sends which weren't started are returned");
+  queue.onDone("device1");
+  XCTAssert(queue.pop().empty(), @"nothing is left after clearing");
+  XCTAssert(queue.getInFlightCount() == 0, @"started sends still complete");
+}
+
+@end
@@ -19,6 +19,24 @@ type ClientDBDraftInfo = {
   +text: string,
 };
 
+type ClientEncryptedMessage = {
+  +message: string,
+  +messageType: number,
+};
+
+type ClientIncomingEncryptedMessage = {
+  +userID: string,
+  +message: string,
+  +messageType: number,
+  +identityKeys: string,
+};
+
+// Either the decrypted message or the reason it couldn't be decrypted
+type ClientDecryptResult = {
+  +message?: string,
+  +error?: string,
+};
+
 export interface Spec extends TurboModule {
   +getDraft: (key: string) => Promise<string>;
   +updateDraft: (draft: ClientDBDraftInfo) => Promise<boolean>;
@@ -27,6 +45,19 @@ export interface Spec extends TurboModule {
   +removeAllDrafts: () => Promise<void>;
   +getAllMessages: () => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
   +getAllMessagesSync: () => $ReadOnlyArray<ClientDBMessageInfo>;
+  +getMessagesForThread: (
+    threadID: string,
+    beforeTime: string,
+    limit: number,
+  ) => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
+  +getLatestMessagesPerThread: (
+    limit: number,
+  ) => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
+  +searchMessages: (
+    query: string,
+    threadID: ?string,
+    limit: number,
+  ) => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
   +processMessageStoreOperations: (
     operations: $ReadOnlyArray<ClientDBMessageStoreOperation>,
   ) => Promise<void>;
@@ -35,6 +66,9 @@ export interface Spec extends TurboModule {
   ) => boolean;
   +getAllThreads: () => Promise<$ReadOnlyArray<ClientDBThreadInfo>>;
   +getAllThreadsSync: () => $ReadOnlyArray<ClientDBThreadInfo>;
+  +getThreadsOfMember: (
+    userID: string,
+  ) => Promise<$ReadOnlyArray<ClientDBThreadInfo>>;
   +processThreadStoreOperations: (
     operations: $ReadOnlyArray<ClientDBThreadStoreOperation>,
   ) => Promise<void>;
@@ -44,6 +78,13 @@ export interface Spec extends TurboModule {
   +initializeCryptoAccount: (userId: string) => Promise<string>;
   +getUserPublicKey: () => Promise<string>;
   +getUserOneTimeKeys: () => Promise<string>;
+  +encryptForMany: (
+    userIDs: $ReadOnlyArray<string>,
+    content: string,
+  ) => Promise<$ReadOnlyArray<ClientEncryptedMessage>>;
+  +decryptMany: (
+    messages: $ReadOnlyArray<ClientIncomingEncryptedMessage>,
+  ) => Promise<$ReadOnlyArray<ClientDecryptResult>>;
   +openSocket: (endpoint: string) => Object;
   +getCodeVersion: () => number;
   +setNotifyToken: (token: string) => Promise<void>;
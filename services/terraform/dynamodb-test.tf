@@ -154,3 +154,20 @@ resource "aws_dynamodb_table" "tunnelbroker-messages-test" {
     enabled        = true
   }
 }
+
+resource "aws_dynamodb_table" "tunnelbroker-device-presence-test" {
+  name           = "tunnelbroker-device-presence-test"
+  hash_key       = "DeviceID"
+  write_capacity = 10
+  read_capacity  = 10
+
+  attribute {
+    name = "DeviceID"
+    type = "S"
+  }
+
+  ttl {
+    attribute_name = "Expire"
+    enabled        = true
+  }
+}
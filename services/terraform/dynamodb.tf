@@ -155,6 +155,23 @@ resource "aws_dynamodb_table" "tunnelbroker-messages" {
   }
 }
 
+resource "aws_dynamodb_table" "tunnelbroker-device-presence" {
+  name           = "tunnelbroker-device-presence"
+  hash_key       = "DeviceID"
+  write_capacity = 10
+  read_capacity  = 10
+
+  attribute {
+    name = "DeviceID"
+    type = "S"
+  }
+
+  ttl {
+    attribute_name = "Expire"
+    enabled        = true
+  }
+}
+
 resource "aws_dynamodb_table" "identity-users" {
   name           = "identity-users"
   hash_key       = "userID"
@@ -25,50 +25,162 @@ void AmqpManager::init() {
   });
 }
 
+void AmqpManager::wakeUpEventLoop() {
+  // Until the event loop is up the requests wait in their queues, they are
+  // processed as soon as the channels become ready.
+  if (this->wakeUpAsyncInitialized) {
+    uv_async_send(&this->wakeUpAsyncHandle);
+  }
+}
+
+void AmqpManager::openPublishChannels(AMQP::TcpConnection &tcpConnection) {
+  for (size_t i = 0; i < AMQP_PUBLISH_CHANNELS_COUNT; ++i) {
+    std::unique_ptr<AmqpPublishChannel> publishChannel =
+        std::make_unique<AmqpPublishChannel>();
+    publishChannel->channel =
+        std::make_unique<AMQP::TcpChannel>(&tcpConnection);
+    AmqpPublishChannel *publishChannelPtr = publishChannel.get();
+    publishChannel->channel->onError(
+        [publishChannelPtr](const char *message) {
+          LOG(ERROR) << "AMQP: publish channel error: " << message;
+          publishChannelPtr->ready = false;
+          failPendingConfirms(*publishChannelPtr);
+        });
+    publishChannel->channel->confirmSelect()
+        .onSuccess([this, publishChannelPtr]() {
+          publishChannelPtr->ready = true;
+          this->publishQueuedMessages();
+        })
+        .onAck([publishChannelPtr](uint64_t deliveryTag, bool multiple) {
+          resolvePendingConfirms(
+              *publishChannelPtr, deliveryTag, multiple, true);
+        })
+        .onNack([publishChannelPtr](
+                    uint64_t deliveryTag, bool multiple, bool requeue) {
+          resolvePendingConfirms(
+              *publishChannelPtr, deliveryTag, multiple, false);
+        });
+    this->publishChannels.push_back(std::move(publishChannel));
+  }
+}
+
+void AmqpManager::resolvePendingConfirms(
+    AmqpPublishChannel &publishChannel,
+    uint64_t deliveryTag,
+    bool multiple,
+    bool confirmed) {
+  // With `multiple` set the broker confirms all the messages up to and
+  // including `deliveryTag` at once.
+  auto first = multiple ? publishChannel.pendingConfirms.begin()
+                        : publishChannel.pendingConfirms.find(deliveryTag);
+  auto last = publishChannel.pendingConfirms.upper_bound(deliveryTag);
+  if (first == publishChannel.pendingConfirms.end()) {
+    return;
+  }
+  for (auto it = first; it != last; ++it) {
+    it->second->set_value(confirmed);
+  }
+  publishChannel.pendingConfirms.erase(first, last);
+}
+
+void AmqpManager::failPendingConfirms(AmqpPublishChannel &publishChannel) {
+  for (auto &pendingConfirm : publishChannel.pendingConfirms) {
+    pendingConfirm.second->set_value(false);
+  }
+  publishChannel.pendingConfirms.clear();
+}
+
+AmqpPublishChannel *AmqpManager::getNextPublishChannel() {
+  const size_t channelsCount = this->publishChannels.size();
+  for (size_t i = 0; i < channelsCount; ++i) {
+    const size_t index = (this->nextPublishChannelIndex + i) % channelsCount;
+    if (this->publishChannels[index]->ready) {
+      this->nextPublishChannelIndex = (index + 1) % channelsCount;
+      return this->publishChannels[index].get();
+    }
+  }
+  return nullptr;
+}
+
+void AmqpManager::publishQueuedMessages() {
+  AmqpPublishChannel *publishChannel;
+  AmqpPublishRequest request;
+  while ((publishChannel = this->getNextPublishChannel()) != nullptr &&
+         this->publishQueue.try_dequeue(request)) {
+    if (std::chrono::steady_clock::now() > request.deadline) {
+      // The sender has already given up waiting for this message
+      request.confirmPromise->set_value(false);
+      continue;
+    }
+    AMQP::Envelope env(request.payload.data(), request.payload.size());
+    // Set delivery mode to: Durable (2)
+    env.setDeliveryMode(2);
+    env.setHeaders(std::move(request.headers));
+    if (!publishChannel->channel->publish(
+            this->directExchangeName, request.routingKey, env)) {
+      request.confirmPromise->set_value(false);
+      continue;
+    }
+    // In the confirms mode the broker numbers the messages published on a
+    // channel sequentially starting from 1.
+    publishChannel->pendingConfirms.emplace(
+        ++publishChannel->lastPublishTag, std::move(request.confirmPromise));
+  }
+}
+
 void AmqpManager::connectInternal() {
   const std::string amqpUri = config::ConfigManager::getInstance().getParameter(
       config::ConfigManager::OPTION_AMQP_URI);
   const std::string tunnelbrokerID =
       config::ConfigManager::getInstance().getParameter(
           config::ConfigManager::OPTION_TUNNELBROKER_ID);
-  const std::string fanoutExchangeName =
+  const std::string directExchangeName =
       config::ConfigManager::getInstance().getParameter(
-          config::ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE);
+          config::ConfigManager::OPTION_AMQP_DIRECT_EXCHANGE);
+  this->directExchangeName = directExchangeName;
   LOG(INFO) << "AMQP: Connecting to " << amqpUri;
   uv_loop_t *localUvLoop = uv_default_loop();
   AMQP::LibUvHandler uvHandler(localUvLoop);
   AMQP::TcpConnection tcpConnection(&uvHandler, AMQP::Address(amqpUri));
   this->amqpChannel = std::make_unique<AMQP::TcpChannel>(&tcpConnection);
-  this->amqpChannel->onReady([this]() {
-    LOG(INFO) << "AMQP: Channel is ready";
-    this->amqpReady = true;
-  });
-  this->amqpChannel->onError([this](const char *message) {
+  const uint64_t channelGeneration = ++this->channelGeneration;
+  this->amqpChannel->onReady([]() { LOG(INFO) << "AMQP: Channel is ready"; });
+  this->amqpChannel->onError([](const char *message) {
     LOG(ERROR) << "AMQP: channel error: " << message
                << ", will try to reconnect";
-    this->amqpReady = false;
   });
+  this->openPublishChannels(tcpConnection);
 
   AMQP::Table arguments;
   arguments["x-message-ttl"] = (uint64_t)AMQP_MESSAGE_TTL;
   arguments["x-expires"] = (uint64_t)AMQP_QUEUE_TTL;
-  this->amqpChannel->declareExchange(fanoutExchangeName, AMQP::fanout);
+  this->amqpChannel->declareExchange(directExchangeName, AMQP::direct);
+  // Limits the number of unacked messages, so the broker doesn't flood an
+  // instance which can't keep up with delivering them.
+  this->amqpChannel->setQos(std::stoul(
+      config::ConfigManager::getInstance().getParameter(
+          config::ConfigManager::OPTION_AMQP_PREFETCH_COUNT)));
   this->amqpChannel->declareQueue(tunnelbrokerID, AMQP::durable, arguments)
-      .onSuccess([this, tunnelbrokerID, fanoutExchangeName](
+      .onSuccess([this, tunnelbrokerID, directExchangeName, channelGeneration](
                      const std::string &name,
                      uint32_t messagecount,
                      uint32_t consumercount) {
         LOG(INFO) << "AMQP: Queue " << name << " created";
-        this->amqpChannel->bindQueue(fanoutExchangeName, tunnelbrokerID, "")
-            .onError([this, tunnelbrokerID, fanoutExchangeName](
+        // Only messages for the devices connected to this instance are
+        // routed to its queue.
+        this->amqpChannel
+            ->bindQueue(directExchangeName, tunnelbrokerID, tunnelbrokerID)
+            .onError([this, tunnelbrokerID, directExchangeName](
                          const char *message) {
               LOG(ERROR) << "AMQP: Failed to bind queue:  " << tunnelbrokerID
-                         << " to exchange: " << fanoutExchangeName;
+                         << " to exchange: " << directExchangeName;
             });
         this->amqpChannel->consume(tunnelbrokerID)
-            .onReceived([](const AMQP::Message &message,
-                           uint64_t deliveryTag,
-                           bool redelivered) {
+            .onReceived([this, channelGeneration](
+                            const AMQP::Message &message,
+                            uint64_t deliveryTag,
+                            bool redelivered) {
+              this->unackedDeliveryTags.insert(deliveryTag);
               try {
                 AMQP::Table headers = message.headers();
                 const std::string payload(message.body(), message.bodySize());
@@ -76,10 +188,23 @@ void AmqpManager::connectInternal() {
                 const std::string toDeviceID(headers[AMQP_HEADER_TO_DEVICEID]);
                 const std::string fromDeviceID(
                     headers[AMQP_HEADER_FROM_DEVICEID]);
-                DeliveryBroker::getInstance().push(
-                    messageID, deliveryTag, toDeviceID, fromDeviceID, payload);
+                if (!DeliveryBroker::getInstance().push(
+                        messageID,
+                        deliveryTag,
+                        channelGeneration,
+                        toDeviceID,
+                        fromDeviceID,
+                        payload)) {
+                  // The message is not kept in memory, it stays in the
+                  // database and will be delivered from there, so we don't
+                  // hold it in the AMQP queue either.
+                  this->processedDeliveryTags.insert(deliveryTag);
+                }
               } catch (const std::exception &e) {
                 LOG(ERROR) << "AMQP: Message parsing exception: " << e.what();
+                // It can't be delivered, but it must not hold a prefetch slot
+                // or block the acks of the messages after it
+                this->processedDeliveryTags.insert(deliveryTag);
               }
             })
             .onError([](const char *message) {
@@ -91,67 +216,146 @@ void AmqpManager::connectInternal() {
             "AMQP: Queue creation error: " + std::string(message));
       });
   uv_run(localUvLoop, UV_RUN_DEFAULT);
+
+  // The connection is gone, channels must not outlive it. Unacked messages
+  // are redelivered by the broker on the next channel, whose delivery tags
+  // start from 1 again.
+  for (auto &publishChannel : this->publishChannels) {
+    failPendingConfirms(*publishChannel);
+  }
+  this->publishChannels.clear();
+  this->amqpChannel.reset();
+  this->unackedDeliveryTags.clear();
+  this->processedDeliveryTags.clear();
 };
 
 void AmqpManager::connect() {
+  // The handles are unreferenced, so they don't keep `uv_run` running after
+  // the connection is closed.
+  uv_async_init(
+      uv_default_loop(), &this->wakeUpAsyncHandle, [](uv_async_t *handle) {
+        AmqpManager *amqpManager = static_cast<AmqpManager *>(handle->data);
+        amqpManager->publishQueuedMessages();
+        amqpManager->collectQueuedAcks();
+      });
+  this->wakeUpAsyncHandle.data = this;
+  uv_unref(reinterpret_cast<uv_handle_t *>(&this->wakeUpAsyncHandle));
+  uv_timer_init(uv_default_loop(), &this->ackFlushTimer);
+  this->ackFlushTimer.data = this;
+  uv_timer_start(
+      &this->ackFlushTimer,
+      [](uv_timer_t *handle) {
+        AmqpManager *amqpManager = static_cast<AmqpManager *>(handle->data);
+        amqpManager->collectQueuedAcks();
+        amqpManager->flushAcks();
+      },
+      AMQP_ACK_FLUSH_INTERVAL,
+      AMQP_ACK_FLUSH_INTERVAL);
+  uv_unref(reinterpret_cast<uv_handle_t *>(&this->ackFlushTimer));
+  this->wakeUpAsyncInitialized = true;
   while (true) {
     int64_t currentTimestamp = tools::getCurrentTimestamp();
     if (this->lastConnectionTimestamp &&
         currentTimestamp - this->lastConnectionTimestamp <
             AMQP_SHORTEST_RECONNECTION_ATTEMPT_INTERVAL) {
-      throw std::runtime_error(
-          "AMQP reconnection attempt interval too short, tried to reconnect "
-          "after " +
-          std::to_string(currentTimestamp - this->lastConnectionTimestamp) +
-          "ms, the shortest allowed interval is " +
-          std::to_string(AMQP_SHORTEST_RECONNECTION_ATTEMPT_INTERVAL) + "ms");
+      const int64_t reconnectionDelay =
+          AMQP_SHORTEST_RECONNECTION_ATTEMPT_INTERVAL -
+          (currentTimestamp - this->lastConnectionTimestamp);
+      LOG(WARNING) << "AMQP: Reconnecting in " << reconnectionDelay << "ms";
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(reconnectionDelay));
+      currentTimestamp = tools::getCurrentTimestamp();
     }
     this->lastConnectionTimestamp = currentTimestamp;
     this->connectInternal();
   }
 }
 
-bool AmqpManager::send(const database::MessageItem *message) {
-  waitUntilReady();
+bool AmqpManager::send(
+    const database::MessageItem *message,
+    const std::string &tunnelbrokerID) {
   try {
-    const std::string messagePayload = message->getPayload();
-    AMQP::Envelope env(messagePayload.c_str(), messagePayload.size());
-    AMQP::Table headers;
-    headers[AMQP_HEADER_MESSAGEID] = message->getMessageID();
-    headers[AMQP_HEADER_FROM_DEVICEID] = message->getFromDeviceID();
-    headers[AMQP_HEADER_TO_DEVICEID] = message->getToDeviceID();
-    // Set delivery mode to: Durable (2)
-    env.setDeliveryMode(2);
-    env.setHeaders(std::move(headers));
-
-    std::scoped_lock lock{this->channelMutex};
-    this->amqpChannel->publish(
-        config::ConfigManager::getInstance().getParameter(
-            config::ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE),
-        "",
-        env);
+    AmqpPublishRequest request;
+    request.payload = message->getPayload();
+    request.routingKey = tunnelbrokerID;
+    request.headers[AMQP_HEADER_MESSAGEID] = message->getMessageID();
+    request.headers[AMQP_HEADER_FROM_DEVICEID] = message->getFromDeviceID();
+    request.headers[AMQP_HEADER_TO_DEVICEID] = message->getToDeviceID();
+    request.deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(AMQP_PUBLISH_CONFIRM_TIMEOUT);
+    request.confirmPromise = std::make_shared<std::promise<bool>>();
+    const std::chrono::steady_clock::time_point deadline = request.deadline;
+    std::future<bool> confirmFuture = request.confirmPromise->get_future();
+
+    this->publishQueue.enqueue(std::move(request));
+    this->wakeUpEventLoop();
+    if (confirmFuture.wait_until(deadline) != std::future_status::ready) {
+      LOG(ERROR) << "AMQP: Message " << message->getMessageID()
+                 << " was not confirmed in time";
+      return false;
+    }
+    return confirmFuture.get();
   } catch (std::runtime_error &e) {
     LOG(ERROR) << "AMQP: Error while publishing message:  " << e.what();
     return false;
   }
-  return true;
 };
 
-void AmqpManager::ack(uint64_t deliveryTag) {
-  waitUntilReady();
-  std::scoped_lock lock{this->channelMutex};
-  this->amqpChannel->ack(deliveryTag);
+void AmqpManager::ack(uint64_t deliveryTag, uint64_t channelGeneration) {
+  this->ackQueue.enqueue(AmqpDeliveryAck{
+      .channelGeneration = channelGeneration, .deliveryTag = deliveryTag});
+  // Smaller batches are flushed by the timer
+  if (++this->queuedAcksCount >= AMQP_ACK_BATCH_SIZE) {
+    this->wakeUpEventLoop();
+  }
+}
+
+void AmqpManager::collectQueuedAcks() {
+  AmqpDeliveryAck deliveryAck;
+  while (this->ackQueue.try_dequeue(deliveryAck)) {
+    this->queuedAcksCount--;
+    // A tag received on an older channel may collide with a tag of a
+    // different message on the current one, so it's dropped by generation.
+    if (deliveryAck.channelGeneration == this->channelGeneration &&
+        this->unackedDeliveryTags.count(deliveryAck.deliveryTag)) {
+      this->processedDeliveryTags.insert(deliveryAck.deliveryTag);
+    }
+  }
+  if (this->processedDeliveryTags.size() >= AMQP_ACK_BATCH_SIZE) {
+    this->flushAcks();
+  }
 }
 
-void AmqpManager::waitUntilReady() {
-  if (this->amqpReady) {
+void AmqpManager::flushAcks() {
+  if (this->amqpChannel == nullptr || this->processedDeliveryTags.empty()) {
     return;
   }
-  while (!this->amqpReady) {
-    LOG(INFO) << "AMQP: Connection is not ready, waiting";
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(AMQP_SHORTEST_RECONNECTION_ATTEMPT_INTERVAL));
+  // The oldest unacked messages which are all processed are acked with a
+  // single `multiple` ack.
+  auto unackedIterator = this->unackedDeliveryTags.begin();
+  auto processedIterator = this->processedDeliveryTags.begin();
+  uint64_t lastConsecutiveTag = 0;
+  while (unackedIterator != this->unackedDeliveryTags.end() &&
+         processedIterator != this->processedDeliveryTags.end() &&
+         *unackedIterator == *processedIterator) {
+    lastConsecutiveTag = *unackedIterator;
+    ++unackedIterator;
+    ++processedIterator;
+  }
+  if (lastConsecutiveTag) {
+    this->amqpChannel->ack(lastConsecutiveTag, AMQP::multiple);
+    this->unackedDeliveryTags.erase(
+        this->unackedDeliveryTags.begin(), unackedIterator);
+    this->processedDeliveryTags.erase(
+        this->processedDeliveryTags.begin(), processedIterator);
+  }
+  // The rest is behind a message which is still being delivered, so it has
+  // to be acked one by one.
+  for (const uint64_t deliveryTag : this->processedDeliveryTags) {
+    this->amqpChannel->ack(deliveryTag);
+    this->unackedDeliveryTags.erase(deliveryTag);
   }
+  this->processedDeliveryTags.clear();
 }
 
 } // namespace network
@@ -4,32 +4,108 @@
 
 #include <amqpcpp.h>
 #include <amqpcpp/libuv.h>
+#include <folly/concurrency/UnboundedQueue.h>
+#include <uv.h>
 
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace comm {
 namespace network {
 
+// Message waiting to be published on the event loop thread. The promise is
+// resolved when the broker confirms (or rejects) the message.
+struct AmqpPublishRequest {
+  std::string payload;
+  std::string routingKey;
+  AMQP::Table headers;
+  std::chrono::steady_clock::time_point deadline;
+  std::shared_ptr<std::promise<bool>> confirmPromise;
+};
+
+// Channel in the publisher confirms mode. It's accessed from the event loop
+// thread only.
+struct AmqpPublishChannel {
+  std::unique_ptr<AMQP::TcpChannel> channel;
+  bool ready = false;
+  uint64_t lastPublishTag = 0;
+  std::map<uint64_t, std::shared_ptr<std::promise<bool>>> pendingConfirms;
+};
+
+// Delivery tags are numbered from 1 on every channel, so a tag is only
+// meaningful together with the generation of the consumer channel it was
+// received on.
+struct AmqpDeliveryAck {
+  uint64_t channelGeneration;
+  uint64_t deliveryTag;
+};
+
 class AmqpManager {
   AmqpManager(){};
 
-  std::mutex channelMutex;
   std::once_flag initOnceFlag;
+  // Consumer channel and its generation, increased on every reconnection.
+  // Accessed from the event loop thread only.
   std::unique_ptr<AMQP::TcpChannel> amqpChannel;
-  std::atomic<bool> amqpReady;
+  uint64_t channelGeneration = 0;
   std::atomic<int64_t> lastConnectionTimestamp;
+  // Wakes up the event loop when there are messages to publish or acks to
+  // send, `uv_async_send` is the only libuv call safe from other threads.
+  uv_async_t wakeUpAsyncHandle;
+  std::atomic<bool> wakeUpAsyncInitialized{false};
+
+  // Publishing
+  folly::UMPSCQueue<AmqpPublishRequest, false> publishQueue;
+  std::vector<std::unique_ptr<AmqpPublishChannel>> publishChannels;
+  size_t nextPublishChannelIndex = 0;
+  std::string directExchangeName;
+
+  // Acknowledgements
+  folly::UMPSCQueue<AmqpDeliveryAck, false> ackQueue;
+  std::atomic<size_t> queuedAcksCount{0};
+  uv_timer_t ackFlushTimer;
+  // Delivery tags received on the consumer channel and not acked yet, and
+  // the subset of them which were already processed. Loop thread only.
+  std::set<uint64_t> unackedDeliveryTags;
+  std::set<uint64_t> processedDeliveryTags;
+
   void connectInternal();
   void connect();
-  void waitUntilReady();
+  void wakeUpEventLoop();
+  void openPublishChannels(AMQP::TcpConnection &tcpConnection);
+  AmqpPublishChannel *getNextPublishChannel();
+  void publishQueuedMessages();
+  void collectQueuedAcks();
+  void flushAcks();
+  static void resolvePendingConfirms(
+      AmqpPublishChannel &publishChannel,
+      uint64_t deliveryTag,
+      bool multiple,
+      bool confirmed);
+  static void failPendingConfirms(AmqpPublishChannel &publishChannel);
 
 public:
   static AmqpManager &getInstance();
   void init();
-  bool send(const database::MessageItem *message);
-  void ack(uint64_t deliveryTag);
+  // Publishes the message to the queue of the `tunnelbrokerID` instance and
+  // waits (up to `AMQP_PUBLISH_CONFIRM_TIMEOUT`) until the broker confirms
+  // it. Safe to call concurrently from many threads, the publishing itself
+  // happens on the event loop thread.
+  bool send(
+      const database::MessageItem *message,
+      const std::string &tunnelbrokerID);
+  // Marks the message as processed. Acks are sent from the event loop thread
+  // in batches, using a single `multiple` ack for consecutive delivery tags.
+  // Acks for messages received on an older channel are ignored, the broker
+  // has already requeued them.
+  void ack(uint64_t deliveryTag, uint64_t channelGeneration);
 
   AmqpManager(AmqpManager const &) = delete;
   void operator=(AmqpManager const &) = delete;
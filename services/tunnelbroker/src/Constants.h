@@ -7,6 +7,11 @@
 namespace comm {
 namespace network {
 
+// gRPC
+// Native clients ping every 30 seconds to keep the connection alive, also
+// when there are no calls. Pings coming more often than this are rejected.
+const size_t GRPC_KEEPALIVE_MIN_PING_INTERVAL = 10 * 1000; // 10 sec
+
 // AWS DynamoDB
 const size_t DYNAMODB_MAX_BATCH_ITEMS = 25;
 const size_t DYNAMODB_BACKOFF_FIRST_RETRY_DELAY = 50;
@@ -17,6 +22,7 @@ const std::string DEVICE_SESSIONS_VERIFICATION_MESSAGES_TABLE_NAME =
     "tunnelbroker-verification-messages";
 const std::string DEVICE_PUBLIC_KEY_TABLE_NAME = "tunnelbroker-public-keys";
 const std::string MESSAGES_TABLE_NAME = "tunnelbroker-messages";
+const std::string DEVICE_PRESENCE_TABLE_NAME = "tunnelbroker-device-presence";
 
 // Sessions
 const size_t SIGNATURE_REQUEST_LENGTH = 64;
@@ -25,9 +31,23 @@ const size_t SESSION_RECORD_TTL = 30 * 24 * 3600; // 30 days
 const size_t SESSION_SIGN_RECORD_TTL = 24 * 3600; // 24 hours
 const std::regex SESSION_ID_FORMAT_REGEX(
     "[0-9a-f]{8}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{4}-[0-9a-f]{12}");
+// Number of parsed device public keys kept in memory for signature
+// verification
+const size_t CRYPTO_PUBLIC_KEYS_CACHE_SIZE = 10000;
+
+// Device presence
+// The record is refreshed on every `Get` stream start and removed when the
+// stream ends, TTL only cleans up records left by crashed instances
+const size_t DEVICE_PRESENCE_RECORD_TTL = 24 * 3600; // 24 hours
+// Presence lookups for sending are cached for a short time only, a device
+// reconnecting to another instance is routed there after at most this delay
+const size_t DEVICE_PRESENCE_CACHE_TTL = 1000; // 1 sec
+const size_t DEVICE_PRESENCE_CACHE_SIZE = 10000;
 
 // AMQP (RabbitMQ)
-const std::string AMQP_FANOUT_EXCHANGE_NAME = "allBrokers";
+// Direct exchange, each tunnelbroker instance queue is bound with its
+// instance ID as a routing key
+const std::string AMQP_DIRECT_EXCHANGE_NAME = "tunnelbrokers";
 // Message broker queue message TTL
 const size_t AMQP_MESSAGE_TTL = 300 * 1000; // 5 min
 // queue TTL in case of no consumers (tunnelbroker is down)
@@ -38,6 +58,16 @@ const std::string AMQP_HEADER_TO_DEVICEID = "toDeviceID";
 const std::string AMQP_HEADER_MESSAGEID = "messageID";
 
 const int64_t AMQP_SHORTEST_RECONNECTION_ATTEMPT_INTERVAL = 1000 * 60; // 1 min
+// Maximum number of unacknowledged messages the broker sends to an instance
+const size_t AMQP_DEFAULT_PREFETCH_COUNT = 1000;
+// Processed messages are acknowledged in batches of this size or after the
+// flush interval, whichever comes first
+const size_t AMQP_ACK_BATCH_SIZE = 100;
+const size_t AMQP_ACK_FLUSH_INTERVAL = 100; // 100 ms
+// Channels used for publishing in the publisher confirms mode
+const size_t AMQP_PUBLISH_CHANNELS_COUNT = 4;
+// Maximum time to wait for the broker to confirm a published message
+const size_t AMQP_PUBLISH_CONFIRM_TIMEOUT = 10 * 1000; // 10 sec
 
 // DeviceID
 // DEVICEID_CHAR_LENGTH has to be kept in sync with deviceIDCharLength
@@ -55,6 +85,15 @@ const std::string DEV_CONFIG_FILE_PATH =
 
 // DeliveryBroker
 const size_t DELIVERY_BROKER_MAX_QUEUE_SIZE = 100;
+// Global limit for messages kept in memory across all device queues
+const size_t DELIVERY_BROKER_MAX_MEMORY_USAGE = 256 * 1024 * 1024; // 256 MB
+// Interval after which a waiting reader re-checks that its queue is alive
+const size_t DELIVERY_BROKER_POP_POLL_INTERVAL = 1000; // 1 sec
+// Messages delivered from the database are remembered until their copy
+// routed through AMQP can't arrive anymore: it's published within the confirm
+// timeout and expires in the queue after the message TTL
+const size_t DELIVERED_MESSAGE_IDS_RETENTION =
+    AMQP_PUBLISH_CONFIRM_TIMEOUT + AMQP_MESSAGE_TTL;
 // Database messages TTL
 const size_t MESSAGE_RECORD_TTL = 300 * 24 * 60 * 60; // 300 days
 
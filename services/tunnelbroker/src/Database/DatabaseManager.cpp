@@ -265,6 +265,57 @@ void DatabaseManager::removeMessageItemsByIDsForDeviceID(
       writeRequests);
 }
 
+void DatabaseManager::putDevicePresenceItem(const DevicePresenceItem &item) {
+  Aws::DynamoDB::Model::PutItemRequest request;
+  request.SetTableName(item.getTableName());
+  request.AddItem(
+      DevicePresenceItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(item.getDeviceID()));
+  request.AddItem(
+      DevicePresenceItem::FIELD_INSTANCE_ID,
+      Aws::DynamoDB::Model::AttributeValue(item.getInstanceID()));
+  request.AddItem(
+      DevicePresenceItem::FIELD_SUBSCRIPTION_ID,
+      Aws::DynamoDB::Model::AttributeValue(item.getSubscriptionID()));
+  request.AddItem(
+      DevicePresenceItem::FIELD_EXPIRE,
+      Aws::DynamoDB::Model::AttributeValue(std::to_string(
+          static_cast<size_t>(std::time(0)) + DEVICE_PRESENCE_RECORD_TTL)));
+  this->innerPutItem(std::make_shared<DevicePresenceItem>(item), request);
+}
+
+std::shared_ptr<DevicePresenceItem>
+DatabaseManager::findDevicePresenceItem(const std::string &deviceID) {
+  Aws::DynamoDB::Model::GetItemRequest request;
+  request.AddKey(
+      DevicePresenceItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(deviceID));
+  return std::move(this->innerFindItem<DevicePresenceItem>(request));
+}
+
+void DatabaseManager::removeDevicePresenceItem(
+    const std::string &deviceID,
+    const std::string &subscriptionID) {
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(DevicePresenceItem().getTableName());
+  request.AddKey(
+      DevicePresenceItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(deviceID));
+  request.SetConditionExpression(
+      DevicePresenceItem::FIELD_SUBSCRIPTION_ID + " = :subscriptionID");
+  AttributeValues attributeValues;
+  attributeValues.emplace(":subscriptionID", subscriptionID);
+  request.SetExpressionAttributeValues(attributeValues);
+
+  const Aws::DynamoDB::Model::DeleteItemOutcome &outcome =
+      getDynamoDBClient()->DeleteItem(request);
+  if (!outcome.IsSuccess() &&
+      outcome.GetError().GetErrorType() !=
+          Aws::DynamoDB::DynamoDBErrors::CONDITIONAL_CHECK_FAILED) {
+    throw std::runtime_error(outcome.GetError().GetMessage());
+  }
+}
+
 } // namespace database
 } // namespace network
 } // namespace comm
@@ -4,6 +4,7 @@
 #include "Constants.h"
 #include "DatabaseEntitiesTools.h"
 #include "DatabaseManagerBase.h"
+#include "DevicePresenceItem.h"
 #include "DeviceSessionItem.h"
 #include "MessageItem.h"
 #include "PublicKeyItem.h"
@@ -12,6 +13,7 @@
 
 #include <aws/core/Aws.h>
 #include <aws/core/utils/Outcome.h>
+#include <aws/dynamodb/DynamoDBErrors.h>
 #include <aws/dynamodb/model/AttributeDefinition.h>
 #include <aws/dynamodb/model/DeleteItemRequest.h>
 #include <aws/dynamodb/model/DescribeTableRequest.h>
@@ -62,6 +64,16 @@ public:
   void removeMessageItemsByIDsForDeviceID(
       std::vector<std::string> &messageIDs,
       const std::string &toDeviceID);
+
+  void putDevicePresenceItem(const DevicePresenceItem &item);
+  std::shared_ptr<DevicePresenceItem>
+  findDevicePresenceItem(const std::string &deviceID);
+  // Removes the item only if it was put for `subscriptionID`, so a closed
+  // stream doesn't remove the presence registered by a newer stream, on
+  // another instance or on the same one.
+  void removeDevicePresenceItem(
+      const std::string &deviceID,
+      const std::string &subscriptionID);
 };
 
 } // namespace database
@@ -0,0 +1,83 @@
+#include "DevicePresenceItem.h"
+#include "ConfigManager.h"
+#include "Tools.h"
+
+namespace comm {
+namespace network {
+namespace database {
+
+const std::string DevicePresenceItem::FIELD_DEVICE_ID = "DeviceID";
+const std::string DevicePresenceItem::FIELD_INSTANCE_ID = "InstanceID";
+const std::string DevicePresenceItem::FIELD_SUBSCRIPTION_ID =
+    "SubscriptionID";
+const std::string DevicePresenceItem::FIELD_EXPIRE = "Expire";
+
+DevicePresenceItem::DevicePresenceItem(
+    const std::string deviceID,
+    const std::string instanceID,
+    const std::string subscriptionID)
+    : deviceID(deviceID),
+      instanceID(instanceID),
+      subscriptionID(subscriptionID) {
+  this->validate();
+}
+
+DevicePresenceItem::DevicePresenceItem(const AttributeValues &itemFromDB) {
+  this->assignItemFromDatabase(itemFromDB);
+}
+
+void DevicePresenceItem::validate() const {
+  if (!tools::validateDeviceID(this->deviceID)) {
+    throw std::runtime_error("Error: DeviceID format is wrong.");
+  }
+  tools::checkIfNotEmpty("instanceID", this->instanceID);
+}
+
+void DevicePresenceItem::assignItemFromDatabase(
+    const AttributeValues &itemFromDB) {
+  try {
+    this->deviceID = itemFromDB.at(DevicePresenceItem::FIELD_DEVICE_ID).GetS();
+    this->instanceID =
+        itemFromDB.at(DevicePresenceItem::FIELD_INSTANCE_ID).GetS();
+    // Items put before subscription IDs were introduced don't have one,
+    // they can only expire
+    auto subscriptionIDIt =
+        itemFromDB.find(DevicePresenceItem::FIELD_SUBSCRIPTION_ID);
+    if (subscriptionIDIt != itemFromDB.end()) {
+      this->subscriptionID = subscriptionIDIt->second.GetS();
+    }
+  } catch (const std::exception &e) {
+    throw std::runtime_error(
+        "Got an exception at DevicePresenceItem: " + std::string(e.what()));
+  }
+  this->validate();
+}
+
+std::string DevicePresenceItem::getTableName() const {
+  return config::ConfigManager::getInstance().getParameter(
+      config::ConfigManager::OPTION_DYNAMODB_DEVICE_PRESENCE_TABLE);
+}
+
+PrimaryKeyDescriptor DevicePresenceItem::getPrimaryKeyDescriptor() const {
+  return PrimaryKeyDescriptor(DevicePresenceItem::FIELD_DEVICE_ID);
+}
+
+PrimaryKeyValue DevicePresenceItem::getPrimaryKeyValue() const {
+  return PrimaryKeyValue(this->deviceID);
+}
+
+std::string DevicePresenceItem::getDeviceID() const {
+  return this->deviceID;
+}
+
+std::string DevicePresenceItem::getInstanceID() const {
+  return this->instanceID;
+}
+
+std::string DevicePresenceItem::getSubscriptionID() const {
+  return this->subscriptionID;
+}
+
+} // namespace database
+} // namespace network
+} // namespace comm
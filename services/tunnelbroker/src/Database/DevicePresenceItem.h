@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Item.h"
+
+#include <string>
+
+namespace comm {
+namespace network {
+namespace database {
+
+// Maps a device to the tunnelbroker instance which holds its `Get` stream, so
+// messages can be routed to that instance only. The subscription ID tells
+// apart the streams of the device which came and went on the same instance.
+class DevicePresenceItem : public Item {
+  std::string deviceID;
+  std::string instanceID;
+  std::string subscriptionID;
+
+  void validate() const override;
+
+public:
+  static const std::string FIELD_DEVICE_ID;
+  static const std::string FIELD_INSTANCE_ID;
+  static const std::string FIELD_SUBSCRIPTION_ID;
+  static const std::string FIELD_EXPIRE;
+
+  PrimaryKeyDescriptor getPrimaryKeyDescriptor() const override;
+  PrimaryKeyValue getPrimaryKeyValue() const override;
+  std::string getTableName() const override;
+  std::string getDeviceID() const;
+  std::string getInstanceID() const;
+  std::string getSubscriptionID() const;
+
+  DevicePresenceItem() {
+  }
+  DevicePresenceItem(
+      const std::string deviceID,
+      const std::string instanceID,
+      const std::string subscriptionID);
+  DevicePresenceItem(const AttributeValues &itemFromDB);
+  void assignItemFromDatabase(const AttributeValues &itemFromDB) override;
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -1,7 +1,12 @@
 #include "DeliveryBroker.h"
+#include "AmqpManager.h"
+#include "GlobalTools.h"
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <thread>
+
 namespace comm {
 namespace network {
 
@@ -10,50 +15,173 @@ DeliveryBroker &DeliveryBroker::getInstance() {
   return instance;
 };
 
-void DeliveryBroker::push(
-    const std::string messageID,
+size_t
+DeliveryBroker::getMessageMemorySize(const DeliveryBrokerMessage &message) {
+  return sizeof(DeliveryBrokerMessage) + message.messageID.size() +
+      message.fromDeviceID.size() + message.payload.size();
+};
+
+std::shared_ptr<DeliveryBrokerDeviceQueue>
+DeliveryBroker::findQueue(const std::string &deviceID) {
+  auto iterator = this->messagesMap.find(deviceID);
+  if (iterator == this->messagesMap.end()) {
+    return nullptr;
+  }
+  return iterator->second;
+};
+
+std::shared_ptr<DeliveryBrokerDeviceQueue>
+DeliveryBroker::getOrCreateQueue(const std::string &deviceID) {
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue != nullptr) {
+    return deviceQueue;
+  }
+  // `insert` doesn't overwrite an existing queue, in case of a concurrent
+  // insert it returns the iterator to the queue which won.
+  return this->messagesMap
+      .insert(
+          deviceID,
+          std::make_shared<DeliveryBrokerDeviceQueue>(
+              DELIVERY_BROKER_MAX_QUEUE_SIZE, tools::generateUUID()))
+      .first->second;
+};
+
+void DeliveryBroker::releaseMessageMemory(
+    const DeliveryBrokerMessage &message) {
+  this->memoryUsage -= getMessageMemorySize(message);
+};
+
+void DeliveryBroker::drainQueue(DeliveryBrokerDeviceQueue &deviceQueue) {
+  // Dropped messages are still stored in the database, but they have to be
+  // acked, otherwise they count against the AMQP prefetch limit forever.
+  DeliveryBrokerMessage message;
+  while (deviceQueue.queue.read(message)) {
+    this->releaseMessageMemory(message);
+    AmqpManager::getInstance().ack(
+        message.deliveryTag, message.channelGeneration);
+  }
+};
+
+std::string DeliveryBroker::subscribe(const std::string &deviceID) {
+  std::scoped_lock lock{this->subscriptionMutex};
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->getOrCreateQueue(deviceID);
+  deviceQueue->subscribersCount++;
+  return deviceQueue->subscriptionID;
+};
+
+bool DeliveryBroker::unsubscribe(const std::string &deviceID) {
+  std::scoped_lock lock{this->subscriptionMutex};
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue == nullptr || deviceQueue->subscribersCount == 0) {
+    return false;
+  }
+  if (--deviceQueue->subscribersCount > 0) {
+    return false;
+  }
+  // Messages left in the queue are still stored in the database and will be
+  // delivered on the next connection of the device.
+  this->messagesMap.erase_if_equal(deviceID, deviceQueue);
+  deviceQueue->closed = true;
+  this->drainQueue(*deviceQueue);
+  return true;
+};
+
+bool DeliveryBroker::push(
+    const std::string &messageID,
     const uint64_t deliveryTag,
-    const std::string toDeviceID,
-    const std::string fromDeviceID,
-    const std::string payload) {
+    const uint64_t channelGeneration,
+    const std::string &toDeviceID,
+    const std::string &fromDeviceID,
+    const std::string &payload) {
   try {
-    if (this->messagesMap.find(toDeviceID) == this->messagesMap.end()) {
-      this->messagesMap.insert(
-          toDeviceID,
-          std::make_unique<DeliveryBrokerQueue>(
-              DELIVERY_BROKER_MAX_QUEUE_SIZE));
+    std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+        this->findQueue(toDeviceID);
+    if (deviceQueue == nullptr) {
+      return false;
+    }
+    DeliveryBrokerMessage message{
+        .messageID = messageID,
+        .deliveryTag = deliveryTag,
+        .channelGeneration = channelGeneration,
+        .fromDeviceID = fromDeviceID,
+        .payload = payload};
+    const size_t messageSize = getMessageMemorySize(message);
+    if (this->memoryUsage.fetch_add(messageSize) + messageSize >
+            DELIVERY_BROKER_MAX_MEMORY_USAGE ||
+        !deviceQueue->queue.write(std::move(message))) {
+      this->memoryUsage -= messageSize;
+      deviceQueue->overflowed = true;
+      this->droppedMessagesCount++;
+      LOG(WARNING) << "DeliveryBroker push: "
+                   << "Message " << messageID << " for " << toDeviceID
+                   << " was dropped, queue size: "
+                   << deviceQueue->queue.sizeGuess()
+                   << ", memory usage: " << this->memoryUsage;
+      return false;
     }
-    this->messagesMap.find(toDeviceID)
-        ->second->blockingWrite(DeliveryBrokerMessage{
-            .messageID = messageID,
-            .deliveryTag = deliveryTag,
-            .fromDeviceID = fromDeviceID,
-            .payload = payload});
+    if (deviceQueue->closed) {
+      // The queue was removed while we were writing to it, nobody is going
+      // to read it anymore.
+      this->drainQueue(*deviceQueue);
+      return false;
+    }
+    return true;
   } catch (const std::exception &e) {
     LOG(ERROR) << "DeliveryBroker push: "
                << "Got an exception " << e.what();
   }
+  return false;
 };
 
-bool DeliveryBroker::isEmpty(const std::string deviceID) {
-  if (this->messagesMap.find(deviceID) == this->messagesMap.end()) {
+bool DeliveryBroker::isEmpty(const std::string &deviceID) {
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue == nullptr) {
     return true;
   };
-  return this->messagesMap.find(deviceID)->second->isEmpty();
+  return deviceQueue->queue.isEmpty();
 };
 
-DeliveryBrokerMessage DeliveryBroker::pop(const std::string deviceID) {
-  try {
-    // If we don't already have a queue, insert it for the blocking read purpose
-    // in case we listen first before the insert happens.
-    if (this->messagesMap.find(deviceID) == this->messagesMap.end()) {
-      this->messagesMap.insert(
-          deviceID,
-          std::make_unique<DeliveryBrokerQueue>(
-              DELIVERY_BROKER_MAX_QUEUE_SIZE));
+bool DeliveryBroker::tryPop(
+    const std::string &deviceID,
+    DeliveryBrokerMessage &message,
+    const std::chrono::milliseconds timeout) {
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    // Queues are created only on subscription, without one there is nothing
+    // to read until the device subscribes.
+    std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+        this->findQueue(deviceID);
+    const std::chrono::steady_clock::time_point readDeadline = std::min(
+        deadline,
+        std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(DELIVERY_BROKER_POP_POLL_INTERVAL));
+    if (deviceQueue == nullptr) {
+      std::this_thread::sleep_until(readDeadline);
+    } else if (deviceQueue->queue.tryReadUntil(readDeadline, message)) {
+      this->releaseMessageMemory(message);
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
     }
+    // Otherwise the poll interval has passed, and we check the queue again,
+    // it might have been replaced in the meantime.
+  }
+};
+
+DeliveryBrokerMessage DeliveryBroker::pop(const std::string &deviceID) {
+  try {
     DeliveryBrokerMessage receievedMessage;
-    this->messagesMap.find(deviceID)->second->blockingRead(receievedMessage);
+    while (!this->tryPop(
+        deviceID,
+        receievedMessage,
+        std::chrono::milliseconds(DELIVERY_BROKER_POP_POLL_INTERVAL))) {
+    }
     return receievedMessage;
   } catch (const std::exception &e) {
     LOG(ERROR) << "DeliveryBroker pop: "
@@ -62,14 +190,64 @@ DeliveryBrokerMessage DeliveryBroker::pop(const std::string deviceID) {
   return {};
 };
 
-void DeliveryBroker::erase(const std::string deviceID) {
-  this->messagesMap.erase(deviceID);
+bool DeliveryBroker::checkAndResetOverflow(const std::string &deviceID) {
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue == nullptr) {
+    return false;
+  }
+  return deviceQueue->overflowed.exchange(false);
+};
+
+void DeliveryBroker::erase(const std::string &deviceID) {
+  std::scoped_lock lock{this->subscriptionMutex};
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue == nullptr) {
+    return;
+  }
+  // A queue with active subscribers is only cleared, it must stay registered
+  // to keep receiving new messages.
+  if (deviceQueue->subscribersCount == 0) {
+    this->messagesMap.erase_if_equal(deviceID, deviceQueue);
+    deviceQueue->closed = true;
+  }
+  this->drainQueue(*deviceQueue);
+};
+
+void DeliveryBroker::deleteQueueIfEmpty(const std::string &clientDeviceID) {
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(clientDeviceID);
+  if (deviceQueue != nullptr && deviceQueue->subscribersCount == 0 &&
+      deviceQueue->queue.isEmpty()) {
+    this->erase(clientDeviceID);
+  }
+};
+
+size_t DeliveryBroker::getQueueSize(const std::string &deviceID) {
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      this->findQueue(deviceID);
+  if (deviceQueue == nullptr) {
+    return 0;
+  }
+  return std::max<ssize_t>(deviceQueue->queue.sizeGuess(), 0);
 };
 
-void DeliveryBroker::deleteQueueIfEmpty(const std::string clientDeviceID) {
-  if (DeliveryBroker::getInstance().isEmpty(clientDeviceID)) {
-    DeliveryBroker::getInstance().erase(clientDeviceID);
+DeliveryBrokerStats DeliveryBroker::getStats() {
+  DeliveryBrokerStats stats{
+      .queuesCount = 0,
+      .messagesCount = 0,
+      .maxQueueDepth = 0,
+      .memoryUsage = this->memoryUsage,
+      .droppedMessagesCount = this->droppedMessagesCount};
+  for (const auto &deviceQueue : this->messagesMap) {
+    const size_t queueDepth =
+        std::max<ssize_t>(deviceQueue.second->queue.sizeGuess(), 0);
+    stats.queuesCount++;
+    stats.messagesCount += queueDepth;
+    stats.maxQueueDepth = std::max(stats.maxQueueDepth, queueDepth);
   }
+  return stats;
 };
 
 } // namespace network
@@ -5,6 +5,10 @@
 
 #include <folly/concurrency/ConcurrentHashMap.h>
 
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace comm {
@@ -12,21 +16,62 @@ namespace network {
 
 class DeliveryBroker {
 
-  folly::ConcurrentHashMap<std::string, std::unique_ptr<DeliveryBrokerQueue>>
+  folly::ConcurrentHashMap<
+      std::string,
+      std::shared_ptr<DeliveryBrokerDeviceQueue>>
       messagesMap;
+  std::atomic<size_t> memoryUsage{0};
+  std::atomic<uint64_t> droppedMessagesCount{0};
+  // Guards only queue creation and removal on (un)subscription, `push` and
+  // `pop` don't take it.
+  std::mutex subscriptionMutex;
+
+  // Must be called with `subscriptionMutex` held, readers and writers only
+  // look queues up.
+  std::shared_ptr<DeliveryBrokerDeviceQueue>
+  getOrCreateQueue(const std::string &deviceID);
+  std::shared_ptr<DeliveryBrokerDeviceQueue>
+  findQueue(const std::string &deviceID);
+  void drainQueue(DeliveryBrokerDeviceQueue &deviceQueue);
+  void releaseMessageMemory(const DeliveryBrokerMessage &message);
+  static size_t getMessageMemorySize(const DeliveryBrokerMessage &message);
 
 public:
   static DeliveryBroker &getInstance();
-  void push(
-      const std::string messageID,
+  // A device queue exists only while the device has an open `Get` stream on
+  // this instance. Messages for devices without a queue are not kept in
+  // memory, they are delivered from the database on the next connection.
+  // Returns the ID of the subscription, shared by the streams of the device
+  // on this instance until the last of them unsubscribes.
+  std::string subscribe(const std::string &deviceID);
+  // Returns `true` when the last subscriber has left and the queue was
+  // removed.
+  bool unsubscribe(const std::string &deviceID);
+  // Never blocks the caller (the AMQP consumer thread). Returns `false` when
+  // the message was not queued because the device is not subscribed, the
+  // device queue is full or the global memory budget is exhausted. Such a
+  // message has to be delivered from the database, in the overflow cases the
+  // device queue is marked as overflowed for that.
+  bool push(
+      const std::string &messageID,
       const uint64_t deliveryTag,
-      const std::string toDeviceID,
-      const std::string fromDeviceID,
-      const std::string payload);
-  bool isEmpty(const std::string deviceID);
-  DeliveryBrokerMessage pop(const std::string deviceID);
-  void erase(const std::string deviceID);
-  void deleteQueueIfEmpty(const std::string clientDeviceID);
+      const uint64_t channelGeneration,
+      const std::string &toDeviceID,
+      const std::string &fromDeviceID,
+      const std::string &payload);
+  bool isEmpty(const std::string &deviceID);
+  DeliveryBrokerMessage pop(const std::string &deviceID);
+  bool tryPop(
+      const std::string &deviceID,
+      DeliveryBrokerMessage &message,
+      const std::chrono::milliseconds timeout);
+  // Returns `true` once after messages for the device have been dropped
+  // since the last call.
+  bool checkAndResetOverflow(const std::string &deviceID);
+  void erase(const std::string &deviceID);
+  void deleteQueueIfEmpty(const std::string &clientDeviceID);
+  size_t getQueueSize(const std::string &deviceID);
+  DeliveryBrokerStats getStats();
 };
 
 } // namespace network
@@ -2,6 +2,7 @@
 
 #include <folly/MPMCQueue.h>
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -11,12 +12,44 @@ namespace network {
 struct DeliveryBrokerMessage {
   std::string messageID;
   uint64_t deliveryTag;
+  // Generation of the AMQP channel the delivery tag belongs to
+  uint64_t channelGeneration;
   std::string fromDeviceID;
   std::string payload;
   std::vector<std::string> blobHashes;
 };
 
-typedef folly::MPMCQueue<DeliveryBrokerMessage> DeliveryBrokerQueue;
+// Dynamic MPMCQueue starts with a small ring and grows up to its capacity,
+// so idle devices don't keep a fully preallocated queue in memory.
+typedef folly::MPMCQueue<DeliveryBrokerMessage, std::atomic, true>
+    DeliveryBrokerQueue;
+
+// Per-device queue shared between the AMQP consumer (writer) and the gRPC
+// `Get` streams of the device (readers). It is reference-counted, so erasing
+// it from the broker never destroys a queue that a reader is still waiting on;
+// the reader notices the `closed` flag and switches to the device's new queue.
+struct DeliveryBrokerDeviceQueue {
+  // Identifies the queue among the ones created for the device over time
+  const std::string subscriptionID;
+  DeliveryBrokerQueue queue;
+  std::atomic<bool> closed{false};
+  // Set when a message for the device could not be queued in memory. The
+  // reader must then reload undelivered messages from the database.
+  std::atomic<bool> overflowed{false};
+  std::atomic<size_t> subscribersCount{0};
+
+  DeliveryBrokerDeviceQueue(size_t capacity, std::string subscriptionID)
+      : subscriptionID(subscriptionID), queue(capacity) {
+  }
+};
+
+struct DeliveryBrokerStats {
+  size_t queuesCount;
+  size_t messagesCount;
+  size_t maxQueueDepth;
+  size_t memoryUsage;
+  uint64_t droppedMessagesCount;
+};
 
 } // namespace network
 } // namespace comm
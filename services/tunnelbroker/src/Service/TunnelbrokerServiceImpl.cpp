@@ -8,11 +8,58 @@
 #include "GlobalTools.h"
 #include "Tools.h"
 
+#include <folly/container/EvictingCacheMap.h>
 #include <glog/logging.h>
 
+#include <chrono>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <unordered_set>
+
 namespace comm {
 namespace network {
 
+namespace {
+
+struct CachedDevicePresence {
+  std::chrono::steady_clock::time_point expiresAt;
+  // Null when the device is offline
+  std::shared_ptr<database::DevicePresenceItem> devicePresenceItem;
+};
+
+std::mutex devicePresenceCacheMutex;
+folly::EvictingCacheMap<std::string, CachedDevicePresence>
+    devicePresenceCache(DEVICE_PRESENCE_CACHE_SIZE);
+
+// A burst of messages to a device only looks its presence up once. A stale
+// entry can route a message to where the device isn't connected anymore, or
+// leave it in the database only. The `Get` stream reloads the messages from
+// the database once the entries from before it started have expired.
+std::shared_ptr<database::DevicePresenceItem>
+findDevicePresenceItemCached(const std::string &deviceID) {
+  const auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(devicePresenceCacheMutex);
+    auto cachedIt = devicePresenceCache.find(deviceID);
+    if (cachedIt != devicePresenceCache.end() &&
+        cachedIt->second.expiresAt > now) {
+      return cachedIt->second.devicePresenceItem;
+    }
+  }
+  std::shared_ptr<database::DevicePresenceItem> devicePresenceItem =
+      database::DatabaseManager::getInstance().findDevicePresenceItem(deviceID);
+  std::lock_guard<std::mutex> lock(devicePresenceCacheMutex);
+  devicePresenceCache.set(
+      deviceID,
+      CachedDevicePresence{
+          now + std::chrono::milliseconds(DEVICE_PRESENCE_CACHE_TTL),
+          devicePresenceItem});
+  return devicePresenceItem;
+}
+
+} // namespace
+
 TunnelBrokerServiceImpl::TunnelBrokerServiceImpl() {
   Aws::InitAPI({});
   // List of AWS DynamoDB tables to check if they are created and can be
@@ -25,7 +72,9 @@ TunnelBrokerServiceImpl::TunnelBrokerServiceImpl() {
       config::ConfigManager::getInstance().getParameter(
           config::ConfigManager::OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE),
       config::ConfigManager::getInstance().getParameter(
-          config::ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE)};
+          config::ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE),
+      config::ConfigManager::getInstance().getParameter(
+          config::ConfigManager::OPTION_DYNAMODB_DEVICE_PRESENCE_TABLE)};
   for (const std::string &table : tablesList) {
     if (!database::DatabaseManager::getInstance().isTableAvailable(table)) {
       throw std::runtime_error(
@@ -75,32 +124,36 @@ grpc::Status TunnelBrokerServiceImpl::NewSession(
   const std::string publicKey = request->publickey();
   const std::string newSessionID = tools::generateUUID();
   try {
-    sessionSignItem =
-        database::DatabaseManager::getInstance().findSessionSignItem(deviceID);
+    // The lookups are independent, so they are issued concurrently
+    std::future<std::shared_ptr<database::SessionSignItem>>
+        sessionSignItemFuture = std::async(std::launch::async, [&deviceID]() {
+          return database::DatabaseManager::getInstance().findSessionSignItem(
+              deviceID);
+        });
+    std::future<std::shared_ptr<database::PublicKeyItem>> publicKeyItemFuture =
+        std::async(std::launch::async, [&deviceID]() {
+          return database::DatabaseManager::getInstance().findPublicKeyItem(
+              deviceID);
+        });
+    sessionSignItem = sessionSignItemFuture.get();
+    publicKeyItem = publicKeyItemFuture.get();
     if (sessionSignItem == nullptr) {
       return grpc::Status(
           grpc::StatusCode::NOT_FOUND, "Session sign request not found");
     }
-    publicKeyItem =
-        database::DatabaseManager::getInstance().findPublicKeyItem(deviceID);
-    if (publicKeyItem == nullptr) {
-      std::shared_ptr<database::PublicKeyItem> newPublicKeyItem =
-          std::make_shared<database::PublicKeyItem>(deviceID, publicKey);
-      database::DatabaseManager::getInstance().putPublicKeyItem(
-          *newPublicKeyItem);
-    } else if (publicKey != publicKeyItem->getPublicKey()) {
+    if (publicKeyItem != nullptr &&
+        publicKey != publicKeyItem->getPublicKey()) {
       return grpc::Status(
           grpc::StatusCode::PERMISSION_DENIED,
           "The public key doesn't match for deviceID");
     }
     const std::string verificationMessage = sessionSignItem->getSign();
-    if (!comm::network::crypto::rsaVerifyString(
-            publicKey, verificationMessage, signature)) {
+    if (!comm::network::crypto::verifyDeviceSignature(
+            deviceID, publicKey, verificationMessage, signature)) {
       return grpc::Status(
           grpc::StatusCode::PERMISSION_DENIED,
           "Signature for the verification message is not valid");
     }
-    database::DatabaseManager::getInstance().removeSessionSignItem(deviceID);
 
     deviceSessionItem = std::make_shared<database::DeviceSessionItem>(
         newSessionID,
@@ -110,7 +163,23 @@ grpc::Status TunnelBrokerServiceImpl::NewSession(
         tunnelbroker::NewSessionRequest_DeviceTypes_Name(request->devicetype()),
         request->deviceappversion(),
         request->deviceos());
+    // The public key is stored only after the signature is verified. The
+    // writes are independent as well.
+    std::vector<std::future<void>> writeFutures;
+    if (publicKeyItem == nullptr) {
+      writeFutures.push_back(
+          std::async(std::launch::async, [&deviceID, &publicKey]() {
+            database::DatabaseManager::getInstance().putPublicKeyItem(
+                database::PublicKeyItem(deviceID, publicKey));
+          }));
+    }
+    writeFutures.push_back(std::async(std::launch::async, [&deviceID]() {
+      database::DatabaseManager::getInstance().removeSessionSignItem(deviceID);
+    }));
     database::DatabaseManager::getInstance().putSessionItem(*deviceSessionItem);
+    for (std::future<void> &writeFuture : writeFutures) {
+      writeFuture.get();
+    }
   } catch (std::runtime_error &e) {
     LOG(ERROR) << "gRPC: "
                << "Error while processing 'NewSession' request: " << e.what();
@@ -148,7 +217,15 @@ grpc::Status TunnelBrokerServiceImpl::Send(
         request->payload(),
         "");
     database::DatabaseManager::getInstance().putMessageItem(message);
-    if (!AmqpManager::getInstance().send(&message)) {
+    std::shared_ptr<database::DevicePresenceItem> devicePresenceItem =
+        findDevicePresenceItemCached(request->todeviceid());
+    if (devicePresenceItem == nullptr) {
+      // The device is offline, the message will be delivered from the
+      // database on its next connection.
+      return grpc::Status::OK;
+    }
+    if (!AmqpManager::getInstance().send(
+            &message, devicePresenceItem->getInstanceID())) {
       LOG(ERROR) << "gRPC: "
                  << "Error while publish the message to AMQP";
       return grpc::Status(
@@ -184,16 +261,37 @@ grpc::Status TunnelBrokerServiceImpl::Get(
     const std::string clientDeviceID = sessionItem->getDeviceID();
     DeliveryBrokerMessage messageToDeliver;
 
-    std::vector<std::shared_ptr<database::MessageItem>> messagesFromDatabase =
-        database::DatabaseManager::getInstance().findMessageItemsByReceiver(
-            clientDeviceID);
-    if (messagesFromDatabase.size() > 0) {
-      // When a client connects and requests GET for the messages first we check
-      // if there are undelivered messages in the database. If so, we are
-      // erasing the messages to deliver from rabbitMQ which are handled by
-      // DeliveryBroker.
-      DeliveryBroker::getInstance().erase(clientDeviceID);
-    }
+    // We subscribe before reading the database, so the messages which arrive
+    // in the meantime are queued and not lost. Messages that are both in the
+    // database and in the queue are delivered only once using the
+    // `deliveredMessageIDs` set, which holds the messages delivered from the
+    // database until their queued copy arrives or can't arrive anymore.
+    const std::string subscriptionID =
+        DeliveryBroker::getInstance().subscribe(clientDeviceID);
+    const std::string tunnelbrokerID =
+        config::ConfigManager::getInstance().getParameter(
+            config::ConfigManager::OPTION_TUNNELBROKER_ID);
+    auto closeStream = [&clientDeviceID, &subscriptionID]() {
+      // Other streams of the same device on this instance still need the
+      // messages to be routed here. A stream subscribed after this one left
+      // has put the presence with a new subscription ID, which is kept.
+      if (DeliveryBroker::getInstance().unsubscribe(clientDeviceID)) {
+        database::DatabaseManager::getInstance().removeDevicePresenceItem(
+            clientDeviceID, subscriptionID);
+      }
+    };
+    std::unordered_set<std::string> deliveredMessageIDs;
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>>
+        deliveredMessageIDsByTime;
+    auto pruneDeliveredMessageIDs = [&]() {
+      const auto now = std::chrono::steady_clock::now();
+      while (!deliveredMessageIDsByTime.empty() &&
+             now - deliveredMessageIDsByTime.front().first >
+                 std::chrono::milliseconds(DELIVERED_MESSAGE_IDS_RETENTION)) {
+        deliveredMessageIDs.erase(deliveredMessageIDsByTime.front().second);
+        deliveredMessageIDsByTime.pop_front();
+      }
+    };
     tunnelbroker::GetResponse response;
     auto respondToWriter =
         [&writer, &response](std::string fromDeviceID, std::string payload) {
@@ -205,26 +303,81 @@ grpc::Status TunnelBrokerServiceImpl::Get(
           }
           response.Clear();
         };
-    for (auto &messageFromDatabase : messagesFromDatabase) {
-      respondToWriter(
-          messageFromDatabase->getFromDeviceID(),
-          messageFromDatabase->getPayload());
-      database::DatabaseManager::getInstance().removeMessageItem(
-          clientDeviceID, messageFromDatabase->getMessageID());
-    }
-    while (1) {
-      messageToDeliver = DeliveryBroker::getInstance().pop(clientDeviceID);
-      respondToWriter(messageToDeliver.fromDeviceID, messageToDeliver.payload);
-      comm::network::AmqpManager::getInstance().ack(
-          messageToDeliver.deliveryTag);
-      database::DatabaseManager::getInstance().removeMessageItem(
-          clientDeviceID, messageToDeliver.messageID);
-      // If messages queue for `clientDeviceID` is empty we don't need to store
-      // `folly::MPMCQueue` for it and need to free memory to fix possible
-      // 'ghost' queues in DeliveryBroker.
-      // We call `deleteQueueIfEmpty()` for this purpose here.
-      DeliveryBroker::getInstance().deleteQueueIfEmpty(clientDeviceID);
+    auto deliverMessagesFromDatabase = [&]() {
+      std::vector<std::shared_ptr<database::MessageItem>>
+          messagesFromDatabase =
+              database::DatabaseManager::getInstance()
+                  .findMessageItemsByReceiver(clientDeviceID);
+      for (auto &messageFromDatabase : messagesFromDatabase) {
+        if (!deliveredMessageIDs.insert(messageFromDatabase->getMessageID())
+                 .second) {
+          continue;
+        }
+        deliveredMessageIDsByTime.emplace_back(
+            std::chrono::steady_clock::now(),
+            messageFromDatabase->getMessageID());
+        respondToWriter(
+            messageFromDatabase->getFromDeviceID(),
+            messageFromDatabase->getPayload());
+        database::DatabaseManager::getInstance().removeMessageItem(
+            clientDeviceID, messageFromDatabase->getMessageID());
+      }
+    };
+    try {
+      // From now on the messages for the device are routed to this instance.
+      database::DatabaseManager::getInstance().putDevicePresenceItem(
+          database::DevicePresenceItem(
+              clientDeviceID, tunnelbrokerID, subscriptionID));
+      deliverMessagesFromDatabase();
+      // Until the cached presences from before this stream expire, messages
+      // may still be left in the database only (see `Send`)
+      const auto presenceCacheExpiresAt = std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(DEVICE_PRESENCE_CACHE_TTL);
+      bool presenceCacheExpired = false;
+      while (!context->IsCancelled()) {
+        pruneDeliveredMessageIDs();
+        if (!presenceCacheExpired &&
+            std::chrono::steady_clock::now() >= presenceCacheExpiresAt) {
+          presenceCacheExpired = true;
+          deliverMessagesFromDatabase();
+        }
+        // Messages which didn't fit into the DeliveryBroker were left in the
+        // database only.
+        if (DeliveryBroker::getInstance().checkAndResetOverflow(
+                clientDeviceID)) {
+          deliverMessagesFromDatabase();
+        }
+        if (!DeliveryBroker::getInstance().tryPop(
+                clientDeviceID,
+                messageToDeliver,
+                std::chrono::milliseconds(DELIVERY_BROKER_POP_POLL_INTERVAL))) {
+          continue;
+        }
+        // The message is acked also when the delivery fails, it's still in
+        // the database, so it isn't lost and doesn't hold a prefetch slot
+        // until the channel reconnects
+        try {
+          // Its queued copy can only arrive once
+          if (!deliveredMessageIDs.erase(messageToDeliver.messageID)) {
+            respondToWriter(
+                messageToDeliver.fromDeviceID, messageToDeliver.payload);
+            database::DatabaseManager::getInstance().removeMessageItem(
+                clientDeviceID, messageToDeliver.messageID);
+          }
+        } catch (std::runtime_error &e) {
+          comm::network::AmqpManager::getInstance().ack(
+              messageToDeliver.deliveryTag,
+              messageToDeliver.channelGeneration);
+          throw;
+        }
+        comm::network::AmqpManager::getInstance().ack(
+            messageToDeliver.deliveryTag, messageToDeliver.channelGeneration);
+      }
+    } catch (std::runtime_error &e) {
+      closeStream();
+      throw;
     }
+    closeStream();
   } catch (std::runtime_error &e) {
     LOG(ERROR) << "gRPC: "
                << "Error while processing 'Get' request: " << e.what();
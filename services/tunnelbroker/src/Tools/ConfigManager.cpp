@@ -13,8 +13,10 @@ const std::string ConfigManager::OPTION_TUNNELBROKER_ID =
 const std::string ConfigManager::OPTION_DEFAULT_KEYSERVER_ID =
     "keyserver.default_keyserver_id";
 const std::string ConfigManager::OPTION_AMQP_URI = "amqp.uri";
-const std::string ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE =
-    "amqp.fanout_exchange_name";
+const std::string ConfigManager::OPTION_AMQP_DIRECT_EXCHANGE =
+    "amqp.direct_exchange_name";
+const std::string ConfigManager::OPTION_AMQP_PREFETCH_COUNT =
+    "amqp.prefetch_count";
 const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_TABLE =
     "dynamodb.sessions_table_name";
 const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE =
@@ -23,6 +25,8 @@ const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE =
     "dynamodb.sessions_public_key_table_name";
 const std::string ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE =
     "dynamodb.messages_table_name";
+const std::string ConfigManager::OPTION_DYNAMODB_DEVICE_PRESENCE_TABLE =
+    "dynamodb.device_presence_table_name";
 
 ConfigManager &ConfigManager::getInstance() {
   static ConfigManager instance;
@@ -60,10 +64,15 @@ void ConfigManager::loadConfigFile(const std::string configFilePath) {
         boost::program_options::value<std::string>()->required(),
         "AMQP URI connection string");
     description.add_options()(
-        this->OPTION_AMQP_FANOUT_EXCHANGE.c_str(),
+        this->OPTION_AMQP_DIRECT_EXCHANGE.c_str(),
         boost::program_options::value<std::string>()->default_value(
-            AMQP_FANOUT_EXCHANGE_NAME),
-        "AMQP Fanout exchange name");
+            AMQP_DIRECT_EXCHANGE_NAME),
+        "AMQP Direct exchange name");
+    description.add_options()(
+        this->OPTION_AMQP_PREFETCH_COUNT.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(AMQP_DEFAULT_PREFETCH_COUNT)),
+        "AMQP consumer prefetch count");
     description.add_options()(
         this->OPTION_DYNAMODB_SESSIONS_TABLE.c_str(),
         boost::program_options::value<std::string>()->default_value(
@@ -84,6 +93,11 @@ void ConfigManager::loadConfigFile(const std::string configFilePath) {
         boost::program_options::value<std::string>()->default_value(
             MESSAGES_TABLE_NAME),
         "DynamoDB table name for messages");
+    description.add_options()(
+        this->OPTION_DYNAMODB_DEVICE_PRESENCE_TABLE.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            DEVICE_PRESENCE_TABLE_NAME),
+        "DynamoDB table name for devices presence");
 
     boost::program_options::parsed_options parsedDescription =
         boost::program_options::parse_config_file(
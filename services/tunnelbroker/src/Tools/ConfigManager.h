@@ -17,11 +17,13 @@ public:
   static const std::string OPTION_TUNNELBROKER_ID;
   static const std::string OPTION_DEFAULT_KEYSERVER_ID;
   static const std::string OPTION_AMQP_URI;
-  static const std::string OPTION_AMQP_FANOUT_EXCHANGE;
+  static const std::string OPTION_AMQP_DIRECT_EXCHANGE;
+  static const std::string OPTION_AMQP_PREFETCH_COUNT;
   static const std::string OPTION_DYNAMODB_SESSIONS_TABLE;
   static const std::string OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE;
   static const std::string OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE;
   static const std::string OPTION_DYNAMODB_MESSAGES_TABLE;
+  static const std::string OPTION_DYNAMODB_DEVICE_PRESENCE_TABLE;
 
   static ConfigManager &getInstance();
   void load();
@@ -1,14 +1,84 @@
 #include "CryptoTools.h"
+#include "Constants.h"
 
 #include <cryptopp/base64.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/rsa.h>
+#include <cryptopp/xed25519.h>
+#include <folly/container/EvictingCacheMap.h>
 #include <glog/logging.h>
 
+#include <memory>
+#include <mutex>
+
 namespace comm {
 namespace network {
 namespace crypto {
 
+namespace {
+
+struct CachedPublicKey {
+  std::string publicKeyBase64;
+  bool isEd25519;
+  CryptoPP::RSA::PublicKey rsaPublicKey;
+  CryptoPP::ed25519::Verifier ed25519Verifier;
+};
+
+std::mutex publicKeysCacheMutex;
+folly::EvictingCacheMap<std::string, std::shared_ptr<const CachedPublicKey>>
+    publicKeysCache(CRYPTO_PUBLIC_KEYS_CACHE_SIZE);
+
+std::string base64Decode(const std::string &encoded) {
+  std::string decoded;
+  CryptoPP::StringSource stringSource(
+      encoded,
+      true,
+      new CryptoPP::Base64Decoder(new CryptoPP::StringSink(decoded)));
+  return decoded;
+}
+
+std::shared_ptr<const CachedPublicKey>
+parsePublicKey(const std::string &publicKeyBase64) {
+  std::shared_ptr<CachedPublicKey> publicKey =
+      std::make_shared<CachedPublicKey>();
+  publicKey->publicKeyBase64 = publicKeyBase64;
+  const std::string decodedPublicKey = base64Decode(publicKeyBase64);
+  publicKey->isEd25519 =
+      decodedPublicKey.size() == CryptoPP::ed25519Verifier::PUBLIC_KEYLENGTH;
+  if (publicKey->isEd25519) {
+    publicKey->ed25519Verifier = CryptoPP::ed25519::Verifier(
+        reinterpret_cast<const CryptoPP::byte *>(decodedPublicKey.data()));
+  } else {
+    CryptoPP::StringSource publicKeySource(decodedPublicKey, true);
+    publicKey->rsaPublicKey.Load(publicKeySource.Ref());
+  }
+  return publicKey;
+}
+
+bool verifyWithPublicKey(
+    const CachedPublicKey &publicKey,
+    const std::string &message,
+    const std::string &signatureBase64) {
+  const std::string decodedSignature = base64Decode(signatureBase64);
+  const unsigned char *messageData =
+      reinterpret_cast<const unsigned char *>(message.c_str());
+  const unsigned char *signatureData =
+      reinterpret_cast<const unsigned char *>(decodedSignature.c_str());
+  if (publicKey.isEd25519) {
+    return publicKey.ed25519Verifier.VerifyMessage(
+        messageData,
+        message.length(),
+        signatureData,
+        decodedSignature.length());
+  }
+  CryptoPP::RSASSA_PKCS1v15_SHA_Verifier verifierSha256(
+      publicKey.rsaPublicKey);
+  return verifierSha256.VerifyMessage(
+      messageData, message.length(), signatureData, decodedSignature.length());
+}
+
+} // namespace
+
 bool rsaVerifyString(
     const std::string &publicKeyBase64,
     const std::string &message,
@@ -37,6 +107,54 @@ bool rsaVerifyString(
   }
 }
 
+bool ed25519VerifyString(
+    const std::string &publicKeyBase64,
+    const std::string &message,
+    const std::string &signatureBase64) {
+  try {
+    std::shared_ptr<const CachedPublicKey> publicKey =
+        parsePublicKey(publicKeyBase64);
+    if (!publicKey->isEd25519) {
+      return false;
+    }
+    return verifyWithPublicKey(*publicKey, message, signatureBase64);
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "CryptoTools: "
+               << "Got an exception " << e.what();
+    return false;
+  }
+}
+
+bool verifyDeviceSignature(
+    const std::string &deviceID,
+    const std::string &publicKeyBase64,
+    const std::string &message,
+    const std::string &signatureBase64) {
+  try {
+    std::shared_ptr<const CachedPublicKey> publicKey;
+    {
+      std::scoped_lock lock{publicKeysCacheMutex};
+      auto cachedPublicKey = publicKeysCache.find(deviceID);
+      if (cachedPublicKey != publicKeysCache.end() &&
+          cachedPublicKey->second->publicKeyBase64 == publicKeyBase64) {
+        publicKey = cachedPublicKey->second;
+      }
+    }
+    if (publicKey == nullptr) {
+      // Parsing is done outside of the lock, the verification of an uncached
+      // key doesn't block the others
+      publicKey = parsePublicKey(publicKeyBase64);
+      std::scoped_lock lock{publicKeysCacheMutex};
+      publicKeysCache.set(deviceID, publicKey);
+    }
+    return verifyWithPublicKey(*publicKey, message, signatureBase64);
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "CryptoTools: "
+               << "Got an exception " << e.what();
+    return false;
+  }
+}
+
 } // namespace crypto
 } // namespace network
 } // namespace comm
@@ -11,6 +11,20 @@ bool rsaVerifyString(
     const std::string &message,
     const std::string &signatureBase64);
 
+bool ed25519VerifyString(
+    const std::string &publicKeyBase64,
+    const std::string &message,
+    const std::string &signatureBase64);
+
+// Verifies the signature with the device public key, which can be either an
+// RSA key or a raw 32 bytes Ed25519 key. Parsed keys are cached by deviceID,
+// so repeated verifications for the same device skip decoding the key.
+bool verifyDeviceSignature(
+    const std::string &deviceID,
+    const std::string &publicKeyBase64,
+    const std::string &message,
+    const std::string &signatureBase64);
+
 } // namespace crypto
 } // namespace network
 } // namespace comm
@@ -37,13 +37,21 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnStaticData) {
       "6d37StvXBzfJoZVU79UeOF2bFvb3DNoArEOe";
   const database::MessageItem messageItem{
       messageID, fromDeviceID, toDeviceID, payload, ""};
-  EXPECT_EQ(AmqpManager::getInstance().send(&messageItem), true);
+  DeliveryBroker::getInstance().subscribe(toDeviceID);
+  EXPECT_EQ(
+      AmqpManager::getInstance().send(
+          &messageItem,
+          config::ConfigManager::getInstance().getParameter(
+              config::ConfigManager::OPTION_TUNNELBROKER_ID)),
+      true);
   DeliveryBrokerMessage receivedMessage =
       DeliveryBroker::getInstance().pop(toDeviceID);
   EXPECT_EQ(messageID, receivedMessage.messageID);
   EXPECT_EQ(fromDeviceID, receivedMessage.fromDeviceID);
   EXPECT_EQ(payload, receivedMessage.payload);
-  AmqpManager::getInstance().ack(receivedMessage.deliveryTag);
+  AmqpManager::getInstance().ack(
+      receivedMessage.deliveryTag, receivedMessage.channelGeneration);
+  DeliveryBroker::getInstance().unsubscribe(toDeviceID);
 }
 
 TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
@@ -55,7 +63,13 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
   const std::string payload = tools::generateRandomString(512);
   const database::MessageItem messageItem{
       messageID, fromDeviceID, toDeviceID, payload, ""};
-  EXPECT_EQ(AmqpManager::getInstance().send(&messageItem), true);
+  DeliveryBroker::getInstance().subscribe(toDeviceID);
+  EXPECT_EQ(
+      AmqpManager::getInstance().send(
+          &messageItem,
+          config::ConfigManager::getInstance().getParameter(
+              config::ConfigManager::OPTION_TUNNELBROKER_ID)),
+      true);
   DeliveryBrokerMessage receivedMessage =
       DeliveryBroker::getInstance().pop(toDeviceID);
   EXPECT_EQ(messageID, receivedMessage.messageID)
@@ -70,5 +84,7 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
       << "Generated Payload \"" << payload
       << "\" differs from what was got from amqp message "
       << receivedMessage.payload;
-  AmqpManager::getInstance().ack(receivedMessage.deliveryTag);
+  AmqpManager::getInstance().ack(
+      receivedMessage.deliveryTag, receivedMessage.channelGeneration);
+  DeliveryBroker::getInstance().unsubscribe(toDeviceID);
 }
@@ -43,3 +43,72 @@ TEST(CryptoToolsTest, RsaVerifyStringIsFalseOnInvalidSignature) {
           publicKeyBase64, verifyMessage, invalidSignatureBase64),
       false);
 }
+
+TEST(CryptoToolsTest, Ed25519VerifyStringIsTrueOnValidSignature) {
+  const std::string publicKeyBase64 =
+      "+V6Tu9p5QmERLT7zH+fIIVN/wq31qpt9rgqnduu5tiQ=";
+  const std::string verifyMessage = "testverifymessagetestverifymessage";
+  const std::string validSignatureBase64 =
+      "qVxffa9ivbwr6YK+3yaWPKLcnBJ7tHr4fI9ZhgDHeyK+DzyajxFZeLh+XzBKVkXR59IlZ2wi"
+      "CuzNhhNC/Z0GDg==";
+  EXPECT_EQ(
+      crypto::ed25519VerifyString(
+          publicKeyBase64, verifyMessage, validSignatureBase64),
+      true);
+}
+
+TEST(CryptoToolsTest, Ed25519VerifyStringIsFalseOnInvalidSignature) {
+  const std::string publicKeyBase64 =
+      "+V6Tu9p5QmERLT7zH+fIIVN/wq31qpt9rgqnduu5tiQ=";
+  const std::string verifyMessage = "testverifymessagetestverifymessage";
+  const std::string invalidSignatureBase64 =
+      "rVxffa9ivbwr6YK+3yaWPKLcnBJ7tHr4fI9ZhgDHeyK+DzyajxFZeLh+XzBKVkXR59IlZ2wi"
+      "CuzNhhNC/Z0GDg==";
+  EXPECT_EQ(
+      crypto::ed25519VerifyString(
+          publicKeyBase64, verifyMessage, invalidSignatureBase64),
+      false);
+}
+
+TEST(CryptoToolsTest, VerifyDeviceSignatureHandlesBothKeyTypesAndKeyChange) {
+  const std::string deviceID =
+      "mobile:EMQNoQ7b2ueEmQ4QsevRWlXxFCNt055y20T1PHdoYAQRt0S6TLzZWNM6XSvdWqxm";
+  const std::string verifyMessage = "testverifymessagetestverifymessage";
+  const std::string rsaPublicKeyBase64 =
+      "MIGfMA0GCSqGSIb3DQEBAQUAA4GNADCBiQKBgQDGC8M8FdRSSEdfAufY/V5iP6cB"
+      "crXdeZa19OjpbbNvq9qAT2FobnYrlNI8p3y/2LvJBxlR9VlvS0Nh4HLZLdmf8zOf"
+      "3HyN0w8ey54xE5eIILZi1Xudrk8J+U5xij78Bzl2WdAvoVCiVbaodff8DBvmqHeR"
+      "/EDcMX3ipPDzjcCFXwIDAQAB";
+  const std::string rsaSignatureBase64 =
+      "tn5w317+CcuUdK8JRvM0GW+m65ph7sHqlbpY5PhYZtl1hlb86ILgmlCaa+"
+      "O7icLImcLQkVsabCaVkczrJOy95jvT251gAKBZAXc4oDNqg4n5An3GmwHzbh50Z40M9gwXG/"
+      "zx6ReEYvgqDo9e1cimljewFykHt8ApBX6mbJ8ShyM=";
+  const std::string ed25519PublicKeyBase64 =
+      "+V6Tu9p5QmERLT7zH+fIIVN/wq31qpt9rgqnduu5tiQ=";
+  const std::string ed25519SignatureBase64 =
+      "qVxffa9ivbwr6YK+3yaWPKLcnBJ7tHr4fI9ZhgDHeyK+DzyajxFZeLh+XzBKVkXR59IlZ2wi"
+      "CuzNhhNC/Z0GDg==";
+  // The second call for the same key is served from the cache
+  for (size_t i = 0; i < 2; ++i) {
+    EXPECT_EQ(
+        crypto::verifyDeviceSignature(
+            deviceID, rsaPublicKeyBase64, verifyMessage, rsaSignatureBase64),
+        true);
+  }
+  EXPECT_EQ(
+      crypto::verifyDeviceSignature(
+          deviceID,
+          rsaPublicKeyBase64,
+          verifyMessage,
+          ed25519SignatureBase64),
+      false);
+  // A different key for the same device must not be verified with the cached
+  // one
+  EXPECT_EQ(
+      crypto::verifyDeviceSignature(
+          deviceID,
+          ed25519PublicKeyBase64,
+          verifyMessage,
+          ed25519SignatureBase64),
+      true);
+}
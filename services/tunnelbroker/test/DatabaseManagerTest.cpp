@@ -293,6 +293,40 @@ TEST_F(DatabaseManagerTest, PutAndFoundPublicKeyItemsGeneratedDataIsSame) {
       item.getDeviceID());
 }
 
+TEST_F(DatabaseManagerTest, PutAndFoundDevicePresenceItemGeneratedDataIsSame) {
+  const database::DevicePresenceItem item(
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      "tunnelbroker-" + tools::generateRandomString(8),
+      tools::generateUUID());
+  EXPECT_EQ(
+      database::DatabaseManager::getInstance().isTableAvailable(
+          item.getTableName()),
+      true);
+  database::DatabaseManager::getInstance().putDevicePresenceItem(item);
+  std::shared_ptr<database::DevicePresenceItem> foundItem =
+      database::DatabaseManager::getInstance().findDevicePresenceItem(
+          item.getDeviceID());
+  EXPECT_NE(foundItem, nullptr);
+  EXPECT_EQ(item.getInstanceID(), foundItem->getInstanceID())
+      << "Generated InstanceID \"" << item.getInstanceID()
+      << "\" differs from what is found in the database "
+      << foundItem->getInstanceID();
+  EXPECT_EQ(item.getSubscriptionID(), foundItem->getSubscriptionID());
+  // Removal by another subscription must not affect the presence
+  database::DatabaseManager::getInstance().removeDevicePresenceItem(
+      item.getDeviceID(), tools::generateUUID());
+  EXPECT_NE(
+      database::DatabaseManager::getInstance().findDevicePresenceItem(
+          item.getDeviceID()),
+      nullptr);
+  database::DatabaseManager::getInstance().removeDevicePresenceItem(
+      item.getDeviceID(), item.getSubscriptionID());
+  EXPECT_EQ(
+      database::DatabaseManager::getInstance().findDevicePresenceItem(
+          item.getDeviceID()),
+      nullptr);
+}
+
 TEST_F(DatabaseManagerTest, PutAndFoundByReceiverMessageItemsDataIsSame) {
   const std::string receiverID =
       "mobile:"
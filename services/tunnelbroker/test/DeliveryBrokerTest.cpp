@@ -29,9 +29,11 @@ TEST(DeliveryBrokerTest, CheckPushAndPopOnStaticValues) {
           "iGhpnX7Hp4xpBL3h2IkvGviDRQ98UvW0ugwUuPxm1NOQpjLG5dPoqQ0jrMst0Bl5rgPw"
           "ajjNGsUWmp9r0ST0wRQXrQcY30PoSoqKSlCEgFMLzHWLrPQ86QFyCICismGSe7iBIqdD"
           "6d37StvXBzfJoZVU79UeOF2bFvb3DNoArEOe"};
+  DeliveryBroker::getInstance().subscribe(toDeviceID);
   DeliveryBroker::getInstance().push(
       message.messageID,
       message.deliveryTag,
+      message.channelGeneration,
       toDeviceID,
       message.fromDeviceID,
       message.payload);
@@ -41,6 +43,7 @@ TEST(DeliveryBrokerTest, CheckPushAndPopOnStaticValues) {
   EXPECT_EQ(message.deliveryTag, receivedMessage.deliveryTag);
   EXPECT_EQ(message.fromDeviceID, receivedMessage.fromDeviceID);
   EXPECT_EQ(message.payload, receivedMessage.payload);
+  DeliveryBroker::getInstance().unsubscribe(toDeviceID);
 }
 
 TEST(DeliveryBrokerTest, CheckPushAndPopOnGeneratedValues) {
@@ -52,9 +55,11 @@ TEST(DeliveryBrokerTest, CheckPushAndPopOnGeneratedValues) {
       .fromDeviceID =
           "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
       .payload = tools::generateRandomString(512)};
+  DeliveryBroker::getInstance().subscribe(toDeviceID);
   DeliveryBroker::getInstance().push(
       message.messageID,
       message.deliveryTag,
+      message.channelGeneration,
       toDeviceID,
       message.fromDeviceID,
       message.payload);
@@ -72,6 +77,7 @@ TEST(DeliveryBrokerTest, CheckPushAndPopOnGeneratedValues) {
   EXPECT_EQ(message.payload, receivedMessage.payload)
       << "Generated Payload \"" << message.payload
       << "\" differs from what was received " << receivedMessage.payload;
+  DeliveryBroker::getInstance().unsubscribe(toDeviceID);
 }
 
 TEST(DeliveryBrokerTest, IsEmptyShoudBeFalseAfterPush) {
@@ -94,13 +100,16 @@ TEST(DeliveryBrokerTest, IsEmptyShoudBeFalseAfterPush) {
           "ajjNGsUWmp9r0ST0wRQXrQcY30PoSoqKSlCEgFMLzHWLrPQ86QFyCICismGSe7iBIqdD"
           "6d37StvXBzfJoZVU79UeOF2bFvb3DNoArEOe"};
   EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+  DeliveryBroker::getInstance().subscribe(deviceID);
   DeliveryBroker::getInstance().push(
       message.messageID,
       message.deliveryTag,
+      message.channelGeneration,
       deviceID,
       message.fromDeviceID,
       message.payload);
   EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), false);
+  DeliveryBroker::getInstance().unsubscribe(deviceID);
 }
 
 TEST(DeliveryBrokerTest, ShouldBeEmptyAfterErase) {
@@ -122,13 +131,88 @@ TEST(DeliveryBrokerTest, ShouldBeEmptyAfterErase) {
           "iGhpnX7Hp4xpBL3h2IkvGviDRQ98UvW0ugwUuPxm1NOQpjLG5dPoqQ0jrMst0Bl5rgPw"
           "ajjNGsUWmp9r0ST0wRQXrQcY30PoSoqKSlCEgFMLzHWLrPQ86QFyCICismGSe7iBIqdD"
           "6d37StvXBzfJoZVU79UeOF2bFvb3DNoArEOe"};
+  DeliveryBroker::getInstance().subscribe(deviceID);
   DeliveryBroker::getInstance().push(
       message.messageID,
       message.deliveryTag,
+      message.channelGeneration,
       deviceID,
       message.fromDeviceID,
       message.payload);
   EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), false);
   DeliveryBroker::getInstance().erase(deviceID);
   EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+  DeliveryBroker::getInstance().unsubscribe(deviceID);
+}
+
+TEST(DeliveryBrokerTest, PushShouldBeRejectedWithoutSubscription) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          tools::generateUUID(),
+          1,
+          1,
+          deviceID,
+          "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+          tools::generateRandomString(512)),
+      false);
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+}
+
+TEST(DeliveryBrokerTest, PushShouldNotBlockWhenQueueIsFull) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  DeliveryBroker::getInstance().subscribe(deviceID);
+  for (size_t i = 0; i < DELIVERY_BROKER_MAX_QUEUE_SIZE; ++i) {
+    EXPECT_EQ(
+        DeliveryBroker::getInstance().push(
+            tools::generateUUID(),
+            i,
+            1,
+            deviceID,
+            fromDeviceID,
+            tools::generateRandomString(64)),
+        true);
+  }
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().getQueueSize(deviceID),
+      DELIVERY_BROKER_MAX_QUEUE_SIZE);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().checkAndResetOverflow(deviceID), false);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          tools::generateUUID(),
+          DELIVERY_BROKER_MAX_QUEUE_SIZE,
+          1,
+          deviceID,
+          fromDeviceID,
+          tools::generateRandomString(64)),
+      false);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().checkAndResetOverflow(deviceID), true);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().checkAndResetOverflow(deviceID), false);
+  DeliveryBroker::getInstance().unsubscribe(deviceID);
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+  EXPECT_EQ(DeliveryBroker::getInstance().getStats().memoryUsage, 0u);
+}
+
+TEST(DeliveryBrokerTest, SubscriptionIDChangesOnlyAfterLastUnsubscribe) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string firstSubscriptionID =
+      DeliveryBroker::getInstance().subscribe(deviceID);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().subscribe(deviceID), firstSubscriptionID);
+  EXPECT_EQ(DeliveryBroker::getInstance().unsubscribe(deviceID), false);
+  EXPECT_EQ(DeliveryBroker::getInstance().unsubscribe(deviceID), true);
+  // A stream subscribing after the last one left must not share the
+  // presence with it
+  const std::string secondSubscriptionID =
+      DeliveryBroker::getInstance().subscribe(deviceID);
+  EXPECT_NE(secondSubscriptionID, firstSubscriptionID);
+  DeliveryBroker::getInstance().unsubscribe(deviceID);
 }